@@ -0,0 +1,43 @@
+# FindLZ4.cmake
+
+# Find liblz4
+#
+# This module defines
+# LZ4_LIBRARY, the name of the library to link against
+# LZ4_FOUND, if false, do not try to link against liblz4
+# LZ4_INCLUDE_DIR, where to find lz4frame.h
+#
+
+find_path(LZ4_INCLUDE_DIR
+  NAMES lz4frame.h
+  PATHS
+    /usr/local/include
+    /usr/include
+    /usr/local/opt/lz4/include
+)
+
+find_library(LZ4_LIBRARY
+  NAMES lz4 liblz4
+  PATHS
+    /usr/local/lib
+    /usr/lib
+    /usr/local/opt/lz4/lib
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LZ4
+    REQUIRED_VARS LZ4_LIBRARY LZ4_INCLUDE_DIR
+)
+
+if(LZ4_FOUND AND NOT TARGET LZ4::LZ4)
+    add_library(LZ4::LZ4 UNKNOWN IMPORTED)
+    set_target_properties(LZ4::LZ4 PROPERTIES
+        IMPORTED_LOCATION "${LZ4_LIBRARY}"
+        INTERFACE_INCLUDE_DIRECTORIES "${LZ4_INCLUDE_DIR}"
+    )
+endif()
+
+mark_as_advanced(
+  LZ4_INCLUDE_DIR
+  LZ4_LIBRARY
+) 
\ No newline at end of file
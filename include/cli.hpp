@@ -1,12 +1,15 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <vector>
 
 struct CLIOptions {
-    std::string command;        // backup, restore, list, verify
+    std::string command;        // backup, restore, list, verify, train-dictionary, bench, recompress
     std::string configPath;     // Path to config file
     std::string backupType;     // full, incremental
-    std::string compression;    // none, gzip
+    std::string compression;    // none or a format name; empty keeps the config's setting
+    std::string compressionLevel;  // low, medium, high; empty keeps the config's setting
     std::string dbType;         // postgres, mysql, sqlite
     std::string dbHost;         // Database host
     int dbPort;                // Database port
@@ -14,15 +17,18 @@ struct CLIOptions {
     std::string dbUser;         // Database username
     std::string dbPass;         // Database password
     std::string dbFile;         // SQLite database file path
-    std::string restorePath;    // Path to backup file for restore
+    std::string restorePath;    // Path to backup file for restore, verify or bench
+    std::vector<int> benchThreads;  // Thread counts to benchmark; empty = 1 and all cores
+    size_t benchSampleMB;       // Uncompressed MB of the input to benchmark on
+    bool json;                  // Print results as JSON instead of a table
+    double maxRateMBps;         // recompress: cap on data decoded per second, 0 = unlimited
     bool verbose;               // Enable verbose output
     bool skipArg2;             // Whether to skip the second argument in option parsing
 
-    CLIOptions() : dbPort(0), verbose(false), skipArg2(false) {
+    CLIOptions() : dbPort(0), benchSampleMB(256), json(false), maxRateMBps(0.0), verbose(false), skipArg2(false) {
         const char* home = getenv("HOME");
         configPath = std::string(home ? home : "") + "/.config/hegemon/config.json"; // Default config path
         backupType = "full";  // Default backup type
-        compression = "gzip";  // Default compression
     }
 };
 
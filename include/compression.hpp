@@ -4,9 +4,23 @@
 #include "error/DatabaseBackupError.hpp"
 #include <string>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
 
 namespace dbbackup {
 
+class Sha256;
+class ErasedStage;
+
+/// Receives a chunk of stream data. Returns false to abort the stream.
+using DataSink = std::function<bool(const char* data, size_t size)>;
+
+/// Pushes a complete stream into the given sink. Returns true on success.
+using DataProducer = std::function<bool(const DataSink& sink)>;
+
 enum class CompressionLevel {
     Low,
     Medium,
@@ -15,8 +29,20 @@ enum class CompressionLevel {
 
 enum class CompressionFormat {
     Gzip,
+    IndexedGzip,  // Independent gzip members plus a block index; inflates in parallel
+    Zstd,
     Bzip2,
-    Xz
+    Xz,
+    Lz4,          // LZ4 frame format; fastest codec, lowest ratio
+    Auto          // Picks one of the above by sampling the data
+};
+
+/// Codec and level picked by "auto" mode, with what the sample measured
+struct CompressionProfile {
+    std::string format;
+    std::string level;
+    double ratio = 1.0;            // Compressed size / input size
+    double throughputMBps = 0.0;   // Estimated for the configured thread count
 };
 
 class Compressor {
@@ -31,26 +57,200 @@ public:
     /// Returns true on success.
     bool decompressFile(const std::string& inputPath, const std::string& outputPath) const;
 
-    /// Get the estimated compressed size for a given input size
+    /// Compresses everything the producer pushes, writes to outputPath.
+    /// Used to compress dump output as it is produced, without a staging file.
+    /// Returns true on success.
+    bool compressStream(const DataProducer& producer, const std::string& outputPath) const;
+
+    /// Compresses everything the producer pushes into output: a file descriptor, a pipe,
+    /// a memory buffer or another stage (see the sources and sinks below). With a digest,
+    /// the compressed output is hashed into it on its way out, as the file's checksum.
+    /// Returns true on success.
+    bool compressStream(const DataProducer& producer, const DataSink& output,
+                        Sha256* digest = nullptr) const;
+
+    /// Decompresses the file at inputPath, pushing the output into sink as it is produced.
+    /// Used to feed a restore client directly, without an uncompressed staging file.
+    /// Returns true on success.
+    bool decompressStream(const std::string& inputPath, const DataSink& sink) const;
+
+    /// Decompresses the compressed stream input pushes, e.g. from a pipe. Decoders that
+    /// seek (indexed gzip, block-split gzip and xz) read it front to back instead.
+    /// Returns true on success.
+    bool decompressStream(const DataProducer& input, const DataSink& sink) const;
+
+    /// Compresses everything the producer pushes as a zstd patch against the uncompressed
+    /// file at referencePath (zstd --patch-from), writes to outputPath. Only what differs
+    /// from the reference costs space. Runs the codec alone, without the SQL transform.
+    /// Throws ConfigurationError unless the format is zstd. Returns true on success.
+    bool compressDelta(const DataProducer& producer, const std::string& referencePath,
+                       const std::string& outputPath) const;
+
+    /// As above, writing the patch into output and hashing it into digest if given
+    bool compressDelta(const DataProducer& producer, const std::string& referencePath,
+                       const DataSink& output, Sha256* digest = nullptr) const;
+
+    /// Decompresses a file written by compressDelta, given the same reference.
+    /// Returns true on success.
+    bool decompressDelta(const std::string& inputPath, const std::string& referencePath,
+                         const DataSink& sink) const;
+
+    /// Largest reference compressDelta can reach back over (0 without zstd support)
+    static size_t maxDeltaReferenceSize();
+
+    /// Get the estimated compressed size for a given input size.
+    /// Uses the measured ratio once "auto" mode has sampled the data.
     size_t estimateCompressedSize(size_t inputSize) const;
 
-    /// Get the file extension for the current compression format
+    /// Get the file extension for the current compression format.
+    /// Empty in "auto" mode until a codec has been picked.
     std::string getFileExtension() const;
 
+    /// In "auto" mode, picks the codec by compressing a sample from the start of inputPath.
+    /// Does nothing for fixed formats or once a codec has been picked.
+    void selectForFile(const std::string& inputPath) const;
+
+    /// The codec "auto" mode picked, or nullptr before sampling and for fixed formats
+    const CompressionProfile* getSelectedProfile() const;
+
+    /// True if the file was written in the indexed gzip format
+    static bool isIndexedGzip(const std::string& path);
+
+    /// Identifies a compressed file by its magic bytes.
+    /// Returns the config format name (e.g. "gzip", "zstd"), or "" if not compressed.
+    static std::string detectFormat(const std::string& path);
+
+    /// Concrete formats this build can write (everything but "auto")
+    static std::vector<std::string> availableFormats();
+
 private:
+    CompressionConfig settings;  // As configured; "auto" builds its chosen codec from it
     CompressionFormat format;
     CompressionLevel level;
+    size_t threads;  // Resolved worker count, always >= 1
+    bool longDistance;
+    size_t blockSize;  // xz block size, 0 = liblzma default
+    bool passthrough;  // gzip: store high-entropy blocks instead of deflating them
+    bool sqlTransform;  // Run the SQL column transform ahead of the codec
+    mutable std::optional<CompressionProfile> selected;  // Set once "auto" has sampled
     
-    // Helper functions for different compression formats
-    bool compressGzip(const std::string& inputPath, const std::string& outputPath) const;
-    bool decompressGzip(const std::string& inputPath, const std::string& outputPath) const;
-    
+    // The one place a format maps to its codec: builds the encoder or decoder stage
+    // (see codec_pipeline.hpp) and hands it to run, returning what run returns. Decoders
+    // that can seek a file to decode blocks in parallel do so through decodeFile().
+    template <typename Run>
+    bool withEncoder(Run&& run) const;
+    template <typename Run>
+    bool withDecoder(Run&& run) const;
+
+    // The same stages type-erased, for "auto" to pick one mid-stream
+    std::unique_ptr<ErasedStage> encoderStage() const;
+    std::unique_ptr<ErasedStage> decoderStage() const;
+
+    // Compresses sample with every available codec and records the best one that
+    // keeps up with the configured target throughput
+    void selectFromSample(const std::vector<char>& sample) const;
+
+    // Config for the codec "auto" mode picked
+    CompressionConfig selectedConfig() const;
+
     // Convert string format to enum
     static CompressionFormat stringToFormat(const std::string& format);
     static CompressionLevel stringToLevel(const std::string& level);
     
     // Get compression level for zlib based on CompressionLevel
     int getZlibLevel() const;
+
+    // Get compression level for zstd based on CompressionLevel
+    int getZstdLevel() const;
+
+    // Get preset for xz based on CompressionLevel
+    uint32_t getXzPreset() const;
+
+    // Get block size (in 100KB units) for bzip2 based on CompressionLevel
+    int getBzip2BlockSize() const;
+
+    // Get compression level for LZ4 based on CompressionLevel
+    int getLz4Level() const;
 };
 
+/// Push-style compression: write() data as it becomes available, then finish().
+/// The codec runs on its own thread, which is also where output is called from.
+/// The compressor must outlive the writer.
+class CompressionWriter {
+public:
+    CompressionWriter(const Compressor& compressor, DataSink output);
+
+    /// Abandons the stream if finish() was not called
+    ~CompressionWriter();
+
+    CompressionWriter(const CompressionWriter&) = delete;
+    CompressionWriter& operator=(const CompressionWriter&) = delete;
+
+    /// Queues data for the codec, blocking while it is behind.
+    /// Returns false once the stream has failed; finish() reports why.
+    bool write(const char* data, size_t size);
+
+    /// Waits until the codec has taken everything written so far.
+    /// Codecs still hold their last partial block until finish().
+    bool flush();
+
+    /// Ends the stream and waits for the codec's last output.
+    /// Rethrows whatever the codec threw; returns true on success.
+    bool finish();
+
+    /// This writer as the output of another stage
+    DataSink asSink();
+
+private:
+    struct Pipe;
+    std::unique_ptr<Pipe> pipe;
+};
+
+/// Pull-style decompression: read() hands out decompressed bytes as the caller wants them.
+/// The codec runs on its own thread, a bounded number of chunks ahead of the reader.
+/// The compressor must outlive the reader.
+class DecompressionReader {
+public:
+    /// Reads the compressed file at inputPath
+    DecompressionReader(const Compressor& compressor, const std::string& inputPath);
+
+    /// Reads the compressed stream input pushes, e.g. fdSource() on a pipe
+    DecompressionReader(const Compressor& compressor, DataProducer input);
+
+    /// Stops the codec if the stream was not read to the end
+    ~DecompressionReader();
+
+    DecompressionReader(const DecompressionReader&) = delete;
+    DecompressionReader& operator=(const DecompressionReader&) = delete;
+
+    /// Copies up to capacity decompressed bytes into buffer. Returns 0 at the end of the
+    /// stream; throws CompressionError (or whatever the codec threw) if decompression failed.
+    size_t read(char* buffer, size_t capacity);
+
+private:
+    struct Pipe;
+    std::unique_ptr<Pipe> pipe;
+
+    void start(std::function<bool(const DataSink& sink)> run);
+};
+
+// Sources and sinks for the stream API. Descriptors and buffers stay owned by the caller
+// and must outlive the producer or sink made from them.
+
+/// Pushes a file's contents in chunkSize pieces, mapped or read ahead asynchronously where the
+/// platform allows (see io_engine.hpp); throws CompressionError if it can't be opened
+DataProducer fileSource(const std::string& path, size_t chunkSize = 1024 * 1024);
+
+/// Pushes everything read from a file descriptor (file, pipe, socket) until end of file
+DataProducer fdSource(int fd, size_t chunkSize = 64 * 1024);
+
+/// Pushes a buffer in one piece
+DataProducer memorySource(const char* data, size_t size);
+
+/// Writes everything to a file descriptor, retrying short and interrupted writes
+DataSink fdSink(int fd);
+
+/// Appends everything to a buffer
+DataSink memorySink(std::vector<char>& buffer);
+
 } // namespace dbbackup 
\ No newline at end of file
@@ -37,6 +37,8 @@ struct StorageConfig {
     std::string cloudProvider;
     std::string cloudPath;
     BackupConfig* backup = nullptr;  // Pointer to backup config for retention settings
+    int spaceWaitSeconds = 3600;     // How long a job queues for space other jobs have reserved
+    int minReservationMB = 1024;     // Reserved for a backup when nothing says how large it will be
 };
 
 struct LoggingConfig {
@@ -48,8 +50,16 @@ struct LoggingConfig {
 
 struct CompressionConfig {
     bool enabled = false;
-    std::string format = "gzip";  // gzip, bzip2, xz
+    std::string format = "gzip";  // gzip, gzip-indexed, zstd, bzip2, xz, lz4, auto
     std::string level = "medium"; // low, medium, high
+    int threads = 0;              // Compression workers, 0 = hardware concurrency
+    bool longDistance = false;    // zstd long-distance matching (128MB window) for large dumps
+    size_t blockSize = 0;         // xz block size in bytes, 0 = liblzma default (3x dictionary)
+    double targetThroughput = 100.0;  // MB/s the codec picked by "auto" must sustain
+    bool passthrough = true;      // gzip: store high-entropy blocks (JPEG, PDF, ...) raw
+    bool dictionary = false;      // zstd: compress with the newest trained dictionary
+    std::string dictionaryDir;    // Trained zstd dictionaries, default <storage.localPath>/dictionaries
+    std::string transform = "none";  // none, sql: lay out COPY/INSERT rows column-wise before the codec
 };
 
 struct RetentionConfig {
@@ -63,6 +73,10 @@ struct ScheduleConfig {
 };
 
 struct BackupConfig {
+    bool streaming = true;   // Pipe dump output straight into the compressor
+    bool delta = false;      // Compress each full backup against the previous one (zstd)
+    int deltaChainLength = 7;  // Deltas in a row before the next self-contained backup
+    std::string ioMode = "buffered";  // buffered, dropbehind, direct: keep backup I/O out of the page cache
     CompressionConfig compression;
     RetentionConfig retention;
     ScheduleConfig schedule;
@@ -2,6 +2,8 @@
 #include "db_connection.hpp"
 #include "compression.hpp"
 #include "storage.hpp"
+#include "checksum.hpp"
+#include "io_engine.hpp"
 #include "logging.hpp"
 #include "notifications.hpp"
 #include "error/ErrorUtils.hpp"
@@ -10,6 +12,7 @@
 #include <chrono>
 #include <ctime>
 #include <filesystem>
+#include <fstream>
 
 using namespace dbbackup::error;  // Add this line to bring error types into scope
 
@@ -49,6 +52,7 @@ bool BackupManager::backup(const std::string& backupType) {
         // Get logger
         auto logger = getLogger();
         logger->info("Starting {} backup...", backupType);
+        logger->debug("File I/O engine: {}", dbbackup::ioBackendName());
 
         // Create and validate connection
         auto conn = createConnection();
@@ -77,44 +81,166 @@ bool BackupManager::backup(const std::string& backupType) {
         // Create temporary file path with unique name
         std::string tempPath = m_config.storage.localPath + "/.tmp_" + backupFileName + ".dump";
         
-        // Final backup path
-        std::string finalPath = m_config.storage.localPath + "/" + backupFileName + 
-                               (m_config.backup.compression.enabled ? ".dump.gz" : ".dump");
-
-        // Remove any existing temporary files
-        if (std::filesystem::exists(tempPath)) {
-            std::filesystem::remove(tempPath);
+        // Final backup path ("auto" compression only knows its extension once it has
+        // sampled the dump; the file is committed under the one it chose)
+        std::string dumpPath = m_config.storage.localPath + "/" + backupFileName + ".dump";
+        std::string finalPath = dumpPath + (compressor ? compressor->getFileExtension() : "");
+
+        // Every backup is catalogued, with the checksum taken as it was written. In
+        // delta mode the dump is compressed against the previous backup, rebuilt as a
+        // plain dump, and the catalog records which backup that was.
+        LocalStorage catalog(m_config.storage);
+        std::string deltaBase;
+        std::string referencePath = scratchPath(m_config.storage.localPath, "reference_" + backupFileName + ".dump");
+
+        // Neither the rebuilt reference nor the raw dump outlives the backup, however it ends
+        ScratchFiles scratch;
+        scratch.paths.push_back(referencePath);
+        scratch.paths.push_back(tempPath);
+
+        if (compressor && m_config.backup.delta) {
+            deltaBase = catalog.deltaBase(static_cast<size_t>(m_config.backup.deltaChainLength));
         }
 
-        // Perform backup to temporary file
-        if (!conn->createBackup(tempPath)) {
-            DB_THROW(BackupError, "Failed to create backup at: " + tempPath);
+        // A previous dump too large to delta against isn't rebuilt: the database's estimate
+        // rules it out up front, and the rebuild stops as soon as it passes the limit
+        uint64_t databaseSize = conn->estimatedBackupSize();
+        uint64_t maxReferenceSize = dbbackup::Compressor::maxDeltaReferenceSize();
+        bool referenceTooLarge = !deltaBase.empty() && databaseSize > maxReferenceSize;
+        if (!deltaBase.empty() && !referenceTooLarge) {
+            uint64_t referenceSize = 0;
+            try {
+                std::ofstream reference(referencePath, std::ios::binary | std::ios::trunc);
+                bool rebuilt = catalog.streamBackup(deltaBase, m_config.backup.compression,
+                    [&reference, &referenceSize, maxReferenceSize](const char* data, size_t size) {
+                        referenceSize += size;
+                        return referenceSize <= maxReferenceSize && static_cast<bool>(reference.write(data, size));
+                    });
+                reference.close();
+                referenceTooLarge = referenceSize > maxReferenceSize;
+                if (!referenceTooLarge && (!rebuilt || !reference)) {
+                    DB_THROW(StorageError, "Failed to rebuild previous backup: " + deltaBase);
+                }
+            } catch (const std::exception& e) {
+                referenceTooLarge = referenceSize > maxReferenceSize;
+                if (!referenceTooLarge) {
+                    DB_THROW(BackupError, std::string("Backup failed: ") + e.what());
+                }
+            }
+        }
+        if (referenceTooLarge) {
+            logger->info("Previous backup is too large to delta against; writing a self-contained backup");
+            std::filesystem::remove(referencePath);
+            deltaBase.clear();
         }
 
-        bool success = false;
-        try {
-            if (compressor) {
-                // Try to compress directly to final location
-                success = compressor->compressFile(tempPath, finalPath);
-                if (!success) {
-                    DB_THROW(CompressionError, "Failed to compress backup file");
+        // Space to reserve for a backup whose size isn't known until it is written: the
+        // last catalogued backup of the same kind with a margin, else the database's
+        // estimate of its dump (compressed, when compressing), else the configured minimum
+        uint64_t minimumSize = static_cast<uint64_t>(m_config.storage.minReservationMB) * 1024 * 1024;
+        auto expectedSize = [&](bool compressed) -> uint64_t {
+            uint64_t previousSize = 0;
+            for (const BackupMetadata& previous : catalog.listBackups()) {
+                if (previous.base.empty() == deltaBase.empty()) {
+                    previousSize = previous.size + previous.size / 10;
                 }
-            } else {
-                // Move uncompressed file to final location
-                std::filesystem::rename(tempPath, finalPath);
-                success = true;
             }
-        } catch (const std::exception& e) {
-            // Clean up temporary file
+            if (previousSize > 0) {
+                return previousSize;
+            }
+            if (databaseSize > 0) {
+                return compressed ? compressor->estimateCompressedSize(databaseSize) : databaseSize;
+            }
+            return minimumSize;
+        };
+
+        // Compresses producer's output to finalPath, as a delta when there is a base,
+        // taking the catalog checksum in the same pass. reserveBytes (0 to skip) is
+        // reserved in the storage ledger and preallocated first, so a backup that won't
+        // fit waits for or fails on space up front rather than part way through.
+        std::string checksum;
+        auto compressTo = [&](const dbbackup::DataProducer& producer, uint64_t reserveBytes) {
+            std::unique_ptr<SpaceReservation> space;
+            if (reserveBytes > 0) {
+                space = std::make_unique<SpaceReservation>(m_config.storage, finalPath, reserveBytes);
+            }
+            BackupFileWriter output(finalPath);
+            if (space) {
+                output.preallocate(space->size());
+            }
+            dbbackup::Sha256 digest;
+            bool compressed = deltaBase.empty()
+                                  ? compressor->compressStream(producer, output.asSink(), &digest)
+                                  : compressor->compressDelta(producer, referencePath, output.asSink(), &digest);
+            if (compressed) {
+                // "auto" knows the extension now that the dump is compressed
+                finalPath = dumpPath + compressor->getFileExtension();
+                output.finish(finalPath);
+                checksum = digest.finish();
+            }
+            return compressed;
+        };
+
+        if (compressor && m_config.backup.streaming) {
+            // Compress dump output as it arrives so the raw dump never reaches disk
+            bool success = false;
+            try {
+                success = compressTo([&conn](const dbbackup::DataSink& sink) { return conn->streamBackup(sink); },
+                                     expectedSize(true));
+            } catch (const std::exception& e) {
+                std::filesystem::remove(finalPath);
+                DB_THROW(BackupError, std::string("Backup failed: ") + e.what());
+            }
+            if (!success) {
+                std::filesystem::remove(finalPath);
+                DB_THROW(BackupError, "Failed to stream backup to: " + finalPath);
+            }
+        } else {
+            // Remove any existing temporary files
             if (std::filesystem::exists(tempPath)) {
                 std::filesystem::remove(tempPath);
             }
-            DB_THROW(BackupError, std::string("Backup failed: ") + e.what());
+
+            bool success = false;
+            try {
+                // Perform backup to temporary file, in space reserved for the raw dump (the
+                // catalog only knows compressed sizes when compressing)
+                {
+                    uint64_t dumpSize = !compressor ? expectedSize(false)
+                                                    : databaseSize > 0 ? databaseSize : minimumSize;
+                    std::unique_ptr<SpaceReservation> space;
+                    if (dumpSize > 0) {
+                        space = std::make_unique<SpaceReservation>(m_config.storage, tempPath, dumpSize);
+                    }
+                    if (!conn->createBackup(tempPath)) {
+                        DB_THROW(BackupError, "Failed to create backup at: " + tempPath);
+                    }
+                }
+
+                if (compressor) {
+                    // A file can be sampled up front, so "auto" needs no read-ahead
+                    if (deltaBase.empty()) {
+                        compressor->selectForFile(tempPath);
+                    }
+                    success = compressTo(dbbackup::fileSource(tempPath),
+                                         compressor->estimateCompressedSize(std::filesystem::file_size(tempPath)));
+                    if (!success) {
+                        DB_THROW(CompressionError, "Failed to compress backup file");
+                    }
+                } else {
+                    // Move uncompressed file to final location, synced before it has the name
+                    commitFile(tempPath, finalPath);
+                    success = true;
+                }
+            } catch (const std::exception& e) {
+                DB_THROW(BackupError, std::string("Backup failed: ") + e.what());
+            }
         }
 
-        // Clean up temporary file
-        if (std::filesystem::exists(tempPath)) {
-            std::filesystem::remove(tempPath);
+        if (compressor && compressor->getSelectedProfile()) {
+            const dbbackup::CompressionProfile* profile = compressor->getSelectedProfile();
+            logger->info("Auto compression chose {} ({}): sampled ratio {:.2f} at {:.0f} MB/s",
+                         profile->format, profile->level, profile->ratio, profile->throughputMBps);
         }
 
         // Verify backup exists
@@ -122,6 +248,12 @@ bool BackupManager::backup(const std::string& backupType) {
             DB_THROW(StorageError, "Backup file not found after creation: " + finalPath);
         }
 
+        // An uncompressed dump was written by the database tool, so only it is read for its checksum
+        catalog.registerBackup(finalPath, deltaBase, checksum);
+        if (!deltaBase.empty()) {
+            logger->info("Stored as a delta against {}", deltaBase);
+        }
+
         // Disconnect database
         if (!conn->disconnect()) {
             logger->warn("Failed to disconnect from database");
@@ -140,10 +272,14 @@ bool BackupManager::backup(const std::string& backupType) {
 }
 
 bool BackupManager::restore(const std::string& backupPath) {
-    // Create compressor outside the macro if compression is enabled
+    // Create compressor outside the macro for whatever codec wrote the file,
+    // so backups made under a different compression config still restore
     std::unique_ptr<dbbackup::Compressor> compressor;
-    if (m_config.backup.compression.enabled) {
-        compressor = std::make_unique<dbbackup::Compressor>(m_config.backup.compression);
+    std::string detectedFormat = dbbackup::Compressor::detectFormat(backupPath);
+    if (!detectedFormat.empty()) {
+        dbbackup::CompressionConfig readConfig = m_config.backup.compression;
+        readConfig.format = detectedFormat;
+        compressor = std::make_unique<dbbackup::Compressor>(readConfig);
     }
 
     DB_TRY_CATCH_LOG("BackupManager", {
@@ -164,29 +300,54 @@ bool BackupManager::restore(const std::string& backupPath) {
             DB_THROW(ConnectionError, "Failed to connect to database");
         }
 
-        // Decompress if needed
-        std::string restorePath = backupPath;
-        if (compressor) {
-            std::string uncompressedPath = backupPath;
-            size_t extPos = backupPath.find(compressor->getFileExtension());
-            if (extPos != std::string::npos) {
-                uncompressedPath = backupPath.substr(0, extPos);
-                if (!compressor->decompressFile(backupPath, uncompressedPath)) {
+        bool isCompressed = compressor != nullptr;
+        bool isDelta = isCompressed && isDeltaBackup(backupPath);  // Rebuilt through its chain
+
+        if (isCompressed && m_config.backup.streaming) {
+            // Decompress straight into the restore client, with no uncompressed copy on disk
+            bool restored = conn->streamRestore([&](const BackupSink& sink) {
+                return isDelta ? streamBackupChain(backupPath, m_config.backup.compression, sink)
+                               : compressor->decompressStream(backupPath, sink);
+            });
+            if (!restored) {
+                DB_THROW(RestoreError, "Failed to restore from backup: " + backupPath);
+            }
+        } else {
+            // Decompress if needed
+            std::string restorePath = backupPath;
+            if (isCompressed) {
+                std::string uncompressedPath = std::filesystem::path(backupPath).replace_extension().string();
+                if (uncompressedPath == backupPath) {
+                    uncompressedPath += ".restore";
+                }
+                bool decompressed = false;
+                if (isDelta) {
+                    std::ofstream uncompressed(uncompressedPath, std::ios::binary);
+                    decompressed = streamBackupChain(backupPath, m_config.backup.compression,
+                        [&uncompressed](const char* data, size_t size) {
+                            return static_cast<bool>(uncompressed.write(data, size));
+                        });
+                    uncompressed.close();
+                    decompressed = decompressed && !uncompressed.fail();
+                } else {
+                    decompressed = compressor->decompressFile(backupPath, uncompressedPath);
+                }
+                if (!decompressed) {
                     DB_THROW(CompressionError, "Failed to decompress backup file");
                 }
                 restorePath = uncompressedPath;
             }
-        }
 
-        // Perform restore
-        if (!conn->restoreBackup(restorePath)) {
-            DB_THROW(RestoreError, "Failed to restore from backup: " + restorePath);
-        }
+            // Perform restore
+            if (!conn->restoreBackup(restorePath)) {
+                DB_THROW(RestoreError, "Failed to restore from backup: " + restorePath);
+            }
 
-        // Clean up decompressed file if we created one
-        if (restorePath != backupPath) {
-            if (!std::filesystem::remove(restorePath)) {
-                logger->warn("Failed to remove temporary decompressed file: {}", restorePath);
+            // Clean up decompressed file if we created one
+            if (restorePath != backupPath) {
+                if (!std::filesystem::remove(restorePath)) {
+                    logger->warn("Failed to remove temporary decompressed file: {}", restorePath);
+                }
             }
         }
 
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "codec_pipeline.hpp"
+#include "error/ErrorUtils.hpp"
+#include <cstddef>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <openssl/evp.h>
+
+namespace dbbackup {
+
+/// Incremental SHA-256, as catalog checksums are taken and rewritten backups compared
+class Sha256 {
+public:
+    Sha256() : ctx(EVP_MD_CTX_new()) {
+        if (!ctx) {
+            DB_THROW(error::StorageError, "Failed to create message digest context");
+        }
+        if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1) {
+            EVP_MD_CTX_free(ctx);
+            DB_THROW(error::StorageError, "Failed to initialize message digest");
+        }
+    }
+
+    ~Sha256() { EVP_MD_CTX_free(ctx); }
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void update(const char* data, size_t size) {
+        if (EVP_DigestUpdate(ctx, data, size) != 1) {
+            DB_THROW(error::StorageError, "Failed to update message digest");
+        }
+    }
+
+    /// Lowercase hex digest
+    std::string finish() {
+        unsigned char hash[EVP_MAX_MD_SIZE];
+        unsigned int hashLen;
+        if (EVP_DigestFinal_ex(ctx, hash, &hashLen) != 1) {
+            DB_THROW(error::StorageError, "Failed to finalize message digest");
+        }
+
+        std::stringstream ss;
+        for (unsigned int i = 0; i < hashLen; i++) {
+            ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+        }
+        return ss.str();
+    }
+
+private:
+    EVP_MD_CTX* ctx;
+};
+
+/// Codec pipeline stage that passes bytes through unchanged, hashing them into digest.
+/// Chained behind a codec it checksums the file being written in the same pass.
+class ChecksumStage {
+public:
+    explicit ChecksumStage(Sha256& digest) : digest(&digest) {}
+
+    void init() {}
+
+    template <typename Out>
+    void process(ByteSpan input, Out& out) {
+        digest->update(input.data, input.size);
+        out(input.data, input.size);
+    }
+
+    template <typename Out>
+    void finish(Out&) {}
+
+private:
+    Sha256* digest;
+};
+
+} // namespace dbbackup
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "../include/compression.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dbbackup {
+
+/// Bounded queue handing stream chunks from one thread to another. push() blocks
+/// while the queue is full and fails once the reader has closed the channel.
+class ChunkChannel {
+public:
+    explicit ChunkChannel(size_t capacity) : capacity(capacity) {}
+
+    bool push(std::vector<char> chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return closed || chunks.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        chunks.push_back(std::move(chunk));
+        changed.notify_all();
+        return true;
+    }
+
+    /// Returns false once the writer has finished and the queue is drained
+    bool pop(std::vector<char>& chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return finished || !chunks.empty(); });
+        if (chunks.empty()) {
+            return false;
+        }
+        chunk = std::move(chunks.front());
+        chunks.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        changed.notify_all();
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        changed.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::deque<std::vector<char>> chunks;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool finished = false;
+    bool closed = false;
+};
+
+/// Runs a producer on its own thread, feeding a channel
+class ProducerThread {
+public:
+    ProducerThread(const DataProducer& producer, ChunkChannel& channel) : channel(channel) {
+        worker = std::thread([this, &producer]() {
+            try {
+                produced = producer([this](const char* data, size_t size) {
+                    return this->channel.push(std::vector<char>(data, data + size));
+                });
+            } catch (...) {
+                error = std::current_exception();
+            }
+            this->channel.finish();
+        });
+    }
+
+    ~ProducerThread() {
+        if (worker.joinable()) {
+            channel.close();
+            worker.join();
+        }
+    }
+
+    /// Waits for the producer and rethrows anything it threw
+    bool join() {
+        channel.close();
+        worker.join();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return produced;
+    }
+
+private:
+    ChunkChannel& channel;
+    std::thread worker;
+    bool produced = false;
+    std::exception_ptr error;
+};
+
+} // namespace dbbackup
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <sstream>
 
 using namespace dbbackup::error;
 
@@ -17,7 +18,11 @@ void CLI::printUsage() {
               << "  backup, -backup      Create a new backup\n"
               << "  restore, -restore    Restore from a backup\n"
               << "  list, -list         List available backups\n"
-              << "  verify, -verify     Verify a backup file\n\n"
+              << "  verify, -verify     Verify a backup file\n"
+              << "  train-dictionary    Train a zstd dictionary from recent backups\n"
+              << "  recompress          Rewrite older backups with a denser codec, in the background\n"
+              << "  bench compression <file>\n"
+              << "                      Measure every codec, level and thread count on a backup or sample\n\n"
               << "Database Types:\n"
               << "  mysql               MySQL database\n"
               << "  postgres            PostgreSQL database\n"
@@ -30,6 +35,12 @@ void CLI::printUsage() {
               << "  -n, --name <dbname>    Database name\n"
               << "  -u, --user <user>      Database username\n"
               << "  -f, --file <path>      SQLite database file path\n"
+              << "  --threads <n,n,...>    bench: thread counts to try (default: 1 and all cores)\n"
+              << "  --sample-size <MB>     bench: uncompressed MB of the file to use (default: 256)\n"
+              << "  --json                 bench: print results as JSON\n"
+              << "  --to <format>          recompress: codec to rewrite backups with (default: the config's)\n"
+              << "  --level <level>        recompress: low|medium|high (default: the config's)\n"
+              << "  --max-rate <MB/s>      recompress: cap on data decoded per second (default: unlimited)\n"
               << "  --verbose              Enable verbose output\n"
               << "  --help                 Show this help message\n\n"
               << "Examples:\n"
@@ -44,7 +55,13 @@ void CLI::printUsage() {
               << "  # Restore from backup:\n"
               << "  " << argv[0] << " restore backup_20240222.dump.gz\n\n"
               << "  # List backups:\n"
-              << "  " << argv[0] << " list\n";
+              << "  " << argv[0] << " list\n\n"
+              << "  # Train a dictionary for small SQLite backups:\n"
+              << "  " << argv[0] << " train-dictionary sqlite\n\n"
+              << "  # Move old gzip backups to zstd without starving the database:\n"
+              << "  " << argv[0] << " recompress postgres --to zstd --level high --max-rate 50\n\n"
+              << "  # Compare codecs on last night's backup:\n"
+              << "  " << argv[0] << " bench compression backup_20240222.dump.zst --threads 1,8\n";
 }
 
 CLIOptions CLI::parse() {
@@ -102,6 +119,28 @@ CLIOptions CLI::parse() {
                 }
             }
         }
+        else if (cmd == "train-dictionary") {
+            options.command = "train-dictionary";
+            // Like list, next argument could be database type
+            if (argc > 2 && argv[2][0] != '-') {
+                std::string dbType = argv[2];
+                if (dbType == "mysql" || dbType == "postgres" || dbType == "sqlite") {
+                    options.dbType = dbType;
+                    options.configPath = std::string(getenv("HOME")) + "/.config/hegemon/" + dbType + "_config.json";
+                }
+            }
+        }
+        else if (cmd == "recompress") {
+            options.command = "recompress";
+            // Like list, next argument could be database type
+            if (argc > 2 && argv[2][0] != '-') {
+                std::string dbType = argv[2];
+                if (dbType == "mysql" || dbType == "postgres" || dbType == "sqlite") {
+                    options.dbType = dbType;
+                    options.configPath = std::string(getenv("HOME")) + "/.config/hegemon/" + dbType + "_config.json";
+                }
+            }
+        }
         else if (cmd == "verify") {
             options.command = "verify";
             // For verify command, next argument is the backup file path
@@ -111,17 +150,30 @@ CLIOptions CLI::parse() {
                 options.skipArg2 = true;
             }
         }
+        else if (cmd == "bench") {
+            options.command = "bench";
+            // bench <target> <file>; codecs are the only target so far
+            if (argc < 4 || argv[2][0] == '-' || argv[3][0] == '-') {
+                DB_THROW(ValidationError, "Usage: bench compression <backup or sample file>");
+            }
+            if (std::string(argv[2]) != "compression") {
+                DB_THROW(ValidationError, "Unknown bench target: " + std::string(argv[2]));
+            }
+            options.restorePath = argv[3];
+        }
         else {
             DB_THROW(ValidationError, "Unknown command: " + cmd);
         }
 
         // Parse remaining options
-        for (int i = 2; i < argc; i++) {
+        int firstOption = options.command == "bench" ? 4 : 2;
+        for (int i = firstOption; i < argc; i++) {
             std::string arg = argv[i];
             
             // Skip if this is a database type argument we already processed
             if (i == 2 && (
-                (arg[0] != '-' && (options.command == "backup" || options.command == "list")) ||
+                (arg[0] != '-' && (options.command == "backup" || options.command == "list" ||
+                                   options.command == "train-dictionary" || options.command == "recompress")) ||
                 options.skipArg2
             )) {
                 continue;
@@ -151,6 +203,46 @@ CLIOptions CLI::parse() {
             else if ((arg == "-c" || arg == "--config") && i + 1 < argc) {
                 options.configPath = argv[++i];
             }
+            else if (arg == "--threads" && i + 1 < argc) {
+                std::stringstream list(argv[++i]);
+                std::string count;
+                while (std::getline(list, count, ',')) {
+                    int threads = std::stoi(count);
+                    if (threads < 1) {
+                        DB_THROW(ValidationError, "Thread counts must be at least 1");
+                    }
+                    options.benchThreads.push_back(threads);
+                }
+            }
+            else if (arg == "--sample-size" && i + 1 < argc) {
+                int megabytes = std::stoi(argv[++i]);
+                if (megabytes < 1) {
+                    DB_THROW(ValidationError, "Sample size must be at least 1 MB");
+                }
+                options.benchSampleMB = static_cast<size_t>(megabytes);
+            }
+            else if (arg == "--to" && i + 1 < argc) {
+                options.compression = argv[++i];
+                if (options.compression == "none" || options.compression == "auto") {
+                    DB_THROW(ValidationError, "Recompression needs a codec to convert to");
+                }
+            }
+            else if (arg == "--level" && i + 1 < argc) {
+                options.compressionLevel = argv[++i];
+                if (options.compressionLevel != "low" && options.compressionLevel != "medium" &&
+                    options.compressionLevel != "high") {
+                    DB_THROW(ValidationError, "Invalid level. Must be 'low', 'medium' or 'high'");
+                }
+            }
+            else if (arg == "--max-rate" && i + 1 < argc) {
+                options.maxRateMBps = std::stod(argv[++i]);
+                if (options.maxRateMBps <= 0) {
+                    DB_THROW(ValidationError, "Rate limit must be positive");
+                }
+            }
+            else if (arg == "--json") {
+                options.json = true;
+            }
             else if (arg == "--verbose") {
                 options.verbose = true;
             }
@@ -181,6 +273,11 @@ CLIOptions CLI::parse() {
                 DB_THROW(ValidationError, "Backup file not found: " + options.restorePath);
             }
         }
+        else if (options.command == "bench") {
+            if (!std::filesystem::exists(options.restorePath)) {
+                DB_THROW(ValidationError, "Benchmark input not found: " + options.restorePath);
+            }
+        }
 
         return options;
     });
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "../include/compression.hpp"
+#include "error/ErrorUtils.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dbbackup {
+
+/// Read-only run of bytes handed from one stage to the next (std::span is C++20)
+struct ByteSpan {
+    const char* data;
+    size_t size;
+};
+
+/// Codec stages are plain types, composed and dispatched at compile time:
+///
+///     struct Stage {
+///         void init();                                         // Before the first byte
+///         template <typename Out> void process(ByteSpan input, Out& out);  // Consumes all of input
+///         template <typename Out> void finish(Out& out);       // Flushes; checks the stream ended cleanly
+///     };
+///
+/// Out is any callable out(const char* data, size_t size) that throws if it can't take the
+/// bytes. Stages throw CompressionError on bad data. The drivers below connect a stage to
+/// a DataProducer and a DataSink, so a stage is only the codec loop.
+///
+/// A decoder that can do better with random access to a whole file (a block index to
+/// decode from in parallel, speculative parallel inflate) also defines
+///
+///         template <typename Out> bool decodeFile(const std::string& path, Out& out);
+///
+/// which decodes all of path after init() and returns true, or returns false without
+/// output to have the file streamed through process() as usual (see decompressFromFile).
+
+/// True if Stage defines decodeFile
+template <typename Stage, typename = void>
+struct DecodesFiles : std::false_type {};
+
+template <typename Stage>
+struct DecodesFiles<Stage, std::void_t<decltype(std::declval<Stage&>().decodeFile(
+    std::declval<const std::string&>(), std::declval<void (*&)(const char*, size_t)>()))>> : std::true_type {};
+
+/// Feeds the output of First straight into Second, e.g. a transform ahead of a codec
+/// or a checksum behind one
+template <typename First, typename Second>
+class Chain {
+public:
+    Chain(First first, Second second) : first(std::move(first)), second(std::move(second)) {}
+
+    void init() {
+        first.init();
+        second.init();
+    }
+
+    template <typename Out>
+    void process(ByteSpan input, Out& out) {
+        auto next = [this, &out](const char* data, size_t size) {
+            second.process(ByteSpan{data, size}, out);
+        };
+        first.process(input, next);
+    }
+
+    template <typename Out>
+    void finish(Out& out) {
+        auto next = [this, &out](const char* data, size_t size) {
+            second.process(ByteSpan{data, size}, out);
+        };
+        first.finish(next);
+        second.finish(out);
+    }
+
+    // First may take a whole file; Second sees its output as usual
+    template <typename Out>
+    bool decodeFile(const std::string& path, Out& out) {
+        if constexpr (DecodesFiles<First>::value) {
+            auto next = [this, &out](const char* data, size_t size) {
+                second.process(ByteSpan{data, size}, out);
+            };
+            if (first.decodeFile(path, next)) {
+                second.finish(out);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    First first;
+    Second second;
+};
+
+template <typename First, typename Second>
+Chain<First, Second> chain(First first, Second second) {
+    return Chain<First, Second>(std::move(first), std::move(second));
+}
+
+/// A stage behind a virtual interface, for the one choice that can't be made before the
+/// data is seen: "auto" picks its codec from the stream. Costs a virtual call per chunk.
+class ErasedStage {
+public:
+    using Emit = std::function<void(const char* data, size_t size)>;
+
+    virtual ~ErasedStage() = default;
+    virtual void init() = 0;
+    virtual void process(ByteSpan input, const Emit& out) = 0;
+    virtual void finish(const Emit& out) = 0;
+    virtual bool decodeFile(const std::string& path, const Emit& out) = 0;
+};
+
+template <typename Stage>
+class ErasedStageOf final : public ErasedStage {
+public:
+    explicit ErasedStageOf(Stage stage) : stage(std::move(stage)) {}
+
+    void init() override { stage.init(); }
+    void process(ByteSpan input, const Emit& out) override { stage.process(input, out); }
+    void finish(const Emit& out) override { stage.finish(out); }
+
+    bool decodeFile(const std::string& path, const Emit& out) override {
+        if constexpr (DecodesFiles<Stage>::value) {
+            return stage.decodeFile(path, out);
+        }
+        return false;
+    }
+
+private:
+    Stage stage;
+};
+
+template <typename Stage>
+std::unique_ptr<ErasedStage> eraseStage(Stage stage) {
+    return std::make_unique<ErasedStageOf<Stage>>(std::move(stage));
+}
+
+/// out as the callable an ErasedStage writes to
+template <typename Out>
+ErasedStage::Emit emitTo(Out& out) {
+    return [&out](const char* data, size_t size) { out(data, size); };
+}
+
+/// Runs everything producer pushes through stage into output
+template <typename Stage>
+bool compressToSink(Stage& stage, const DataProducer& producer, const DataSink& output) {
+    auto write = [&output](const char* data, size_t size) {
+        if (size > 0 && !output(data, size)) {
+            DB_THROW(error::CompressionError, "Failed to write compressed data");
+        }
+    };
+
+    stage.init();
+    bool produced = producer([&stage, &write](const char* data, size_t size) {
+        stage.process(ByteSpan{data, size}, write);
+        return true;
+    });
+    if (!produced) {
+        DB_THROW(error::CompressionError, "Input stream ended with an error");
+    }
+    stage.finish(write);
+    return true;
+}
+
+/// Runs the compressed stream input pushes through stage into sink
+template <typename Stage>
+bool decompressFromSource(Stage& stage, const DataProducer& input, const DataSink& sink) {
+    auto write = [&sink](const char* data, size_t size) {
+        // A slow consumer (e.g. a restore client's stdin) blocks here,
+        // which throttles reading and decoding
+        if (size > 0 && !sink(data, size)) {
+            DB_THROW(error::CompressionError, "Failed to write decompressed data");
+        }
+    };
+
+    stage.init();
+    bool read = input([&stage, &write](const char* data, size_t size) {
+        stage.process(ByteSpan{data, size}, write);
+        return true;
+    });
+    if (!read) {
+        DB_THROW(error::CompressionError, "Failed to read compressed data");
+    }
+    stage.finish(write);
+    return true;
+}
+
+/// Decodes the file at path through stage into sink, letting a stage that defines
+/// decodeFile take the whole file
+template <typename Stage>
+bool decompressFromFile(Stage& stage, const std::string& path, const DataSink& sink) {
+    auto write = [&sink](const char* data, size_t size) {
+        if (size > 0 && !sink(data, size)) {
+            DB_THROW(error::CompressionError, "Failed to write decompressed data");
+        }
+    };
+
+    stage.init();
+    if constexpr (DecodesFiles<Stage>::value) {
+        if (stage.decodeFile(path, write)) {
+            return true;
+        }
+    }
+    bool read = fileSource(path)([&stage, &write](const char* data, size_t size) {
+        stage.process(ByteSpan{data, size}, write);
+        return true;
+    });
+    if (!read) {
+        DB_THROW(error::CompressionError, "Failed to read compressed data");
+    }
+    stage.finish(write);
+    return true;
+}
+
+} // namespace dbbackup
@@ -1,5 +1,14 @@
 #include "../include/compression.hpp"
 #include "error/ErrorUtils.hpp"
+#include "thread_pool.hpp"
+#include "dictionary_store.hpp"
+#include "sql_transform.hpp"
+#include "codec_pipeline.hpp"
+#include "checksum.hpp"
+#include "chunk_channel.hpp"
+#include "mapped_file.hpp"
+#include "parallel_inflate.hpp"
+#include "io_engine.hpp"
 #include <iostream>
 #include <filesystem>
 #include <fstream>
@@ -8,8 +17,36 @@
 #include <sstream>
 #include <iomanip>
 #include <zlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef USE_XZ
+#include <lzma.h>
+#endif
+#ifdef USE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
 #include <vector>
 #include <stdexcept>
+#include <memory>
+#include <deque>
+#include <future>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace fs = std::filesystem;
 using namespace dbbackup::error;
@@ -18,17 +55,354 @@ namespace dbbackup {
 
 namespace {
     constexpr size_t CHUNK_SIZE = 16384;  // 16KB chunks for reading/writing
+
+    // Releases deflate state on every exit path, including exceptions from producers
+    struct DeflateGuard {
+        z_stream* stream;
+        ~DeflateGuard() { deflateEnd(stream); }
+    };
+
+    struct InflateGuard {
+        z_stream* stream;
+        ~InflateGuard() { inflateEnd(stream); }
+    };
+
+    constexpr size_t PARALLEL_BLOCK_SIZE = 1024 * 1024;  // Input bytes per deflate job
+    constexpr size_t DEFLATE_WINDOW = 32768;             // History carried into the next block
+    constexpr uint64_t MIN_PARALLEL_INFLATE_SIZE = 4 * PARALLEL_INFLATE_CHUNK;  // Compressed bytes
+
+    // Minimal gzip member header: no file name, no mtime, OS = Unix
+    constexpr unsigned char GZIP_HEADER[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+
+    struct DeflatedBlock {
+        std::vector<char> data;
+        uLong crc;
+        size_t inputSize;
+    };
+
+    // Deflates one block as a raw deflate fragment primed with the previous block's
+    // tail. Non-final blocks end with a sync flush, which leaves them byte-aligned
+    // so the fragments concatenate into one valid deflate stream.
+    DeflatedBlock deflateBlock(const std::vector<char>& input, const std::vector<char>& dictionary,
+                               int level, bool last) {
+        z_stream stream{};
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            DB_THROW(CompressionError, "Failed to initialize compression");
+        }
+        DeflateGuard guard{&stream};
+
+        if (!dictionary.empty() &&
+            deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()),
+                                 static_cast<uInt>(dictionary.size())) != Z_OK) {
+            DB_THROW(CompressionError, "Failed to prime compression dictionary");
+        }
+
+        DeflatedBlock block;
+        block.inputSize = input.size();
+        block.crc = crc32(0L, reinterpret_cast<const Bytef*>(input.data()), static_cast<uInt>(input.size()));
+        block.data.resize(deflateBound(&stream, input.size()) + 16);  // + sync flush marker
+
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        size_t written = 0;
+        for (;;) {
+            stream.next_out = reinterpret_cast<Bytef*>(block.data.data() + written);
+            stream.avail_out = static_cast<uInt>(block.data.size() - written);
+
+            int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                DB_THROW(CompressionError, "Compression error");
+            }
+            written = block.data.size() - stream.avail_out;
+
+            bool done = last ? ret == Z_STREAM_END : stream.avail_out != 0;
+            if (done) {
+                break;
+            }
+            block.data.resize(block.data.size() * 2);
+        }
+        block.data.resize(written);
+        return block;
+    }
+
+    // Order-0 entropy (bits per byte) above which deflate can't shrink a block:
+    // JPEG and PDF streams, already-compressed or encrypted BLOBs
+    constexpr double PASSTHROUGH_ENTROPY = 7.5;
+    constexpr size_t MIN_ENTROPY_SAMPLE = 4096;  // Shorter runs can't show a full byte distribution
+
+    double byteEntropy(const char* data, size_t size) {
+        size_t counts[256] = {};
+        for (size_t i = 0; i < size; i++) {
+            counts[static_cast<unsigned char>(data[i])]++;
+        }
+
+        double entropy = 0.0;
+        for (size_t count : counts) {
+            if (count > 0) {
+                double p = static_cast<double>(count) / size;
+                entropy -= p * std::log2(p);
+            }
+        }
+        return entropy;
+    }
+
+    // zlib level for a block: stored (level 0) when it looks incompressible, so deflate
+    // skips the match search. Stored blocks are plain deflate, readable by any gunzip.
+    int passthroughLevel(const char* data, size_t size, int level) {
+        if (size < MIN_ENTROPY_SAMPLE || byteEntropy(data, size) < PASSTHROUGH_ENTROPY) {
+            return level;
+        }
+        return Z_NO_COMPRESSION;
+    }
+
+    // Cuts a stream into blockSize pieces for a stage that encodes them on a pool. encode
+    // returns a future for one block; results are passed to write strictly in input
+    // order, with at most maxInFlight blocks held in memory. The final call to encode has
+    // last = true and may receive an empty block.
+    template <typename Result>
+    class BlockQueue {
+    public:
+        void reset(size_t size, size_t inFlight) {
+            blockSize = size;
+            maxInFlight = inFlight;
+            pending.clear();
+            current = std::vector<char>();
+            current.reserve(blockSize);
+        }
+
+        template <typename Encode, typename Write>
+        void add(ByteSpan input, Encode&& encode, Write&& write) {
+            const char* data = input.data;
+            size_t size = input.size;
+            while (size > 0) {
+                size_t take = std::min(size, blockSize - current.size());
+                current.insert(current.end(), data, data + take);
+                data += take;
+                size -= take;
+                if (current.size() == blockSize) {
+                    submit(false, encode, write);
+                }
+            }
+        }
+
+        template <typename Encode, typename Write>
+        void finish(Encode&& encode, Write&& write) {
+            submit(true, encode, write);
+        }
+
+    private:
+        template <typename Encode, typename Write>
+        void submit(bool last, Encode& encode, Write& write) {
+            auto input = std::make_shared<std::vector<char>>(std::move(current));
+            current = std::vector<char>();
+            current.reserve(blockSize);
+
+            pending.push_back(encode(input, last));
+            while (pending.size() > maxInFlight || (last && !pending.empty())) {
+                write(pending.front().get());
+                pending.pop_front();
+            }
+        }
+
+        size_t blockSize = 0;
+        size_t maxInFlight = 0;
+        std::deque<std::future<Result>> pending;
+        std::vector<char> current;
+    };
+
+    // Indexed gzip layout. Every member is a standard gzip member, so the file as a
+    // whole is an ordinary multi-member gzip stream:
+    //   data members   - one per INDEXED_BLOCK_SIZE of input, extra subfield "HB"
+    //                    holding the member's own compressed size
+    //   index members  - empty members whose "HI" subfield lists member sizes
+    //   tail member    - fixed-size empty member whose "HT" subfield locates the index
+    constexpr size_t INDEXED_BLOCK_SIZE = 1024 * 1024;
+    constexpr unsigned char GZIP_FEXTRA = 0x04;
+    constexpr size_t MAX_INDEX_ENTRIES = 16000;           // Keeps each "HI" subfield under 64KB
+    constexpr size_t TAIL_PAYLOAD_SIZE = 20;              // index offset, block count, block size
+    constexpr size_t TAIL_MEMBER_SIZE = 12 + 4 + TAIL_PAYLOAD_SIZE + 2 + 8;
+    constexpr unsigned char EMPTY_DEFLATE[2] = {0x03, 0x00};  // Final empty fixed-Huffman block
+
+    void appendLE(std::vector<char>& out, uint64_t value, size_t bytes) {
+        for (size_t i = 0; i < bytes; i++) {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    uint64_t readLE(const unsigned char* in, size_t bytes) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; i++) {
+            value |= static_cast<uint64_t>(in[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    // Gzip member header with a single extra subfield (RFC 1952, 2.3.1.1)
+    void appendExtraHeader(std::vector<char>& out, char si1, char si2, size_t payloadSize) {
+        out.push_back(static_cast<char>(GZIP_HEADER[0]));
+        out.push_back(static_cast<char>(GZIP_HEADER[1]));
+        out.push_back(static_cast<char>(GZIP_HEADER[2]));
+        out.push_back(static_cast<char>(GZIP_FEXTRA));
+        out.insert(out.end(), GZIP_HEADER + 4, GZIP_HEADER + 10);
+        appendLE(out, payloadSize + 4, 2);  // XLEN
+        out.push_back(si1);
+        out.push_back(si2);
+        appendLE(out, payloadSize, 2);      // LEN
+    }
+
+    // Empty member carrying metadata in its extra field; inflates to zero bytes
+    std::vector<char> makeMetadataMember(char si2, const std::vector<char>& payload) {
+        std::vector<char> member;
+        appendExtraHeader(member, 'H', si2, payload.size());
+        member.insert(member.end(), payload.begin(), payload.end());
+        member.insert(member.end(), EMPTY_DEFLATE, EMPTY_DEFLATE + sizeof(EMPTY_DEFLATE));
+        appendLE(member, 0, 8);  // CRC32 and ISIZE of no data
+        return member;
+    }
+
+    // Wraps one independently deflated block in a gzip member
+    std::vector<char> makeDataMember(const DeflatedBlock& block) {
+        std::vector<char> member;
+        member.reserve(block.data.size() + 28);
+        appendExtraHeader(member, 'H', 'B', 4);
+        appendLE(member, block.data.size() + 28, 4);
+        member.insert(member.end(), block.data.begin(), block.data.end());
+        appendLE(member, block.crc, 4);
+        appendLE(member, block.inputSize, 4);
+        return member;
+    }
+
+    // Inflates one complete gzip member; zlib checks its CRC and length
+    std::vector<char> inflateMember(const std::vector<char>& member) {
+        if (member.size() < 18) {
+            DB_THROW(CompressionError, "Truncated compressed block");
+        }
+        size_t outputSize = readLE(reinterpret_cast<const unsigned char*>(member.data() + member.size() - 4), 4);
+
+        z_stream stream{};
+        if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+            DB_THROW(CompressionError, "Failed to initialize decompression");
+        }
+        InflateGuard guard{&stream};
+
+        std::vector<char> output(outputSize);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(member.data()));
+        stream.avail_in = static_cast<uInt>(member.size());
+        stream.next_out = reinterpret_cast<Bytef*>(output.data());
+        stream.avail_out = static_cast<uInt>(output.size());
+
+        if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.avail_in != 0) {
+            DB_THROW(CompressionError, "Corrupted compressed block");
+        }
+        return output;
+    }
+
+    constexpr size_t FORMAT_MAGIC_SIZE = 6;    // Longest magic number below (xz)
+    constexpr size_t STREAM_QUEUE_DEPTH = 64;  // Chunks buffered between a stream and its codec
+
+    // Runs compress with a sink writing to a new file at path
+    bool writeFile(const std::string& path, const std::function<bool(const DataSink&)>& compress) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            DB_THROW(CompressionError, "Failed to open output file for compression");
+        }
+
+        bool compressed = false;
+        bool written = false;
+        try {
+            BlockWriter outFile(fd);
+            compressed = compress([&outFile](const char* data, size_t size) {
+                return outFile.write(data, size);
+            });
+            written = outFile.flush();
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        if (::close(fd) != 0 || !written) {
+            DB_THROW(CompressionError, "Failed to write compressed data");
+        }
+        return compressed;
+    }
+
+    // Runs everything producer pushes through stage into output, with the checksum stage
+    // behind it when there is a digest to fill
+    template <typename Stage>
+    bool encodeStream(Stage stage, const DataProducer& producer, const DataSink& output, Sha256* digest) {
+        if (digest) {
+            auto hashed = chain(std::move(stage), ChecksumStage(*digest));
+            return compressToSink(hashed, producer, output);
+        }
+        return compressToSink(stage, producer, output);
+    }
+
+    // Config format name for a stream starting with these bytes, or "" if unknown.
+    // Indexed gzip also reports "gzip"; telling them apart takes the whole file.
+    std::string formatFromMagic(const unsigned char* magic, size_t size) {
+        if (size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+            return "gzip";
+        }
+        if (size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+            return "zstd";
+        }
+        if (size >= 6 && magic[0] == 0xfd && magic[1] == '7' && magic[2] == 'z' && magic[3] == 'X' &&
+            magic[4] == 'Z' && magic[5] == 0x00) {
+            return "xz";
+        }
+        if (size >= 4 && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h' &&
+            magic[3] >= '1' && magic[3] <= '9') {
+            return "bzip2";
+        }
+        if (size >= 4 && magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18) {
+            return "lz4";
+        }
+        return "";
+    }
 }
 
 Compressor::Compressor(const CompressionConfig& config)
-    : format(stringToFormat(config.format))
-    , level(stringToLevel(config.level)) {
+    : settings(config)
+    , format(stringToFormat(config.format))
+    , level(stringToLevel(config.level))
+    , threads(ThreadPool::resolveThreadCount(config.threads))
+    , longDistance(config.longDistance)
+    , blockSize(config.blockSize)
+    , passthrough(config.passthrough)
+    , sqlTransform(config.transform == "sql") {
 }
 
 CompressionFormat Compressor::stringToFormat(const std::string& format) {
     if (format == "gzip") return CompressionFormat::Gzip;
-    if (format == "bzip2") return CompressionFormat::Bzip2;
-    if (format == "xz") return CompressionFormat::Xz;
+    if (format == "gzip-indexed") return CompressionFormat::IndexedGzip;
+    if (format == "zstd") {
+#ifdef USE_ZSTD
+        return CompressionFormat::Zstd;
+#else
+        DB_THROW(ConfigurationError, "zstd support not enabled");
+#endif
+    }
+    if (format == "bzip2") {
+#ifdef USE_BZIP2
+        return CompressionFormat::Bzip2;
+#else
+        DB_THROW(ConfigurationError, "bzip2 support not enabled");
+#endif
+    }
+    if (format == "xz") {
+#ifdef USE_XZ
+        return CompressionFormat::Xz;
+#else
+        DB_THROW(ConfigurationError, "xz support not enabled");
+#endif
+    }
+    if (format == "lz4") {
+#ifdef USE_LZ4
+        return CompressionFormat::Lz4;
+#else
+        DB_THROW(ConfigurationError, "lz4 support not enabled");
+#endif
+    }
+    if (format == "auto") return CompressionFormat::Auto;
     DB_THROW(ConfigurationError, "Unsupported compression format: " + format);
 }
 
@@ -48,176 +422,1960 @@ int Compressor::getZlibLevel() const {
     }
 }
 
+int Compressor::getZstdLevel() const {
+    // zstd 1 and 3 outrun gzip -1 and -6 while compressing better; 19 is the
+    // densest level that does not need --ultra window sizes
+    switch (level) {
+        case CompressionLevel::Low: return 1;
+        case CompressionLevel::Medium: return 3;
+        case CompressionLevel::High: return 19;
+        default: return 3;
+    }
+}
+
+uint32_t Compressor::getXzPreset() const {
+    switch (level) {
+        case CompressionLevel::Low: return 1;
+        case CompressionLevel::Medium: return 6;
+        case CompressionLevel::High: return 9;
+        default: return 6;
+    }
+}
+
+int Compressor::getBzip2BlockSize() const {
+    // bzip2 speed hardly depends on block size, so only "low" gives up the
+    // standard 900KB blocks, trading ratio for less memory per worker
+    switch (level) {
+        case CompressionLevel::Low: return 1;
+        case CompressionLevel::Medium: return 9;
+        case CompressionLevel::High: return 9;
+        default: return 9;
+    }
+}
+
+int Compressor::getLz4Level() const {
+    // Negative levels are LZ4's accelerated mode; 9 switches to LZ4HC
+    switch (level) {
+        case CompressionLevel::Low: return -1;
+        case CompressionLevel::Medium: return 0;
+        case CompressionLevel::High: return 9;
+        default: return 0;
+    }
+}
+
 std::string Compressor::getFileExtension() const {
     switch (format) {
         case CompressionFormat::Gzip: return ".gz";
+        case CompressionFormat::IndexedGzip: return ".gz";
+        case CompressionFormat::Zstd: return ".zst";
         case CompressionFormat::Bzip2: return ".bz2";
         case CompressionFormat::Xz: return ".xz";
+        case CompressionFormat::Lz4: return ".lz4";
+        case CompressionFormat::Auto:
+            return selected ? Compressor(selectedConfig()).getFileExtension() : "";
         default: return ".gz";
     }
 }
 
 bool Compressor::compressFile(const std::string& inputPath, const std::string& outputPath) const {
-    switch (format) {
-        case CompressionFormat::Gzip:
-            return compressGzip(inputPath, outputPath);
-        case CompressionFormat::Bzip2:
-        case CompressionFormat::Xz:
-            DB_THROW(ConfigurationError, "Compression format not yet implemented");
-        default:
-            DB_THROW(ConfigurationError, "Unknown compression format");
-    }
+    // A file can be sampled up front, so "auto" needs no read-ahead
+    selectForFile(inputPath);
+    return compressStream(fileSource(inputPath), outputPath);
+}
+
+bool Compressor::compressStream(const DataProducer& producer, const std::string& outputPath) const {
+    return writeFile(outputPath, [&](const DataSink& output) {
+        return compressStream(producer, output);
+    });
+}
+
+bool Compressor::compressStream(const DataProducer& producer, const DataSink& output, Sha256* digest) const {
+    DB_TRY_CATCH_LOG("Compression", {
+        return withEncoder([&](auto codec) {
+            // The transform sits between the producer and the codec, on the producer's side
+            if (sqlTransform) {
+                return encodeStream(chain(SqlTransformStage(), std::move(codec)), producer, output, digest);
+            }
+            return encodeStream(std::move(codec), producer, output, digest);
+        });
+    });
     return false;
 }
 
 bool Compressor::decompressFile(const std::string& inputPath, const std::string& outputPath) const {
-    switch (format) {
-        case CompressionFormat::Gzip:
-            return decompressGzip(inputPath, outputPath);
-        case CompressionFormat::Bzip2:
-        case CompressionFormat::Xz:
-            DB_THROW(ConfigurationError, "Decompression format not yet implemented");
-        default:
-            DB_THROW(ConfigurationError, "Unknown compression format");
+    if (!fs::exists(inputPath)) {
+        DB_THROW(CompressionError, "Failed to open input file for decompression");
+    }
+
+    int fd = ::open(outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        DB_THROW(CompressionError, "Failed to open output file for decompression");
+    }
+
+    bool decompressed = false;
+    bool written = false;
+    try {
+        BlockWriter outFile(fd);
+        decompressed = decompressStream(inputPath, [&outFile](const char* data, size_t size) {
+            if (!outFile.write(data, size)) {
+                DB_THROW(CompressionError, "Failed to write decompressed data");
+            }
+            return true;
+        });
+        written = outFile.flush();
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0 || !written) {
+        DB_THROW(CompressionError, "Failed to write decompressed data");
     }
+    return decompressed;
+}
+
+bool Compressor::decompressStream(const std::string& inputPath, const DataSink& sink) const {
+    DB_TRY_CATCH_LOG("Compression", {
+        return withDecoder([&](auto codec) {
+            // Transformed backups identify themselves, so the inverse runs whatever the config says
+            auto stages = chain(std::move(codec), SqlRestoreStage());
+            return decompressFromFile(stages, inputPath, sink);
+        });
+    });
     return false;
 }
 
-bool Compressor::compressGzip(const std::string& inputPath, const std::string& outputPath) const {
+bool Compressor::decompressStream(const DataProducer& input, const DataSink& sink) const {
     DB_TRY_CATCH_LOG("Compression", {
-        std::ifstream inFile(inputPath, std::ios::binary);
-        if (!inFile) {
-            DB_THROW(CompressionError, "Failed to open input file for compression");
+        return withDecoder([&](auto codec) {
+            auto stages = chain(std::move(codec), SqlRestoreStage());
+            return decompressFromSource(stages, input, sink);
+        });
+    });
+    return false;
+}
+
+DataProducer fileSource(const std::string& path, size_t chunkSize) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        DB_THROW(CompressionError, "Failed to open input file");
+    }
+    std::shared_ptr<int> inFile(new int(fd), [](int* owned) {
+        ::close(*owned);
+        delete owned;
+    });
+
+    return [inFile, chunkSize](const DataSink& sink) {
+        return readBlocks(*inFile, sink, chunkSize);
+    };
+}
+
+DataProducer fdSource(int fd, size_t chunkSize) {
+    return [fd, chunkSize](const DataSink& sink) {
+        std::vector<char> buffer(chunkSize);
+        for (;;) {
+            ssize_t got = ::read(fd, buffer.data(), buffer.size());
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return got == 0;
+            }
+            if (!sink(buffer.data(), static_cast<size_t>(got))) {
+                return false;
+            }
         }
+    };
+}
 
-        std::ofstream outFile(outputPath, std::ios::binary);
-        if (!outFile) {
-            DB_THROW(CompressionError, "Failed to open output file for compression");
+DataProducer memorySource(const char* data, size_t size) {
+    return [data, size](const DataSink& sink) {
+        return size == 0 || sink(data, size);
+    };
+}
+
+DataSink fdSink(int fd) {
+    return [fd](const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    };
+}
+
+DataSink memorySink(std::vector<char>& buffer) {
+    return [&buffer](const char* data, size_t size) {
+        buffer.insert(buffer.end(), data, data + size);
+        return true;
+    };
+}
+
+bool Compressor::isIndexedGzip(const std::string& path) {
+    std::ifstream inFile(path, std::ios::binary);
+    unsigned char header[16];
+    if (!inFile.read(reinterpret_cast<char*>(header), sizeof(header))) {
+        return false;
+    }
+    return header[0] == GZIP_HEADER[0] && header[1] == GZIP_HEADER[1] &&
+           (header[3] & GZIP_FEXTRA) && header[12] == 'H' && header[13] == 'B';
+}
+
+namespace {
+    struct DeflateFree {
+        void operator()(z_stream* stream) const {
+            deflateEnd(stream);
+            delete stream;
+        }
+    };
+
+    struct InflateFree {
+        void operator()(z_stream* stream) const {
+            inflateEnd(stream);
+            delete stream;
         }
+    };
 
-        z_stream stream;
-        stream.zalloc = Z_NULL;
-        stream.zfree = Z_NULL;
-        stream.opaque = Z_NULL;
+    // Writes one gzip member on the calling thread. With passthrough, chunks that look
+    // incompressible are stored by switching the level between chunks.
+    class GzipEncoder {
+    public:
+        GzipEncoder(int level, bool passthrough) : level(level), passthrough(passthrough) {}
 
-        int ret = deflateInit2(&stream, getZlibLevel(), Z_DEFLATED,
+        void init() {
+            // zlib keeps a pointer back to the z_stream, so it lives on the heap
+            stream.reset(new z_stream());
+            if (deflateInit2(stream.get(), level, Z_DEFLATED,
                              15 + 16,  // 15 window bits + 16 for gzip header
                              8,        // memory level
-                             Z_DEFAULT_STRATEGY);
-        
-        if (ret != Z_OK) {
-            DB_THROW(CompressionError, "Failed to initialize compression");
+                             Z_DEFAULT_STRATEGY) != Z_OK) {
+                DB_THROW(CompressionError, "Failed to initialize compression");
+            }
+            outBuffer.resize(CHUNK_SIZE);
+            currentLevel = level;
         }
 
-        std::vector<unsigned char> inBuffer(CHUNK_SIZE);
-        std::vector<unsigned char> outBuffer(CHUNK_SIZE);
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            if (passthrough && input.size >= MIN_ENTROPY_SAMPLE) {
+                int chunkLevel = passthroughLevel(input.data, input.size, level);
+                if (chunkLevel != currentLevel) {
+                    setLevel(chunkLevel, out);
+                }
+            }
+            stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data));
+            stream->avail_in = static_cast<uInt>(input.size);
+            drain(Z_NO_FLUSH, out);
+        }
 
-        do {
-            inFile.read(reinterpret_cast<char*>(inBuffer.data()), CHUNK_SIZE);
-            stream.avail_in = inFile.gcount();
-            stream.next_in = inBuffer.data();
+        template <typename Out>
+        void finish(Out& out) {
+            stream->next_in = Z_NULL;
+            stream->avail_in = 0;
+            drain(Z_FINISH, out);
+        }
 
+    private:
+        // Runs deflate until all pending input is consumed and writes the output
+        template <typename Out>
+        void drain(int flush, Out& out) {
             do {
-                stream.avail_out = CHUNK_SIZE;
-                stream.next_out = outBuffer.data();
+                stream->avail_out = CHUNK_SIZE;
+                stream->next_out = outBuffer.data();
 
-                ret = deflate(&stream, inFile.eof() ? Z_FINISH : Z_NO_FLUSH);
-                if (ret == Z_STREAM_ERROR) {
-                    deflateEnd(&stream);
+                if (deflate(stream.get(), flush) == Z_STREAM_ERROR) {
                     DB_THROW(CompressionError, "Compression error");
                 }
+                out(reinterpret_cast<const char*>(outBuffer.data()), CHUNK_SIZE - stream->avail_out);
+            } while (stream->avail_out == 0);
+        }
 
-                int have = CHUNK_SIZE - stream.avail_out;
-                outFile.write(reinterpret_cast<char*>(outBuffer.data()), have);
-                
-                if (!outFile) {
-                    deflateEnd(&stream);
-                    DB_THROW(CompressionError, "Failed to write compressed data");
+        // zlib flushes what it holds at the old level into the output space given here,
+        // so that output is written out like any other
+        template <typename Out>
+        void setLevel(int newLevel, Out& out) {
+            int ret;
+            do {
+                stream->avail_out = CHUNK_SIZE;
+                stream->next_out = outBuffer.data();
+                ret = deflateParams(stream.get(), newLevel, Z_DEFAULT_STRATEGY);
+                if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                    DB_THROW(CompressionError, "Failed to change compression level");
                 }
-            } while (stream.avail_out == 0);
-        } while (!inFile.eof());
+                out(reinterpret_cast<const char*>(outBuffer.data()), CHUNK_SIZE - stream->avail_out);
+            } while (ret == Z_BUF_ERROR);
+            currentLevel = newLevel;
+        }
 
-        deflateEnd(&stream);
-        return true;
-    });
-    return false;
-}
+        int level;
+        bool passthrough;
+        int currentLevel = 0;
+        std::unique_ptr<z_stream, DeflateFree> stream;
+        std::vector<unsigned char> outBuffer;
+    };
 
-bool Compressor::decompressGzip(const std::string& inputPath, const std::string& outputPath) const {
-    DB_TRY_CATCH_LOG("Compression", {
-        std::ifstream inFile(inputPath, std::ios::binary);
+    // Writes one gzip member whose deflate stream is made on a pool, PARALLEL_BLOCK_SIZE
+    // of input per job. Each block is primed with the tail of the block before it.
+    class ParallelGzipEncoder {
+    public:
+        ParallelGzipEncoder(size_t threads, int level, bool passthrough)
+            : threads(threads), level(level), passthrough(passthrough) {}
+
+        void init() {
+            pool = std::make_unique<ThreadPool>(threads);
+            blocks.reset(PARALLEL_BLOCK_SIZE, threads * 2);  // Bounds memory to a few blocks per worker
+            dictionary.clear();
+            crc = crc32(0L, Z_NULL, 0);
+            totalSize = 0;
+            started = false;
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            begin(out);
+            blocks.add(input, [this](std::shared_ptr<std::vector<char>> block, bool last) {
+                return encode(std::move(block), last);
+            }, [this, &out](DeflatedBlock block) {
+                write(block, out);
+            });
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            begin(out);
+            blocks.finish([this](std::shared_ptr<std::vector<char>> block, bool last) {
+                return encode(std::move(block), last);
+            }, [this, &out](DeflatedBlock block) {
+                write(block, out);
+            });
+
+            std::vector<char> trailer;
+            appendLE(trailer, crc, 4);
+            appendLE(trailer, totalSize, 4);
+            out(trailer.data(), trailer.size());
+        }
+
+    private:
+        template <typename Out>
+        void begin(Out& out) {
+            if (!started) {
+                started = true;
+                out(reinterpret_cast<const char*>(GZIP_HEADER), sizeof(GZIP_HEADER));
+            }
+        }
+
+        std::future<DeflatedBlock> encode(std::shared_ptr<std::vector<char>> input, bool last) {
+            auto primer = std::make_shared<std::vector<char>>(std::move(dictionary));
+            size_t tail = std::min(input->size(), DEFLATE_WINDOW);
+            dictionary.assign(input->end() - tail, input->end());
+
+            const int zlibLevel = level;
+            const bool detectEntropy = passthrough;
+            return pool->submit([input, primer, zlibLevel, detectEntropy, last]() {
+                int blockLevel = detectEntropy ? passthroughLevel(input->data(), input->size(), zlibLevel) : zlibLevel;
+                return deflateBlock(*input, *primer, blockLevel, last);
+            });
+        }
+
+        template <typename Out>
+        void write(const DeflatedBlock& block, Out& out) {
+            out(block.data.data(), block.data.size());
+            crc = crc32_combine(crc, block.crc, static_cast<z_off_t>(block.inputSize));
+            totalSize += block.inputSize;
+        }
+
+        size_t threads;
+        int level;
+        bool passthrough;
+        std::unique_ptr<ThreadPool> pool;
+        BlockQueue<DeflatedBlock> blocks;  // After the pool, so it goes first
+        std::vector<char> dictionary;
+        uLong crc = 0;
+        uLong totalSize = 0;
+        bool started = false;
+    };
+
+    // Writes the indexed gzip layout: blocks deflated on a pool into members that share
+    // no history, so each one can later be inflated on its own, then the block index
+    class IndexedGzipEncoder {
+    public:
+        IndexedGzipEncoder(size_t threads, int level, bool passthrough)
+            : threads(threads), level(level), passthrough(passthrough) {}
+
+        void init() {
+            pool = std::make_unique<ThreadPool>(threads);
+            blocks.reset(INDEXED_BLOCK_SIZE, threads * 2);
+            memberSizes.clear();
+            offset = 0;
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            blocks.add(input, [this](std::shared_ptr<std::vector<char>> block, bool) {
+                return encode(std::move(block));
+            }, [this, &out](std::vector<char> member) {
+                write(member, out);
+            });
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            blocks.finish([this](std::shared_ptr<std::vector<char>> block, bool) {
+                return encode(std::move(block));
+            }, [this, &out](std::vector<char> member) {
+                write(member, out);
+            });
+
+            // Block index, split across as many metadata members as needed
+            const uint64_t indexOffset = offset;
+            for (size_t first = 0; first < memberSizes.size(); first += MAX_INDEX_ENTRIES) {
+                size_t count = std::min(MAX_INDEX_ENTRIES, memberSizes.size() - first);
+                std::vector<char> payload;
+                for (size_t i = first; i < first + count; i++) {
+                    appendLE(payload, memberSizes[i], 4);
+                }
+                std::vector<char> member = makeMetadataMember('I', payload);
+                out(member.data(), member.size());
+            }
+
+            std::vector<char> tail;
+            appendLE(tail, indexOffset, 8);
+            appendLE(tail, memberSizes.size(), 8);
+            appendLE(tail, INDEXED_BLOCK_SIZE, 4);
+            std::vector<char> tailMember = makeMetadataMember('T', tail);
+            out(tailMember.data(), tailMember.size());
+        }
+
+    private:
+        std::future<std::vector<char>> encode(std::shared_ptr<std::vector<char>> input) {
+            const int zlibLevel = level;
+            const bool detectEntropy = passthrough;
+            return pool->submit([input, zlibLevel, detectEntropy]() {
+                int blockLevel = detectEntropy ? passthroughLevel(input->data(), input->size(), zlibLevel) : zlibLevel;
+                return makeDataMember(deflateBlock(*input, std::vector<char>(), blockLevel, true));
+            });
+        }
+
+        template <typename Out>
+        void write(const std::vector<char>& member, Out& out) {
+            out(member.data(), member.size());
+            memberSizes.push_back(static_cast<uint32_t>(member.size()));
+            offset += member.size();
+        }
+
+        size_t threads;
+        int level;
+        bool passthrough;
+        std::unique_ptr<ThreadPool> pool;
+        BlockQueue<std::vector<char>> blocks;
+        std::vector<uint32_t> memberSizes;
+        uint64_t offset = 0;
+    };
+
+    // Reads an indexed gzip file through its block index: members are read in order on
+    // this thread and inflated on a pool
+    template <typename Out>
+    void readIndexedGzip(const std::string& inputPath, size_t threads, Out& out) {
+        std::ifstream inFile(inputPath, std::ios::binary | std::ios::ate);
         if (!inFile) {
             DB_THROW(CompressionError, "Failed to open input file for decompression");
         }
+        const uint64_t fileSize = static_cast<uint64_t>(inFile.tellg());
+        DB_CHECK(fileSize >= TAIL_MEMBER_SIZE, CompressionError, "Missing block index");
+
+        // Locate the index through the fixed-size tail member
+        std::vector<unsigned char> tail(TAIL_MEMBER_SIZE);
+        inFile.seekg(static_cast<std::streamoff>(fileSize - TAIL_MEMBER_SIZE));
+        inFile.read(reinterpret_cast<char*>(tail.data()), tail.size());
+        DB_CHECK(inFile && tail[12] == 'H' && tail[13] == 'T' &&
+                 readLE(tail.data() + 14, 2) == TAIL_PAYLOAD_SIZE,
+                 CompressionError, "Missing block index");
+        const uint64_t indexOffset = readLE(tail.data() + 16, 8);
+        const uint64_t blockCount = readLE(tail.data() + 24, 8);
+        DB_CHECK(indexOffset <= fileSize - TAIL_MEMBER_SIZE, CompressionError, "Corrupted block index");
 
-        std::ofstream outFile(outputPath, std::ios::binary);
-        if (!outFile) {
-            DB_THROW(CompressionError, "Failed to open output file for decompression");
+        std::vector<uint32_t> memberSizes;
+        memberSizes.reserve(blockCount);
+        inFile.seekg(static_cast<std::streamoff>(indexOffset));
+        while (memberSizes.size() < blockCount) {
+            unsigned char header[16];
+            inFile.read(reinterpret_cast<char*>(header), sizeof(header));
+            DB_CHECK(inFile && header[12] == 'H' && header[13] == 'I', CompressionError, "Corrupted block index");
+
+            size_t entries = readLE(header + 14, 2) / 4;
+            std::vector<unsigned char> payload(entries * 4 + sizeof(EMPTY_DEFLATE) + 8);
+            inFile.read(reinterpret_cast<char*>(payload.data()), payload.size());
+            DB_CHECK(inFile, CompressionError, "Corrupted block index");
+            for (size_t i = 0; i < entries; i++) {
+                memberSizes.push_back(static_cast<uint32_t>(readLE(payload.data() + 4 * i, 4)));
+            }
         }
 
-        z_stream stream;
-        stream.zalloc = Z_NULL;
-        stream.zfree = Z_NULL;
-        stream.opaque = Z_NULL;
-        stream.avail_in = 0;
-        stream.next_in = Z_NULL;
+        ThreadPool pool(threads);
+        std::deque<std::future<std::vector<char>>> pending;
+        auto writeNext = [&]() {
+            std::vector<char> block = pending.front().get();
+            pending.pop_front();
+            out(block.data(), block.size());
+        };
 
-        int ret = inflateInit2(&stream, 15 + 16);  // 15 window bits + 16 for gzip header
-        if (ret != Z_OK) {
-            DB_THROW(CompressionError, "Failed to initialize decompression");
+        inFile.seekg(0);
+        for (uint32_t memberSize : memberSizes) {
+            auto member = std::make_shared<std::vector<char>>(memberSize);
+            inFile.read(member->data(), memberSize);
+            DB_CHECK(inFile, CompressionError, "Truncated compressed block");
+
+            pending.push_back(pool.submit([member]() { return inflateMember(*member); }));
+            while (pending.size() > threads * 2) {
+                writeNext();
+            }
+        }
+        while (!pending.empty()) {
+            writeNext();
         }
+    }
 
-        std::vector<unsigned char> inBuffer(CHUNK_SIZE);
-        std::vector<unsigned char> outBuffer(CHUNK_SIZE);
+    // Reads concatenated gzip members (pigz -i, indexed gzip) in order
+    class GzipDecoder {
+    public:
+        explicit GzipDecoder(size_t threads) : threads(threads) {}
 
-        do {
-            inFile.read(reinterpret_cast<char*>(inBuffer.data()), CHUNK_SIZE);
-            stream.avail_in = inFile.gcount();
-            
-            if (stream.avail_in == 0) {
-                break;
+        void init() {
+            // zlib keeps a pointer back to the z_stream, so it lives on the heap
+            stream.reset(new z_stream());
+            stream->zalloc = Z_NULL;
+            stream->zfree = Z_NULL;
+            stream->opaque = Z_NULL;
+            if (inflateInit2(stream.get(), 15 + 16) != Z_OK) {  // 15 window bits + 16 for gzip header
+                DB_THROW(CompressionError, "Failed to initialize decompression");
             }
-            stream.next_in = inBuffer.data();
+            outBuffer.resize(CHUNK_SIZE);
+        }
 
-            do {
-                stream.avail_out = CHUNK_SIZE;
-                stream.next_out = outBuffer.data();
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data));
+            stream->avail_in = static_cast<uInt>(input.size);
+
+            for (;;) {
+                if (memberEnded && stream->avail_in > 0) {
+                    // Another member follows the trailer
+                    inflateReset(stream.get());
+                    memberEnded = false;
+                }
 
-                ret = inflate(&stream, Z_NO_FLUSH);
+                stream->next_out = outBuffer.data();
+                stream->avail_out = static_cast<uInt>(outBuffer.size());
+                int ret = inflate(stream.get(), Z_NO_FLUSH);
                 switch (ret) {
                     case Z_NEED_DICT:
                     case Z_DATA_ERROR:
                     case Z_MEM_ERROR:
-                        inflateEnd(&stream);
+                    case Z_STREAM_ERROR:
                         DB_THROW(CompressionError, "Decompression error");
                 }
+                out(reinterpret_cast<const char*>(outBuffer.data()), outBuffer.size() - stream->avail_out);
 
-                int have = CHUNK_SIZE - stream.avail_out;
-                outFile.write(reinterpret_cast<char*>(outBuffer.data()), have);
-                
-                if (!outFile) {
-                    inflateEnd(&stream);
-                    DB_THROW(CompressionError, "Failed to write decompressed data");
+                if (ret == Z_STREAM_END) {
+                    memberEnded = true;
+                }
+                // Done once input is used up and inflate had room to spare
+                if (stream->avail_in == 0 && (memberEnded || stream->avail_out != 0)) {
+                    break;
                 }
-            } while (stream.avail_out == 0);
-        } while (ret != Z_STREAM_END);
+            }
+        }
 
-        inflateEnd(&stream);
-        
-        if (ret != Z_STREAM_END) {
-            DB_THROW(CompressionError, "Incomplete or corrupted compressed data");
+        template <typename Out>
+        void finish(Out&) {
+            if (!memberEnded) {
+                DB_THROW(CompressionError, "Incomplete or corrupted compressed data");
+            }
         }
-        
-        return true;
-    });
-    return false;
+
+        // An indexed file is read through its block index. A large plain one is inflated
+        // in parallel from guessed block boundaries; smaller files aren't worth the
+        // speculative work.
+        template <typename Out>
+        bool decodeFile(const std::string& path, Out& out) {
+            if (Compressor::isIndexedGzip(path)) {
+                readIndexedGzip(path, threads, out);
+                return true;
+            }
+            if (threads > 1 && fs::file_size(path) >= MIN_PARALLEL_INFLATE_SIZE) {
+                return inflateGzipParallel(path, threads, [&out](const char* data, size_t size) {
+                    out(data, size);
+                    return true;
+                });
+            }
+            return false;
+        }
+
+    private:
+        size_t threads;
+        std::unique_ptr<z_stream, InflateFree> stream;
+        std::vector<unsigned char> outBuffer;
+        bool memberEnded = false;
+    };
 }
 
-size_t Compressor::estimateCompressedSize(size_t inputSize) const {
-    // Conservative estimation based on compression level and format
-    // For random/incompressible data, compression might actually increase size slightly
-    double ratio;
-    switch (level) {
+std::string Compressor::detectFormat(const std::string& path) {
+    std::ifstream inFile(path, std::ios::binary);
+    unsigned char magic[FORMAT_MAGIC_SIZE] = {};
+    inFile.read(reinterpret_cast<char*>(magic), sizeof(magic));
+
+    std::string detected = formatFromMagic(magic, static_cast<size_t>(inFile.gcount()));
+    if (detected == "gzip" && isIndexedGzip(path)) {
+        return "gzip-indexed";
+    }
+    return detected;
+}
+
+std::vector<std::string> Compressor::availableFormats() {
+    std::vector<std::string> formats = {"gzip", "gzip-indexed"};
+#ifdef USE_ZSTD
+    formats.push_back("zstd");
+#endif
+#ifdef USE_XZ
+    formats.push_back("xz");
+#endif
+#ifdef USE_BZIP2
+    formats.push_back("bzip2");
+#endif
+#ifdef USE_LZ4
+    formats.push_back("lz4");
+#endif
+    return formats;
+}
+
+#ifdef USE_ZSTD
+namespace {
+    struct ZstdCCtxFree {
+        void operator()(ZSTD_CCtx* ctx) const { ZSTD_freeCCtx(ctx); }
+    };
+
+    struct ZstdDCtxFree {
+        void operator()(ZSTD_DCtx* ctx) const { ZSTD_freeDCtx(ctx); }
+    };
+
+    void checkZstd(size_t result, const std::string& what) {
+        if (ZSTD_isError(result)) {
+            DB_THROW(CompressionError, what + ": " + ZSTD_getErrorName(result));
+        }
+    }
+
+    ZSTD_inBuffer zstdInput(const void* data, size_t size) {
+        ZSTD_inBuffer input = {data, size, 0};
+        return input;
+    }
+
+    ZSTD_outBuffer zstdOutput(std::vector<char>& buffer) {
+        ZSTD_outBuffer output = {buffer.data(), buffer.size(), 0};
+        return output;
+    }
+
+    constexpr int ZSTD_LONG_WINDOW_LOG = 27;  // 128MB, the default long-mode window
+    constexpr int ZSTD_MAX_WINDOW_LOG = 31;   // Accept any window a zstd encoder can produce
+
+    // Window for a delta: twice the reference, so a dump of similar size can still reach
+    // back to its start from the end, capped at the largest window zstd supports
+    int deltaWindowLog(size_t referenceSize) {
+        int windowLog = ZSTD_LONG_WINDOW_LOG;
+        while (windowLog < ZSTD_MAX_WINDOW_LOG && (static_cast<uint64_t>(1) << (windowLog - 1)) < referenceSize) {
+            windowLog++;
+        }
+        return windowLog;
+    }
+
+    // The newest trained dictionary, when dictionaries are on. Its ID goes into the frame
+    // header for restore to find it by.
+    std::vector<char> latestDictionary(const CompressionConfig& settings) {
+        std::vector<char> dictionary;
+        if (settings.dictionary && !settings.dictionaryDir.empty()) {
+            DictionaryStore store(settings.dictionaryDir);
+            uint32_t dictionaryId = store.latestId();
+            if (dictionaryId != 0) {
+                dictionary = store.load(dictionaryId);
+            }
+        }
+        return dictionary;
+    }
+
+    // Writes one zstd frame with a content checksum
+    class ZstdEncoder {
+    public:
+        ZstdEncoder(int level, size_t threads, bool longDistance, std::vector<char> dictionary,
+                    ByteSpan reference = ByteSpan{nullptr, 0})
+            : level(level), threads(threads), longDistance(longDistance), dictionary(std::move(dictionary)),
+              reference(reference) {}
+
+        void init() {
+            ctx.reset(ZSTD_createCCtx());
+            if (!ctx) {
+                DB_THROW(CompressionError, "Failed to initialize compression");
+            }
+
+            checkZstd(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_compressionLevel, level),
+                      "Failed to set compression level");
+            checkZstd(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_checksumFlag, 1),
+                      "Failed to enable checksums");
+            if (threads > 1) {
+                // libzstd compresses on its own worker threads; input calls stay non-blocking
+                checkZstd(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_nbWorkers, static_cast<int>(threads)),
+                          "Failed to enable compression workers");
+            }
+            if (!dictionary.empty()) {
+                checkZstd(ZSTD_CCtx_loadDictionary(ctx.get(), dictionary.data(), dictionary.size()),
+                          "Failed to load compression dictionary");
+            }
+            if (longDistance) {
+                checkZstd(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_enableLongDistanceMatching, 1),
+                          "Failed to enable long-distance matching");
+                checkZstd(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_windowLog, ZSTD_LONG_WINDOW_LOG),
+                          "Failed to set window size");
+            }
+            if (reference.size > 0) {
+                // zstd --patch-from: the window spans the whole reference, and long-distance
+                // matching finds the unchanged stretches however far back they are
+                checkZstd(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_enableLongDistanceMatching, 1),
+                          "Failed to enable long-distance matching");
+                checkZstd(ZSTD_CCtx_setParameter(ctx.get(), ZSTD_c_windowLog, deltaWindowLog(reference.size)),
+                          "Failed to set window size");
+                checkZstd(ZSTD_CCtx_refPrefix(ctx.get(), reference.data, reference.size),
+                          "Failed to load delta reference");
+            }
+            outBuffer.resize(ZSTD_CStreamOutSize());
+        }
+
+        template <typename Out>
+        void process(ByteSpan data, Out& out) {
+            ZSTD_inBuffer input = zstdInput(data.data, data.size);
+            pump(input, ZSTD_e_continue, out);
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            ZSTD_inBuffer empty = zstdInput(nullptr, 0);
+            pump(empty, ZSTD_e_end, out);
+        }
+
+    private:
+        // Feeds input to zstd and writes whatever it emits; with ZSTD_e_end, loops
+        // until the frame is fully flushed
+        template <typename Out>
+        void pump(ZSTD_inBuffer& input, ZSTD_EndDirective mode, Out& out) {
+            for (;;) {
+                ZSTD_outBuffer output = zstdOutput(outBuffer);
+                size_t remaining = ZSTD_compressStream2(ctx.get(), &output, &input, mode);
+                checkZstd(remaining, "Compression error");
+                out(outBuffer.data(), output.pos);
+
+                bool done = mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size;
+                if (done) {
+                    break;
+                }
+            }
+        }
+
+        int level;
+        size_t threads;
+        bool longDistance;
+        std::vector<char> dictionary;
+        ByteSpan reference;  // Previous dump a delta is compressed against
+        std::unique_ptr<ZSTD_CCtx, ZstdCCtxFree> ctx;
+        std::vector<char> outBuffer;
+    };
+
+    // Reads concatenated zstd frames, loading the dictionary the first frame names
+    class ZstdDecoder {
+    public:
+        explicit ZstdDecoder(std::string dictionaryDir, ByteSpan reference = ByteSpan{nullptr, 0})
+            : dictionaryDir(std::move(dictionaryDir)), reference(reference) {}
+
+        void init() {
+            ctx.reset(ZSTD_createDCtx());
+            if (!ctx) {
+                DB_THROW(CompressionError, "Failed to initialize decompression");
+            }
+
+            // Long-distance frames use windows above the decoder's default 128MB limit
+            checkZstd(ZSTD_DCtx_setParameter(ctx.get(), ZSTD_d_windowLogMax, ZSTD_MAX_WINDOW_LOG),
+                      "Failed to set window limit");
+            if (reference.size > 0) {
+                checkZstd(ZSTD_DCtx_refPrefix(ctx.get(), reference.data, reference.size),
+                          "Failed to load delta reference");
+            }
+            outBuffer.resize(ZSTD_DStreamOutSize());
+        }
+
+        template <typename Out>
+        void process(ByteSpan data, Out& out) {
+            if (firstInput) {
+                firstInput = false;
+                loadDictionary(data);
+            }
+
+            ZSTD_inBuffer input = zstdInput(data.data, data.size);
+            while (input.pos < input.size) {
+                ZSTD_outBuffer output = zstdOutput(outBuffer);
+                lastResult = ZSTD_decompressStream(ctx.get(), &output, &input);
+                checkZstd(lastResult, "Decompression error");
+                out(outBuffer.data(), output.pos);
+            }
+        }
+
+        template <typename Out>
+        void finish(Out&) {
+            // Zero means the last frame ended cleanly (frames may be concatenated)
+            if (lastResult != 0) {
+                DB_THROW(CompressionError, "Incomplete or corrupted compressed data");
+            }
+        }
+
+    private:
+        void loadDictionary(ByteSpan frameStart) {
+            unsigned dictionaryId = ZSTD_getDictID_fromFrame(frameStart.data, frameStart.size);
+            if (dictionaryId == 0) {
+                return;
+            }
+            if (dictionaryDir.empty()) {
+                DB_THROW(CompressionError, "Backup needs compression dictionary " +
+                         std::to_string(dictionaryId) + " but no dictionary directory is configured");
+            }
+            dictionary = DictionaryStore(dictionaryDir).load(dictionaryId);
+            checkZstd(ZSTD_DCtx_loadDictionary(ctx.get(), dictionary.data(), dictionary.size()),
+                      "Failed to load compression dictionary");
+        }
+
+        std::string dictionaryDir;
+        ByteSpan reference;
+        std::unique_ptr<ZSTD_DCtx, ZstdDCtxFree> ctx;
+        std::vector<char> outBuffer;
+        std::vector<char> dictionary;
+        size_t lastResult = 0;
+        bool firstInput = true;
+    };
+}
+
+bool Compressor::compressDelta(const DataProducer& producer, const std::string& referencePath,
+                               const std::string& outputPath) const {
+    return writeFile(outputPath, [&](const DataSink& output) {
+        return compressDelta(producer, referencePath, output);
+    });
+}
+
+bool Compressor::compressDelta(const DataProducer& producer, const std::string& referencePath,
+                               const DataSink& output, Sha256* digest) const {
+    DB_CHECK(format == CompressionFormat::Zstd, ConfigurationError, "Delta compression requires zstd");
+    DB_TRY_CATCH_LOG("Compression", {
+        MappedFile reference(referencePath);
+        ZstdEncoder encoder(getZstdLevel(), threads, longDistance, std::vector<char>(), reference.span());
+        return encodeStream(std::move(encoder), producer, output, digest);
+    });
+    return false;
+}
+
+bool Compressor::decompressDelta(const std::string& inputPath, const std::string& referencePath,
+                                 const DataSink& sink) const {
+    DB_TRY_CATCH_LOG("Compression", {
+        MappedFile reference(referencePath);
+        ZstdDecoder decoder(settings.dictionaryDir, reference.span());
+        return decompressFromSource(decoder, fileSource(inputPath), sink);
+    });
+    return false;
+}
+
+size_t Compressor::maxDeltaReferenceSize() {
+    return static_cast<size_t>(1) << ZSTD_MAX_WINDOW_LOG;
+}
+#else
+bool Compressor::compressDelta(const DataProducer&, const std::string&, const std::string&) const {
+    DB_THROW(ConfigurationError, "zstd support not enabled");
+}
+
+bool Compressor::compressDelta(const DataProducer&, const std::string&, const DataSink&, Sha256*) const {
+    DB_THROW(ConfigurationError, "zstd support not enabled");
+}
+
+bool Compressor::decompressDelta(const std::string&, const std::string&, const DataSink&) const {
+    DB_THROW(ConfigurationError, "zstd support not enabled");
+}
+
+size_t Compressor::maxDeltaReferenceSize() {
+    return 0;
+}
+#endif
+
+#ifdef USE_XZ
+namespace {
+    struct LzmaStreamGuard {
+        lzma_stream* strm;
+        ~LzmaStreamGuard() { lzma_end(strm); }
+    };
+
+    struct LzmaIndexGuard {
+        lzma_index* index;
+        ~LzmaIndexGuard() { lzma_index_end(index, nullptr); }
+    };
+
+    lzma_stream makeLzmaStream() {
+        lzma_stream strm = LZMA_STREAM_INIT;
+        return strm;
+    }
+
+    struct LzmaStreamFree {
+        void operator()(lzma_stream* strm) const {
+            lzma_end(strm);
+            delete strm;
+        }
+    };
+
+    using LzmaStreamPtr = std::unique_ptr<lzma_stream, LzmaStreamFree>;
+
+    LzmaStreamPtr newLzmaStream() {
+        return LzmaStreamPtr(new lzma_stream(makeLzmaStream()));
+    }
+
+    // Runs lzma_code over the stream's pending input, writing whatever comes out.
+    // With LZMA_FINISH, loops until the stream end; returns the last lzma_code result.
+    template <typename Out>
+    lzma_ret pumpLzma(lzma_stream& strm, lzma_action action, std::vector<uint8_t>& outBuffer,
+                      Out& out, const char* error) {
+        for (;;) {
+            strm.next_out = outBuffer.data();
+            strm.avail_out = outBuffer.size();
+            lzma_ret ret = lzma_code(&strm, action);
+            if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+                DB_THROW(CompressionError, error);
+            }
+            out(reinterpret_cast<const char*>(outBuffer.data()), outBuffer.size() - strm.avail_out);
+
+            bool done = action == LZMA_FINISH || ret == LZMA_STREAM_END
+                ? ret == LZMA_STREAM_END
+                : strm.avail_in == 0 && strm.avail_out != 0;
+            if (done) {
+                return ret;
+            }
+        }
+    }
+
+    // Writes one xz stream. The multi-threaded encoder splits input into independent
+    // blocks and records their sizes, which is what lets decompressXz work on blocks
+    // in parallel. It is used even with one thread so every file gets block boundaries.
+    class XzEncoder {
+    public:
+        XzEncoder(size_t threads, size_t blockSize, uint32_t preset) {
+            options.threads = static_cast<uint32_t>(threads);
+            options.block_size = blockSize;
+            options.preset = preset;
+            options.check = LZMA_CHECK_CRC64;
+        }
+
+        void init() {
+            strm = newLzmaStream();
+            if (lzma_stream_encoder_mt(strm.get(), &options) != LZMA_OK) {
+                DB_THROW(CompressionError, "Failed to initialize compression");
+            }
+            outBuffer.resize(CHUNK_SIZE);
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            strm->next_in = reinterpret_cast<const uint8_t*>(input.data);
+            strm->avail_in = input.size;
+            pumpLzma(*strm, LZMA_RUN, outBuffer, out, "Compression error");
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            pumpLzma(*strm, LZMA_FINISH, outBuffer, out, "Compression error");
+        }
+
+    private:
+        lzma_mt options = {};
+        LzmaStreamPtr strm;
+        std::vector<uint8_t> outBuffer;
+    };
+
+    // Blocks larger than this are streamed serially instead of buffered per worker
+    // (single-threaded xz writes the whole file as one block)
+    constexpr uint64_t MAX_PARALLEL_XZ_BLOCK = 256ULL * 1024 * 1024;
+
+    // Reads the combined index of every stream in an xz file. liblzma drives the
+    // seeks, starting from the stream footer at the end of the file.
+    lzma_index* readXzIndex(std::ifstream& inFile, uint64_t fileSize) {
+        lzma_stream strm = makeLzmaStream();
+        lzma_index* index = nullptr;
+        if (lzma_file_info_decoder(&strm, &index, UINT64_MAX, fileSize) != LZMA_OK) {
+            DB_THROW(CompressionError, "Failed to initialize xz index reader");
+        }
+        LzmaStreamGuard guard{&strm};
+
+        std::vector<uint8_t> buffer(CHUNK_SIZE);
+        inFile.clear();
+        inFile.seekg(0);
+        for (;;) {
+            if (strm.avail_in == 0) {
+                inFile.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+                strm.next_in = buffer.data();
+                strm.avail_in = static_cast<size_t>(inFile.gcount());
+            }
+
+            lzma_ret ret = lzma_code(&strm, LZMA_RUN);
+            if (ret == LZMA_STREAM_END) {
+                return index;
+            }
+            if (ret == LZMA_SEEK_NEEDED) {
+                inFile.clear();
+                inFile.seekg(static_cast<std::streamoff>(strm.seek_pos));
+                strm.avail_in = 0;
+                continue;
+            }
+            if (ret != LZMA_OK) {
+                DB_THROW(CompressionError, "Corrupted xz index");
+            }
+        }
+    }
+
+    // Decodes one complete block (header, data, padding and check)
+    std::vector<char> decodeXzBlock(const std::vector<uint8_t>& input, lzma_check check,
+                                    uint64_t uncompressedSize) {
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block block = {};
+        block.version = 1;
+        block.check = check;
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(input[0]);
+        if (input.size() < block.header_size ||
+            lzma_block_header_decode(&block, nullptr, input.data()) != LZMA_OK) {
+            DB_THROW(CompressionError, "Corrupted xz block header");
+        }
+
+        std::vector<char> output(uncompressedSize);
+        size_t inPos = block.header_size;
+        size_t outPos = 0;
+        lzma_ret ret = lzma_block_buffer_decode(&block, nullptr, input.data(), &inPos, input.size(),
+                                                reinterpret_cast<uint8_t*>(output.data()), &outPos,
+                                                output.size());
+        for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++) {
+            free(filters[i].options);
+        }
+        if (ret != LZMA_OK || outPos != output.size()) {
+            DB_THROW(CompressionError, "Corrupted xz block");
+        }
+        return output;
+    }
+
+    // Reads concatenated xz streams in order
+    class XzDecoder {
+    public:
+        explicit XzDecoder(size_t threads) : threads(threads) {}
+
+        void init() {
+            strm = newLzmaStream();
+            if (lzma_stream_decoder(strm.get(), UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+                DB_THROW(CompressionError, "Failed to initialize decompression");
+            }
+            outBuffer.resize(CHUNK_SIZE);
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            strm->next_in = reinterpret_cast<const uint8_t*>(input.data);
+            strm->avail_in = input.size;
+            pumpLzma(*strm, LZMA_RUN, outBuffer, out, "Incomplete or corrupted compressed data");
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            // LZMA_CONCATENATED only reports the end once told no more streams follow
+            pumpLzma(*strm, LZMA_FINISH, outBuffer, out, "Incomplete or corrupted compressed data");
+        }
+
+        // With several workers and an index showing several blocks of a bounded size,
+        // blocks are read in order on this thread and decoded on a pool
+        template <typename Out>
+        bool decodeFile(const std::string& path, Out& out) {
+            if (threads <= 1) {
+                return false;
+            }
+            std::ifstream inFile(path, std::ios::binary | std::ios::ate);
+            if (!inFile) {
+                DB_THROW(CompressionError, "Failed to open input file for decompression");
+            }
+            lzma_index* index = readXzIndex(inFile, static_cast<uint64_t>(inFile.tellg()));
+            LzmaIndexGuard indexGuard{index};
+
+            bool parallel = lzma_index_block_count(index) > 1;
+            lzma_index_iter iter;
+            lzma_index_iter_init(&iter, index);
+            while (parallel && !lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)) {
+                parallel = iter.block.uncompressed_size <= MAX_PARALLEL_XZ_BLOCK;
+            }
+            if (!parallel) {
+                return false;
+            }
+
+            ThreadPool pool(threads);
+            std::deque<std::future<std::vector<char>>> pending;
+            auto writeNext = [&]() {
+                std::vector<char> block = pending.front().get();
+                pending.pop_front();
+                out(block.data(), block.size());
+            };
+
+            lzma_index_iter_init(&iter, index);
+            while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)) {
+                auto block = std::make_shared<std::vector<uint8_t>>(iter.block.total_size);
+                inFile.clear();
+                inFile.seekg(static_cast<std::streamoff>(iter.block.compressed_file_offset));
+                inFile.read(reinterpret_cast<char*>(block->data()), block->size());
+                DB_CHECK(inFile, CompressionError, "Truncated compressed block");
+
+                lzma_check check = iter.stream.flags->check;
+                uint64_t uncompressedSize = iter.block.uncompressed_size;
+                pending.push_back(pool.submit([block, check, uncompressedSize]() {
+                    return decodeXzBlock(*block, check, uncompressedSize);
+                }));
+                while (pending.size() > threads * 2) {
+                    writeNext();
+                }
+            }
+            while (!pending.empty()) {
+                writeNext();
+            }
+            return true;
+        }
+
+    private:
+        size_t threads;
+        LzmaStreamPtr strm;
+        std::vector<uint8_t> outBuffer;
+    };
+}
+
+#endif
+
+#ifdef USE_BZIP2
+namespace {
+    struct BzCompressGuard {
+        bz_stream* strm;
+        ~BzCompressGuard() { BZ2_bzCompressEnd(strm); }
+    };
+
+    struct BzDecompressGuard {
+        bz_stream* strm;
+        ~BzDecompressGuard() { BZ2_bzDecompressEnd(strm); }
+    };
+
+    // "BZh" + block size digit + first block magic (BCD pi). Every stream starts
+    // byte-aligned with this, which is how stream boundaries are found without an index.
+    constexpr size_t BZIP2_STREAM_MAGIC_SIZE = 10;
+    constexpr size_t BZIP2_PROBE_SIZE = 2 * 1024 * 1024;
+
+    bool isBzip2StreamStart(const char* p) {
+        static const unsigned char BLOCK_MAGIC[6] = {0x31, 0x41, 0x59, 0x26, 0x53, 0x59};
+        return p[0] == 'B' && p[1] == 'Z' && p[2] == 'h' && p[3] >= '1' && p[3] <= '9' &&
+               std::equal(BLOCK_MAGIC, BLOCK_MAGIC + 6, reinterpret_cast<const unsigned char*>(p) + 4);
+    }
+
+    // Offset of the first stream start in data[from, size), or size if none
+    size_t findBzip2StreamStart(const std::vector<char>& data, size_t from) {
+        for (size_t i = from; i + BZIP2_STREAM_MAGIC_SIZE <= data.size(); i++) {
+            if (isBzip2StreamStart(data.data() + i)) {
+                return i;
+            }
+        }
+        return data.size();
+    }
+
+    // Compresses one block as a complete, independent bzip2 stream
+    std::vector<char> compressBzip2Stream(const std::vector<char>& input, int blockSize100k) {
+        bz_stream strm = {};
+        if (BZ2_bzCompressInit(&strm, blockSize100k, 0, 0) != BZ_OK) {
+            DB_THROW(CompressionError, "Failed to initialize compression");
+        }
+        BzCompressGuard guard{&strm};
+
+        // Worst case is about 1% over the input plus a small constant
+        std::vector<char> output(input.size() + input.size() / 100 + 600);
+        strm.next_in = const_cast<char*>(input.data());
+        strm.avail_in = static_cast<unsigned int>(input.size());
+        strm.next_out = output.data();
+        strm.avail_out = static_cast<unsigned int>(output.size());
+
+        if (BZ2_bzCompress(&strm, BZ_FINISH) != BZ_STREAM_END) {
+            DB_THROW(CompressionError, "Compression error");
+        }
+        output.resize(output.size() - strm.avail_out);
+        return output;
+    }
+
+    // Decodes every stream in input (usually exactly one) to memory
+    std::vector<char> decompressBzip2Streams(const std::vector<char>& input) {
+        std::vector<char> output;
+        std::vector<char> buffer(CHUNK_SIZE * 4);
+        size_t offset = 0;
+
+        while (offset < input.size()) {
+            bz_stream strm = {};
+            if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) {
+                DB_THROW(CompressionError, "Failed to initialize decompression");
+            }
+            BzDecompressGuard guard{&strm};
+            strm.next_in = const_cast<char*>(input.data() + offset);
+            strm.avail_in = static_cast<unsigned int>(input.size() - offset);
+
+            int ret = BZ_OK;
+            while (ret != BZ_STREAM_END) {
+                strm.next_out = buffer.data();
+                strm.avail_out = static_cast<unsigned int>(buffer.size());
+                ret = BZ2_bzDecompress(&strm);
+                if (ret != BZ_OK && ret != BZ_STREAM_END) {
+                    DB_THROW(CompressionError, "Corrupted compressed data");
+                }
+                size_t have = buffer.size() - strm.avail_out;
+                if (ret == BZ_OK && have == 0 && strm.avail_in == 0) {
+                    DB_THROW(CompressionError, "Incomplete or corrupted compressed data");
+                }
+                output.insert(output.end(), buffer.data(), buffer.data() + have);
+            }
+            offset = input.size() - strm.avail_in;
+        }
+        return output;
+    }
+
+    // pbzip2 layout: each block of input becomes its own bzip2 stream, compressed on a
+    // pool, so the concatenation is a valid multi-stream file
+    class Bzip2Encoder {
+    public:
+        Bzip2Encoder(size_t threads, int blockSize100k) : threads(threads), blockSize100k(blockSize100k) {}
+
+        void init() {
+            pool = std::make_unique<ThreadPool>(threads);
+            blocks.reset(static_cast<size_t>(blockSize100k) * 100000, threads * 2);
+            count = 0;
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            blocks.add(input, [this](std::shared_ptr<std::vector<char>> block, bool) {
+                return encode(std::move(block));
+            }, [&out](std::vector<char> stream) {
+                out(stream.data(), stream.size());
+            });
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            blocks.finish([this](std::shared_ptr<std::vector<char>> block, bool) {
+                return encode(std::move(block));
+            }, [&out](std::vector<char> stream) {
+                out(stream.data(), stream.size());
+            });
+        }
+
+    private:
+        std::future<std::vector<char>> encode(std::shared_ptr<std::vector<char>> input) {
+            bool first = count++ == 0;
+            const int level = blockSize100k;
+            return pool->submit([input, level, first]() {
+                // Only an entirely empty input needs an (empty) stream of its own
+                if (input->empty() && !first) {
+                    return std::vector<char>();
+                }
+                return compressBzip2Stream(*input, level);
+            });
+        }
+
+        size_t threads;
+        int blockSize100k;
+        std::unique_ptr<ThreadPool> pool;
+        BlockQueue<std::vector<char>> blocks;
+        size_t count = 0;
+    };
+
+    // One decoder, restarted at each stream boundary so multi-stream files decode in full
+    class Bzip2Decoder {
+    public:
+        Bzip2Decoder() = default;
+        Bzip2Decoder(Bzip2Decoder&&) = default;
+
+        void init() {
+            outBuffer.resize(CHUNK_SIZE);
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            strm->next_in = const_cast<char*>(input.data);
+            strm->avail_in = static_cast<unsigned int>(input.size);
+
+            // Keep going while output filled the buffer, or the last of it may stay inside the decoder
+            bool full = false;
+            while (strm->avail_in > 0 || full) {
+                if (!inStream) {
+                    char* nextIn = strm->next_in;
+                    unsigned int availIn = strm->avail_in;
+                    *strm = bz_stream{};
+                    if (BZ2_bzDecompressInit(strm.get(), 0, 0) != BZ_OK) {
+                        DB_THROW(CompressionError, "Failed to initialize decompression");
+                    }
+                    strm->next_in = nextIn;
+                    strm->avail_in = availIn;
+                    inStream = true;
+                }
+                strm->next_out = outBuffer.data();
+                strm->avail_out = static_cast<unsigned int>(outBuffer.size());
+
+                int ret = BZ2_bzDecompress(strm.get());
+                if (ret != BZ_OK && ret != BZ_STREAM_END) {
+                    DB_THROW(CompressionError, "Corrupted compressed data");
+                }
+                full = strm->avail_out == 0;
+                out(outBuffer.data(), outBuffer.size() - strm->avail_out);
+                if (ret == BZ_STREAM_END) {
+                    BZ2_bzDecompressEnd(strm.get());
+                    inStream = false;
+                    full = false;
+                }
+            }
+        }
+
+        template <typename Out>
+        void finish(Out&) {
+            if (inStream) {
+                DB_THROW(CompressionError, "Incomplete or corrupted compressed data");
+            }
+        }
+
+        ~Bzip2Decoder() {
+            if (inStream) {
+                BZ2_bzDecompressEnd(strm.get());
+            }
+        }
+
+    private:
+        std::unique_ptr<bz_stream> strm = std::make_unique<bz_stream>();
+        std::vector<char> outBuffer;
+        bool inStream = false;
+    };
+
+    // Splits a multi-stream file (pbzip2, or compressed here) at its stream starts and
+    // decodes the streams on a pool. Only multi-stream input splits into parallel work:
+    // one from plain bzip2 is a single stream, and once the probe shows that, it goes to
+    // a serial Bzip2Decoder so it never sits in memory whole.
+    class ParallelBzip2Decoder {
+    public:
+        explicit ParallelBzip2Decoder(size_t threads) : threads(threads) {}
+
+        void init() {
+            mode = Mode::Probing;
+            segment.clear();
+            searchFrom = 1;
+            pending.clear();
+            pool.reset();
+            serial.init();
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            if (mode == Mode::Serial) {
+                serial.process(input, out);
+                return;
+            }
+            segment.insert(segment.end(), input.data, input.data + input.size);
+
+            if (mode == Mode::Probing) {
+                if (findBzip2StreamStart(segment, 1) < segment.size()) {
+                    mode = Mode::Parallel;
+                    pool = std::make_unique<ThreadPool>(threads);
+                } else if (segment.size() >= BZIP2_PROBE_SIZE) {
+                    toSerial(out);
+                    return;
+                } else {
+                    return;
+                }
+            }
+
+            // Streams are cut out on this thread and decoded on the pool
+            for (;;) {
+                size_t next = findBzip2StreamStart(segment, searchFrom);
+                if (next == segment.size()) {
+                    break;
+                }
+                submit(next, out);
+                searchFrom = 1;
+            }
+            // Rescan the last few bytes in case a magic straddles the next input
+            searchFrom = std::max<size_t>(1, segment.size() + 1 - std::min(segment.size(), BZIP2_STREAM_MAGIC_SIZE));
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            if (mode == Mode::Probing) {
+                toSerial(out);
+            }
+            if (mode == Mode::Serial) {
+                serial.finish(out);
+                return;
+            }
+            if (!segment.empty()) {
+                submit(segment.size(), out);
+            }
+            while (!pending.empty()) {
+                writeNext(out);
+            }
+        }
+
+    private:
+        enum class Mode { Probing, Parallel, Serial };
+
+        template <typename Out>
+        void toSerial(Out& out) {
+            mode = Mode::Serial;
+            std::vector<char> probed;
+            probed.swap(segment);
+            serial.process(ByteSpan{probed.data(), probed.size()}, out);
+        }
+
+        template <typename Out>
+        void submit(size_t length, Out& out) {
+            auto stream = std::make_shared<std::vector<char>>(segment.begin(), segment.begin() + length);
+            segment.erase(segment.begin(), segment.begin() + length);
+            pending.push_back(pool->submit([stream]() { return decompressBzip2Streams(*stream); }));
+            while (pending.size() > threads * 2) {
+                writeNext(out);
+            }
+        }
+
+        template <typename Out>
+        void writeNext(Out& out) {
+            std::vector<char> block = pending.front().get();
+            pending.pop_front();
+            out(block.data(), block.size());
+        }
+
+        size_t threads;
+        Mode mode = Mode::Probing;
+        std::vector<char> segment;  // Input not yet handed to a job
+        size_t searchFrom = 1;
+        std::unique_ptr<ThreadPool> pool;
+        std::deque<std::future<std::vector<char>>> pending;
+        Bzip2Decoder serial;
+    };
+}
+
+#endif
+
+#ifdef USE_LZ4
+namespace {
+    struct Lz4CompressFree {
+        void operator()(LZ4F_cctx* ctx) const { LZ4F_freeCompressionContext(ctx); }
+    };
+
+    struct Lz4DecompressFree {
+        void operator()(LZ4F_dctx* ctx) const { LZ4F_freeDecompressionContext(ctx); }
+    };
+
+    size_t checkLz4(size_t result, const std::string& what) {
+        if (LZ4F_isError(result)) {
+            DB_THROW(CompressionError, what + ": " + LZ4F_getErrorName(result));
+        }
+        return result;
+    }
+
+    LZ4F_preferences_t lz4Preferences(int level) {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = level;
+        // Linked blocks let each block reference the 64KB before it: a better ratio
+        // at no speed cost, since a single stream is decoded in order anyway
+        prefs.frameInfo.blockMode = LZ4F_blockLinked;
+        prefs.frameInfo.blockSizeID = LZ4F_max1MB;
+        prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+        return prefs;
+    }
+
+    // Writes one LZ4 frame
+    class Lz4Encoder {
+    public:
+        explicit Lz4Encoder(int level) : prefs(lz4Preferences(level)) {}
+
+        void init() {
+            LZ4F_cctx* created = nullptr;
+            checkLz4(LZ4F_createCompressionContext(&created, LZ4F_VERSION), "Failed to initialize compression");
+            ctx.reset(created);
+            outBuffer.resize(LZ4F_HEADER_SIZE_MAX);
+            started = false;
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            begin(out);
+            reserve(LZ4F_compressBound(input.size, &prefs));
+            out(outBuffer.data(), checkLz4(LZ4F_compressUpdate(ctx.get(), outBuffer.data(), outBuffer.size(),
+                                                               input.data, input.size, nullptr),
+                                           "Compression error"));
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            begin(out);
+            reserve(LZ4F_compressBound(0, &prefs));
+            out(outBuffer.data(), checkLz4(LZ4F_compressEnd(ctx.get(), outBuffer.data(), outBuffer.size(), nullptr),
+                                           "Compression error"));
+        }
+
+    private:
+        template <typename Out>
+        void begin(Out& out) {
+            if (started) {
+                return;
+            }
+            started = true;
+            out(outBuffer.data(), checkLz4(LZ4F_compressBegin(ctx.get(), outBuffer.data(), outBuffer.size(), &prefs),
+                                           "Failed to write frame header"));
+        }
+
+        void reserve(size_t bound) {
+            if (outBuffer.size() < bound) {
+                outBuffer.resize(bound);
+            }
+        }
+
+        LZ4F_preferences_t prefs;
+        std::unique_ptr<LZ4F_cctx, Lz4CompressFree> ctx;
+        std::vector<char> outBuffer;
+        bool started = false;
+    };
+
+    // Reads concatenated LZ4 frames
+    class Lz4Decoder {
+    public:
+        void init() {
+            LZ4F_dctx* created = nullptr;
+            checkLz4(LZ4F_createDecompressionContext(&created, LZ4F_VERSION), "Failed to initialize decompression");
+            ctx.reset(created);
+            outBuffer.resize(CHUNK_SIZE * 4);
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            size_t consumed = 0;
+            while (consumed < input.size) {
+                size_t srcSize = input.size - consumed;
+                size_t dstSize = outBuffer.size();
+                hint = checkLz4(LZ4F_decompress(ctx.get(), outBuffer.data(), &dstSize,
+                                                input.data + consumed, &srcSize, nullptr),
+                                "Decompression error");
+                consumed += srcSize;
+                out(outBuffer.data(), dstSize);
+            }
+        }
+
+        template <typename Out>
+        void finish(Out&) {
+            if (hint != 0) {
+                DB_THROW(CompressionError, "Incomplete or corrupted compressed data");
+            }
+        }
+
+    private:
+        std::unique_ptr<LZ4F_dctx, Lz4DecompressFree> ctx;
+        std::vector<char> outBuffer;
+        size_t hint = 0;  // Zero once a frame is complete (frames may be concatenated)
+    };
+}
+
+#endif
+
+namespace {
+    constexpr size_t AUTO_SAMPLE_SIZE = 4 * 1024 * 1024;
+
+    struct AutoCandidate {
+        const char* format;
+        const char* level;
+        bool parallel;  // Scales with compression threads
+    };
+
+    // Fastest first within each codec, so once a level misses the target the
+    // stronger levels of that codec can be skipped
+    const AutoCandidate AUTO_CANDIDATES[] = {
+#ifdef USE_LZ4
+        {"lz4", "low", false},
+        {"lz4", "medium", false},
+#endif
+#ifdef USE_ZSTD
+        {"zstd", "low", true},
+        {"zstd", "medium", true},
+        {"zstd", "high", true},
+#endif
+        {"gzip", "low", true},
+        {"gzip", "medium", true},
+        {"gzip", "high", true},
+#ifdef USE_BZIP2
+        {"bzip2", "medium", true},
+#endif
+#ifdef USE_XZ
+        {"xz", "low", true},
+        {"xz", "medium", true},
+        {"xz", "high", true},
+#endif
+    };
+
+    // "auto" as a stage: holds back the first AUTO_SAMPLE_SIZE bytes, has choose pick a
+    // codec from them, then replays them into it ahead of the rest of the stream
+    class AutoEncoder {
+    public:
+        using Choose = std::function<std::unique_ptr<ErasedStage>(const std::vector<char>& sample)>;
+
+        explicit AutoEncoder(Choose choose) : choose(std::move(choose)) {}
+
+        void init() {
+            chosen.reset();
+            sample.clear();
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            if (chosen) {
+                chosen->process(input, emitTo(out));
+                return;
+            }
+            sample.insert(sample.end(), input.data, input.data + input.size);
+            if (sample.size() >= AUTO_SAMPLE_SIZE) {
+                start(out);
+            }
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            if (!chosen) {
+                start(out);
+            }
+            chosen->finish(emitTo(out));
+        }
+
+    private:
+        template <typename Out>
+        void start(Out& out) {
+            chosen = choose(sample);
+            chosen->init();
+            if (!sample.empty()) {
+                chosen->process(ByteSpan{sample.data(), sample.size()}, emitTo(out));
+            }
+            sample = std::vector<char>();
+        }
+
+        Choose choose;
+        std::unique_ptr<ErasedStage> chosen;
+        std::vector<char> sample;
+    };
+
+    // Reads whichever codec the data turns out to be, told apart by its magic bytes
+    class AutoDecoder {
+    public:
+        using Choose = std::function<std::unique_ptr<ErasedStage>(const std::string& format)>;
+
+        explicit AutoDecoder(Choose choose) : choose(std::move(choose)) {}
+
+        void init() {
+            chosen.reset();
+            head.clear();
+        }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            if (chosen) {
+                chosen->process(input, emitTo(out));
+                return;
+            }
+            head.insert(head.end(), input.data, input.data + input.size);
+            if (head.size() >= FORMAT_MAGIC_SIZE) {
+                start(out);
+            }
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            if (!chosen) {
+                start(out);
+            }
+            chosen->finish(emitTo(out));
+        }
+
+        // A file is told apart before it is read, so indexed gzip keeps its index reader
+        template <typename Out>
+        bool decodeFile(const std::string& path, Out& out) {
+            pick(Compressor::detectFormat(path));
+            return chosen->decodeFile(path, emitTo(out));
+        }
+
+    private:
+        void pick(const std::string& format) {
+            if (format.empty()) {
+                DB_THROW(CompressionError, "Unrecognized compressed data");
+            }
+            chosen = choose(format);
+            chosen->init();
+        }
+
+        template <typename Out>
+        void start(Out& out) {
+            pick(formatFromMagic(reinterpret_cast<const unsigned char*>(head.data()), head.size()));
+            if (!head.empty()) {
+                chosen->process(ByteSpan{head.data(), head.size()}, emitTo(out));
+            }
+            head.clear();
+        }
+
+        Choose choose;
+        std::unique_ptr<ErasedStage> chosen;
+        std::vector<char> head;
+    };
+}
+
+void Compressor::selectForFile(const std::string& inputPath) const {
+    if (format != CompressionFormat::Auto || selected) {
+        return;
+    }
+
+    std::ifstream inFile(inputPath, std::ios::binary);
+    if (!inFile) {
+        DB_THROW(CompressionError, "Failed to open input file for compression");
+    }
+    std::vector<char> sample(AUTO_SAMPLE_SIZE);
+    inFile.read(sample.data(), sample.size());
+    sample.resize(static_cast<size_t>(inFile.gcount()));
+
+    // Time the codecs on what they will actually be given
+    if (sqlTransform) {
+        std::vector<char> transformed;
+        SqlTransformEncoder encoder([&transformed](const char* data, size_t size) {
+            transformed.insert(transformed.end(), data, data + size);
+            return true;
+        });
+        encoder.write(sample.data(), sample.size());
+        encoder.finish();
+        sample.swap(transformed);
+    }
+    selectFromSample(sample);
+}
+
+const CompressionProfile* Compressor::getSelectedProfile() const {
+    return selected ? &*selected : nullptr;
+}
+
+CompressionConfig Compressor::selectedConfig() const {
+    CompressionConfig config = settings;
+    config.format = selected->format;
+    config.level = selected->level;
+    config.transform = "none";  // Already applied ahead of compressAuto
+    return config;
+}
+
+void Compressor::selectFromSample(const std::vector<char>& sample) const {
+    // Too little data to time; take the safe middle ground
+    if (sample.empty()) {
+        selected = CompressionProfile{"gzip", "medium", 1.0, 0.0};
+        return;
+    }
+
+    std::optional<CompressionProfile> best;     // Densest that meets the target
+    std::optional<CompressionProfile> fastest;  // Fallback when nothing does
+    std::string tooSlow;
+
+    for (const AutoCandidate& candidate : AUTO_CANDIDATES) {
+        if (tooSlow == candidate.format) {
+            continue;
+        }
+
+        // Timed on one thread; parallel codecs are assumed to scale with workers
+        CompressionConfig config = settings;
+        config.format = candidate.format;
+        config.level = candidate.level;
+        config.threads = 1;
+        config.transform = "none";
+        Compressor probe(config);
+
+        // Output is only counted, so the probe measures the codec rather than the disk
+        size_t compressedSize = 0;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = false;
+        try {
+            ok = probe.compressStream(memorySource(sample.data(), sample.size()),
+                                      [&compressedSize](const char*, size_t size) {
+                compressedSize += size;
+                return true;
+            });
+        } catch (const std::exception&) {
+            ok = false;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (!ok) {
+            continue;
+        }
+
+        CompressionProfile profile;
+        profile.format = candidate.format;
+        profile.level = candidate.level;
+        profile.ratio = static_cast<double>(compressedSize) / sample.size();
+        profile.throughputMBps = sample.size() / 1e6 / std::max(elapsed.count(), 1e-6) *
+                                 (candidate.parallel ? threads : 1);
+
+        if (!fastest || profile.throughputMBps > fastest->throughputMBps) {
+            fastest = profile;
+        }
+        if (profile.throughputMBps < settings.targetThroughput) {
+            tooSlow = candidate.format;
+        } else if (!best || profile.ratio < best->ratio) {
+            best = profile;
+        }
+    }
+
+    if (!fastest) {
+        DB_THROW(CompressionError, "No compression codec could compress the sample");
+    }
+    selected = best ? best : fastest;
+}
+
+template <typename Run>
+bool Compressor::withEncoder(Run&& run) const {
+    switch (format) {
+        case CompressionFormat::Gzip:
+            if (threads > 1) {
+                return run(ParallelGzipEncoder(threads, getZlibLevel(), passthrough));
+            }
+            return run(GzipEncoder(getZlibLevel(), passthrough));
+        case CompressionFormat::IndexedGzip:
+            return run(IndexedGzipEncoder(threads, getZlibLevel(), passthrough));
+        case CompressionFormat::Zstd:
+#ifdef USE_ZSTD
+            return run(ZstdEncoder(getZstdLevel(), threads, longDistance, latestDictionary(settings)));
+#else
+            DB_THROW(ConfigurationError, "zstd support not enabled");
+#endif
+        case CompressionFormat::Xz:
+#ifdef USE_XZ
+            return run(XzEncoder(threads, blockSize, getXzPreset()));
+#else
+            DB_THROW(ConfigurationError, "xz support not enabled");
+#endif
+        case CompressionFormat::Bzip2:
+#ifdef USE_BZIP2
+            return run(Bzip2Encoder(threads, getBzip2BlockSize()));
+#else
+            DB_THROW(ConfigurationError, "bzip2 support not enabled");
+#endif
+        case CompressionFormat::Lz4:
+#ifdef USE_LZ4
+            return run(Lz4Encoder(getLz4Level()));
+#else
+            DB_THROW(ConfigurationError, "lz4 support not enabled");
+#endif
+        case CompressionFormat::Auto:
+            if (selected) {
+                return Compressor(selectedConfig()).withEncoder(std::forward<Run>(run));
+            }
+            return run(AutoEncoder([this](const std::vector<char>& sample) {
+                selectFromSample(sample);
+                return Compressor(selectedConfig()).encoderStage();
+            }));
+        default:
+            DB_THROW(ConfigurationError, "Unknown compression format");
+    }
+    return false;
+}
+
+template <typename Run>
+bool Compressor::withDecoder(Run&& run) const {
+    switch (format) {
+        case CompressionFormat::Gzip:
+        case CompressionFormat::IndexedGzip:
+            // Both variants are gzip; the decoder tells them apart from the data
+            return run(GzipDecoder(threads));
+        case CompressionFormat::Zstd:
+#ifdef USE_ZSTD
+            return run(ZstdDecoder(settings.dictionaryDir));
+#else
+            DB_THROW(ConfigurationError, "zstd support not enabled");
+#endif
+        case CompressionFormat::Xz:
+#ifdef USE_XZ
+            return run(XzDecoder(threads));
+#else
+            DB_THROW(ConfigurationError, "xz support not enabled");
+#endif
+        case CompressionFormat::Bzip2:
+#ifdef USE_BZIP2
+            if (threads > 1) {
+                return run(ParallelBzip2Decoder(threads));
+            }
+            return run(Bzip2Decoder());
+#else
+            DB_THROW(ConfigurationError, "bzip2 support not enabled");
+#endif
+        case CompressionFormat::Lz4:
+#ifdef USE_LZ4
+            return run(Lz4Decoder());
+#else
+            DB_THROW(ConfigurationError, "lz4 support not enabled");
+#endif
+        case CompressionFormat::Auto:
+            // Whichever codec was picked, the data identifies itself
+            return run(AutoDecoder([this](const std::string& detected) {
+                CompressionConfig readConfig = settings;
+                readConfig.format = detected;
+                return Compressor(readConfig).decoderStage();
+            }));
+        default:
+            DB_THROW(ConfigurationError, "Unknown compression format");
+    }
+    return false;
+}
+
+std::unique_ptr<ErasedStage> Compressor::encoderStage() const {
+    std::unique_ptr<ErasedStage> stage;
+    withEncoder([&stage](auto codec) {
+        stage = eraseStage(std::move(codec));
+        return true;
+    });
+    return stage;
+}
+
+std::unique_ptr<ErasedStage> Compressor::decoderStage() const {
+    std::unique_ptr<ErasedStage> stage;
+    withDecoder([&stage](auto codec) {
+        stage = eraseStage(std::move(codec));
+        return true;
+    });
+    return stage;
+}
+
+size_t Compressor::estimateCompressedSize(size_t inputSize) const {
+    if (selected) {
+        // Measured on the head of the data only, so leave 10% for the rest to differ
+        return static_cast<size_t>(inputSize * selected->ratio * 1.1) + 1024;
+    }
+
+    if (format == CompressionFormat::Lz4) {
+        // LZ4 has no entropy coding stage, so typical SQL dumps only shrink to
+        // about half (LZ4HC a little further) where gzip reaches a quarter
+        double lz4Ratio = level == CompressionLevel::High ? 0.45 : 0.55;
+        size_t frameOverhead = 19 + 4 + 4;  // Max header, end mark, content checksum
+        return static_cast<size_t>(inputSize * lz4Ratio) + frameOverhead;
+    }
+
+    // Conservative estimation based on compression level and format
+    // For random/incompressible data, compression might actually increase size slightly
+    double ratio;
+    switch (level) {
         case CompressionLevel::Low:
             ratio = 1.0;  // Assume no compression for low level
             break;
@@ -236,6 +2394,169 @@ size_t Compressor::estimateCompressedSize(size_t inputSize) const {
     return static_cast<size_t>(inputSize * ratio) + overhead;
 }
 
+struct CompressionWriter::Pipe {
+    ChunkChannel channel{STREAM_QUEUE_DEPTH};
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable progress;
+    size_t queued = 0;      // Chunks handed to the channel
+    size_t taken = 0;       // Chunks the codec has consumed
+    bool done = false;
+    bool abandoned = false;
+    bool result = false;
+    std::exception_ptr error;
+};
+
+CompressionWriter::CompressionWriter(const Compressor& compressor, DataSink output)
+    : pipe(std::make_unique<Pipe>()) {
+    Pipe* p = pipe.get();
+    p->worker = std::thread([p, &compressor, output = std::move(output)]() {
+        bool compressed = false;
+        try {
+            compressed = compressor.compressStream([p](const DataSink& sink) {
+                std::vector<char> chunk;
+                while (p->channel.pop(chunk)) {
+                    if (!sink(chunk.data(), chunk.size())) {
+                        return false;
+                    }
+                    std::lock_guard<std::mutex> lock(p->mutex);
+                    p->taken++;
+                    p->progress.notify_all();
+                }
+                std::lock_guard<std::mutex> lock(p->mutex);
+                return !p->abandoned;
+            }, output);
+        } catch (...) {
+            p->error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(p->mutex);
+            p->result = compressed;
+            p->done = true;
+            p->progress.notify_all();
+        }
+        // Fails any write still blocked on a full queue
+        p->channel.close();
+    });
+}
+
+CompressionWriter::~CompressionWriter() {
+    if (pipe->worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(pipe->mutex);
+            pipe->abandoned = true;
+        }
+        pipe->channel.finish();
+        pipe->worker.join();
+    }
+}
+
+bool CompressionWriter::write(const char* data, size_t size) {
+    if (size == 0) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pipe->mutex);
+        pipe->queued++;
+    }
+    return pipe->channel.push(std::vector<char>(data, data + size));
+}
+
+bool CompressionWriter::flush() {
+    std::unique_lock<std::mutex> lock(pipe->mutex);
+    pipe->progress.wait(lock, [this]() { return pipe->done || pipe->taken == pipe->queued; });
+    return !pipe->done || pipe->result;
+}
+
+bool CompressionWriter::finish() {
+    if (pipe->worker.joinable()) {
+        pipe->channel.finish();
+        pipe->worker.join();
+    }
+    if (pipe->error) {
+        std::rethrow_exception(pipe->error);
+    }
+    return pipe->result;
+}
+
+DataSink CompressionWriter::asSink() {
+    return [this](const char* data, size_t size) {
+        return write(data, size);
+    };
+}
+
+struct DecompressionReader::Pipe {
+    ChunkChannel channel{STREAM_QUEUE_DEPTH};
+    std::thread worker;
+    std::vector<char> chunk;  // Being handed out by read()
+    size_t offset = 0;
+    bool ended = false;
+    bool result = false;
+    std::exception_ptr error;
+};
+
+DecompressionReader::DecompressionReader(const Compressor& compressor, const std::string& inputPath) {
+    start([&compressor, inputPath](const DataSink& sink) {
+        return compressor.decompressStream(inputPath, sink);
+    });
+}
+
+DecompressionReader::DecompressionReader(const Compressor& compressor, DataProducer input) {
+    start([&compressor, input = std::move(input)](const DataSink& sink) {
+        return compressor.decompressStream(input, sink);
+    });
+}
+
+DecompressionReader::~DecompressionReader() {
+    if (pipe->worker.joinable()) {
+        // The codec's next write fails, which stops it
+        pipe->channel.close();
+        pipe->worker.join();
+    }
+}
+
+void DecompressionReader::start(std::function<bool(const DataSink& sink)> run) {
+    pipe = std::make_unique<Pipe>();
+    Pipe* p = pipe.get();
+    p->worker = std::thread([p, run = std::move(run)]() {
+        try {
+            p->result = run([p](const char* data, size_t size) {
+                return p->channel.push(std::vector<char>(data, data + size));
+            });
+        } catch (...) {
+            p->error = std::current_exception();
+        }
+        p->channel.finish();
+    });
+}
+
+size_t DecompressionReader::read(char* buffer, size_t capacity) {
+    while (pipe->offset == pipe->chunk.size()) {
+        if (pipe->ended) {
+            return 0;
+        }
+        pipe->offset = 0;
+        if (!pipe->channel.pop(pipe->chunk)) {
+            pipe->chunk.clear();
+            pipe->ended = true;
+            pipe->worker.join();
+            if (pipe->error) {
+                std::rethrow_exception(pipe->error);
+            }
+            if (!pipe->result) {
+                DB_THROW(CompressionError, "Decompression failed");
+            }
+            return 0;
+        }
+    }
+
+    size_t count = std::min(capacity, pipe->chunk.size() - pipe->offset);
+    std::memcpy(buffer, pipe->chunk.data() + pipe->offset, count);
+    pipe->offset += count;
+    return count;
+}
+
 bool compressFile(const std::string& inputPath, const std::string& outputPath) {
     std::ifstream inFile(inputPath, std::ios::binary);
     if (!inFile) {
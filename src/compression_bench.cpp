@@ -0,0 +1,157 @@
+#include "compression_bench.hpp"
+#include "../include/compression.hpp"
+#include "error/ErrorUtils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using namespace dbbackup::error;
+
+namespace dbbackup {
+
+namespace {
+    const char* const BENCH_LEVELS[] = {"low", "medium", "high"};
+
+    // Restarts the kernel's peak RSS tracking (VmHWM) at the current RSS.
+    // Linux only; elsewhere the peak stays the process-lifetime maximum.
+    void resetPeakRss() {
+        std::ofstream clearRefs("/proc/self/clear_refs");
+        clearRefs << "5";
+    }
+
+    size_t peakRssKB() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmHWM:") == 0) {
+                return std::stoul(line.substr(6));
+            }
+        }
+        struct rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<size_t>(usage.ru_maxrss);
+    }
+
+    double megabytesPerSecond(size_t bytes, std::chrono::steady_clock::duration elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        return bytes / 1e6 / std::max(seconds, 1e-9);
+    }
+
+    void benchmarkOne(const std::vector<char>& sample, const CompressionConfig& config,
+                      const std::string& scratchPath, CodecBenchmark& result) {
+        Compressor compressor(config);
+
+        // Compress to memory, so only the codec is timed
+        std::vector<char> compressed;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = compressor.compressStream(memorySource(sample.data(), sample.size()), memorySink(compressed));
+        auto compressTime = std::chrono::steady_clock::now() - start;
+        DB_CHECK(ok, CompressionError, "Compression failed");
+
+        // Restores decode files, which is what lets xz, bzip2 and indexed gzip go parallel
+        {
+            std::ofstream scratch(scratchPath, std::ios::binary | std::ios::trunc);
+            scratch.write(compressed.data(), compressed.size());
+            DB_CHECK(scratch.flush(), CompressionError, "Failed to write benchmark scratch file");
+        }
+
+        size_t offset = 0;
+        bool matches = true;
+        start = std::chrono::steady_clock::now();
+        ok = compressor.decompressStream(scratchPath, [&](const char* data, size_t size) {
+            matches = matches && offset + size <= sample.size() &&
+                      std::memcmp(sample.data() + offset, data, size) == 0;
+            offset += size;
+            return true;
+        });
+        auto decompressTime = std::chrono::steady_clock::now() - start;
+        DB_CHECK(ok, CompressionError, "Decompression failed");
+        DB_CHECK(matches && offset == sample.size(), CompressionError, "Round trip does not match the input");
+
+        result.compressedBytes = compressed.size();
+        result.ratio = sample.empty() ? 1.0 : static_cast<double>(compressed.size()) / sample.size();
+        result.compressMBps = megabytesPerSecond(sample.size(), compressTime);
+        result.decompressMBps = megabytesPerSecond(sample.size(), decompressTime);
+    }
+}
+
+std::vector<char> loadBenchSample(const std::string& path, size_t limit, const CompressionConfig& config) {
+    std::vector<char> sample;
+    std::string format = Compressor::detectFormat(path);
+
+    if (format.empty()) {
+        std::ifstream inFile(path, std::ios::binary);
+        DB_CHECK(inFile, CompressionError, "Failed to open benchmark input: " + path);
+        sample.resize(limit);
+        inFile.read(sample.data(), sample.size());
+        sample.resize(static_cast<size_t>(inFile.gcount()));
+        return sample;
+    }
+
+    CompressionConfig readConfig = config;
+    readConfig.format = format;
+    Compressor compressor(readConfig);
+    DecompressionReader reader(compressor, path);
+    std::vector<char> buffer(1024 * 1024);
+    while (sample.size() < limit) {
+        size_t got = reader.read(buffer.data(), std::min(buffer.size(), limit - sample.size()));
+        if (got == 0) {
+            break;
+        }
+        sample.insert(sample.end(), buffer.data(), buffer.data() + got);
+    }
+    return sample;
+}
+
+std::vector<CodecBenchmark> benchmarkCodecs(const std::vector<char>& sample,
+                                            const CompressionConfig& config,
+                                            const std::vector<int>& threadCounts,
+                                            const std::string& scratchDir) {
+    const std::string scratchPath =
+        (fs::path(scratchDir) / ("hegemon_bench_" + std::to_string(getpid()) + ".tmp")).string();
+
+    std::vector<CodecBenchmark> results;
+    for (const std::string& format : Compressor::availableFormats()) {
+        for (const char* level : BENCH_LEVELS) {
+            for (int threads : threadCounts) {
+                CompressionConfig benchConfig = config;
+                benchConfig.enabled = true;
+                benchConfig.format = format;
+                benchConfig.level = level;
+                benchConfig.threads = threads;
+
+                CodecBenchmark result;
+                result.format = format;
+                result.level = level;
+                result.threads = threads;
+                result.inputBytes = sample.size();
+
+                resetPeakRss();
+                try {
+                    benchmarkOne(sample, benchConfig, scratchPath, result);
+                } catch (const std::exception& e) {
+                    // Figures from a run that failed part way aren't kept
+                    result.compressedBytes = 0;
+                    result.ratio = 0.0;
+                    result.compressMBps = 0.0;
+                    result.decompressMBps = 0.0;
+                    result.error = e.what();
+                }
+                result.peakRssKB = peakRssKB();
+                results.push_back(result);
+            }
+        }
+    }
+
+    std::error_code ignored;
+    fs::remove(scratchPath, ignored);
+    return results;
+}
+
+} // namespace dbbackup
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "config.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace dbbackup {
+
+/// One codec setting measured by benchmarkCodecs
+struct CodecBenchmark {
+    std::string format;
+    std::string level;
+    int threads = 1;
+    size_t inputBytes = 0;
+    size_t compressedBytes = 0;
+    double ratio = 0.0;            // Compressed size / input size
+    double compressMBps = 0.0;     // Input bytes per second of compression
+    double decompressMBps = 0.0;   // Input bytes per second of decompression
+    size_t peakRssKB = 0;          // Process high-water mark while this setting ran, sample included
+    std::string error;             // Set if the setting failed; the figures are then zero
+};
+
+/// Reads up to limit bytes of uncompressed data to benchmark on. A compressed backup
+/// is decompressed first, so codecs are measured on the dump itself.
+std::vector<char> loadBenchSample(const std::string& path, size_t limit, const CompressionConfig& config);
+
+/// Compresses and decompresses sample with every available codec, level and thread count,
+/// checking each round trip. Decompression reads from a file in scratchDir, as restore does.
+std::vector<CodecBenchmark> benchmarkCodecs(const std::vector<char>& sample,
+                                            const CompressionConfig& config,
+                                            const std::vector<int>& threadCounts,
+                                            const std::string& scratchDir);
+
+} // namespace dbbackup
@@ -150,6 +150,10 @@ Config Config::fromFile(const std::string& configPath) {
         if (storageConfig.contains("cloudPath")) {
             config.storage.cloudPath = storageConfig["cloudPath"].get<std::string>();
         }
+        config.storage.spaceWaitSeconds = storageConfig.value("spaceWaitSeconds", 3600);
+        DB_CHECK(config.storage.spaceWaitSeconds >= 0, ConfigurationError, "Space wait cannot be negative");
+        config.storage.minReservationMB = storageConfig.value("minReservationMB", 1024);
+        DB_CHECK(config.storage.minReservationMB >= 0, ConfigurationError, "Minimum reservation cannot be negative");
 
         // Logging configuration
         DB_CHECK(configJson.contains("logging"), ConfigurationError, "Missing 'logging' section in config");
@@ -174,6 +178,10 @@ Config Config::fromFile(const std::string& configPath) {
         // Backup configuration
         if (configJson.contains("backup")) {
             const auto& backupConfig = configJson["backup"];
+            config.backup.streaming = backupConfig.value("streaming", true);
+            config.backup.delta = backupConfig.value("delta", false);
+            config.backup.deltaChainLength = backupConfig.value("deltaChainLength", 7);
+            config.backup.ioMode = backupConfig.value("ioMode", "buffered");
             
             // Compression settings
             if (backupConfig.contains("compression")) {
@@ -181,6 +189,14 @@ Config Config::fromFile(const std::string& configPath) {
                 config.backup.compression.enabled = compressionConfig.value("enabled", false);
                 config.backup.compression.format = compressionConfig.value("format", "gzip");
                 config.backup.compression.level = compressionConfig.value("level", "medium");
+                config.backup.compression.threads = compressionConfig.value("threads", 0);
+                config.backup.compression.longDistance = compressionConfig.value("longDistance", false);
+                config.backup.compression.blockSize = compressionConfig.value("blockSize", static_cast<size_t>(0));
+                config.backup.compression.targetThroughput = compressionConfig.value("targetThroughput", 100.0);
+                config.backup.compression.passthrough = compressionConfig.value("passthrough", true);
+                config.backup.compression.dictionary = compressionConfig.value("dictionary", false);
+                config.backup.compression.dictionaryDir = compressionConfig.value("dictionaryDir", "");
+                config.backup.compression.transform = compressionConfig.value("transform", "none");
             }
             
             // Retention settings
@@ -197,6 +213,11 @@ Config Config::fromFile(const std::string& configPath) {
                 config.backup.schedule.cron = scheduleConfig.value("cron", "0 0 * * *");
             }
 
+            // Dictionaries live in the backup repository unless configured elsewhere
+            if (config.backup.compression.dictionaryDir.empty()) {
+                config.backup.compression.dictionaryDir = config.storage.localPath + "/dictionaries";
+            }
+
             // Set up the backup pointer in storage config
             config.storage.backup = &config.backup;
         }
@@ -276,14 +297,40 @@ Config Config::fromFile(const std::string& configPath) {
         // Validate backup configuration
         if (config.backup.compression.enabled) {
             DB_CHECK(config.backup.compression.format == "gzip" || 
+                    config.backup.compression.format == "gzip-indexed" ||
+                    config.backup.compression.format == "zstd" ||
                     config.backup.compression.format == "bzip2" ||
-                    config.backup.compression.format == "xz",
+                    config.backup.compression.format == "xz" ||
+                    config.backup.compression.format == "lz4" ||
+                    config.backup.compression.format == "auto",
                     ConfigurationError, "Invalid compression format");
             
             DB_CHECK(config.backup.compression.level == "low" ||
                     config.backup.compression.level == "medium" ||
                     config.backup.compression.level == "high",
                     ConfigurationError, "Invalid compression level");
+
+            DB_CHECK(config.backup.compression.threads >= 0,
+                    ConfigurationError, "Compression threads cannot be negative");
+
+            DB_CHECK(config.backup.compression.targetThroughput > 0,
+                    ConfigurationError, "Compression target throughput must be positive");
+
+            DB_CHECK(config.backup.compression.transform == "none" ||
+                    config.backup.compression.transform == "sql",
+                    ConfigurationError, "Invalid compression transform");
+        }
+
+        DB_CHECK(config.backup.ioMode == "buffered" ||
+                config.backup.ioMode == "dropbehind" ||
+                config.backup.ioMode == "direct",
+                ConfigurationError, "Invalid I/O mode");
+
+        if (config.backup.delta) {
+            DB_CHECK(config.backup.compression.enabled && config.backup.compression.format == "zstd",
+                    ConfigurationError, "Delta backups require zstd compression");
+            DB_CHECK(config.backup.deltaChainLength >= 1,
+                    ConfigurationError, "Delta chain length must be at least 1");
         }
 
         // Validate schedule configuration
@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <filesystem>
 #include <sstream>
+#include <fstream>
+#include <unistd.h>
 
 using namespace dbbackup::error;
 
@@ -217,4 +219,103 @@ bool MySQLConnection::restoreBackup(const std::string& backupPath) {
     });
     
     return false;
-} 
\ No newline at end of file
+}
+
+std::string MySQLConnection::writeOptionFile() {
+    // Get password from credential manager
+    auto& credManager = CredentialManager::getInstance();
+    auto cred = credManager.getCredential(
+        currentConfig.credentials.passwordKey,
+        CredentialType::Password,
+        currentConfig.credentials.preferredSources
+    );
+
+    if (!cred) {
+        DB_THROW(AuthenticationError, "Failed to retrieve database password");
+    }
+
+    // Streams have no backup path to sit next to; each gets a private file of its own
+    return writeSecretFile("[client]\npassword=" + cred->value + "\n");
+}
+
+bool MySQLConnection::streamBackup(const BackupSink& sink) {
+    DB_TRY_CATCH_LOG("MySQLConnection", {
+        if (!mysql || mysql_ping(mysql) != 0) {
+            DB_THROW(BackupError, "Not connected to MySQL server");
+        }
+
+        std::string tempPwFile = writeOptionFile();
+
+        // Same as createBackup, but mysqldump writes to stdout instead of --result-file
+        std::string cmd = "mysqldump"
+            " --defaults-extra-file=" + tempPwFile +
+            " --host=" + currentConfig.host +
+            " --port=" + std::to_string(currentConfig.port) +
+            " --user=" + currentConfig.credentials.username +
+            " --databases " + currentDatabase +
+            " --add-drop-database" +
+            " --add-drop-table" +
+            " --create-options" +
+            " --quote-names" +
+            " --single-transaction" +  // For InnoDB tables
+            " --set-gtid-purged=OFF";
+
+        int result;
+        try {
+            result = runCommandToSink(cmd, sink);
+        } catch (...) {
+            std::filesystem::remove(tempPwFile);
+            throw;
+        }
+
+        // Always remove the temporary password file
+        std::filesystem::remove(tempPwFile);
+
+        if (result != 0) {
+            DB_THROW(BackupError, "mysqldump failed with error code: " + 
+                    std::to_string(result));
+        }
+
+        return true;
+    });
+    
+    return false;
+}
+
+bool MySQLConnection::streamRestore(const RestoreSource& source) {
+    DB_TRY_CATCH_LOG("MySQLConnection", {
+        if (!mysql || mysql_ping(mysql) != 0) {
+            DB_THROW(RestoreError, "Not connected to MySQL server");
+        }
+
+        std::string tempPwFile = writeOptionFile();
+
+        // Same as restoreBackup, but the script arrives on stdin through a pipe
+        std::string cmd = "mysql"
+            " --defaults-extra-file=" + tempPwFile +
+            " --host=" + currentConfig.host +
+            " --port=" + std::to_string(currentConfig.port) +
+            " --user=" + currentConfig.credentials.username +
+            " " + currentDatabase;
+
+        int result;
+        try {
+            result = runCommandFromSource(cmd, source);
+        } catch (...) {
+            std::filesystem::remove(tempPwFile);
+            throw;
+        }
+
+        // Always remove the temporary password file
+        std::filesystem::remove(tempPwFile);
+
+        if (result != 0) {
+            DB_THROW(RestoreError, "mysql restore failed with error code: " + 
+                    std::to_string(result));
+        }
+
+        return true;
+    });
+    
+    return false;
+}
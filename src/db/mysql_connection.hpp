@@ -13,8 +13,13 @@ public:
     bool disconnect() override;
     bool createBackup(const std::string& backupPath) override;
     bool restoreBackup(const std::string& backupPath) override;
+    bool streamBackup(const BackupSink& sink) override;
+    bool streamRestore(const RestoreSource& source) override;
 
 private:
+    /// Writes a temporary [client] option file holding the password and returns its path
+    std::string writeOptionFile();
+
     dbbackup::DatabaseConfig currentConfig;  // Store config for backup/restore operations
     MYSQL* mysql = nullptr;  // MySQL connection handle
     std::string currentDatabase;  // Current database name
@@ -14,8 +14,16 @@ public:
     bool disconnect() override;
     bool createBackup(const std::string& backupPath) override;
     bool restoreBackup(const std::string& backupPath) override;
+    bool streamBackup(const BackupSink& sink) override;
+    bool streamRestore(const RestoreSource& source) override;
+    uint64_t estimatedBackupSize() override;
 
 private:
+    /// Writes a private temporary .pgpass file and runs command with the shell
+    /// assignment that points PGPASSFILE at it ("PGPASSFILE=<path> ") to put in front
+    /// of its command line. Removes the file after; returns the command's exit status.
+    int runWithPassFile(const std::function<int(const std::string&)>& command);
+
     dbbackup::DatabaseConfig currentConfig;  // Store config for backup/restore operations
     std::unique_ptr<pqxx::connection> conn;  // PostgreSQL connection handle
     std::string currentDatabase;  // Current database name
@@ -2,6 +2,8 @@
 #include "error/ErrorUtils.hpp"
 #include <iostream>
 #include <filesystem>
+#include <algorithm>
+#include <cstring>
 
 using namespace dbbackup::error;
 
@@ -165,4 +167,123 @@ bool SQLiteConnection::restoreBackup(const std::string& backupPath) {
     });
     
     return false;
-} 
\ No newline at end of file
+}
+
+bool SQLiteConnection::streamBackup(const BackupSink& sink) {
+    DB_TRY_CATCH_LOG("SQLiteConnection", {
+        if (!db) {
+            DB_THROW(BackupError, "Not connected to SQLite database");
+        }
+
+        // Serialize the database under a read transaction, giving the same
+        // consistent image the backup API would write to disk
+        sqlite3_int64 size = 0;
+        unsigned char* image = sqlite3_serialize(db, "main", &size, 0);
+        if (!image) {
+            DB_THROW(BackupError, "Failed to serialize database: " +
+                    std::string(sqlite3_errmsg(db)));
+        }
+
+        constexpr sqlite3_int64 chunkSize = 65536;
+        bool ok = true;
+        try {
+            for (sqlite3_int64 offset = 0; ok && offset < size; offset += chunkSize) {
+                size_t n = static_cast<size_t>(std::min(chunkSize, size - offset));
+                ok = sink(reinterpret_cast<const char*>(image + offset), n);
+            }
+        } catch (...) {
+            sqlite3_free(image);
+            throw;
+        }
+
+        sqlite3_free(image);
+        return ok;
+    });
+    
+    return false;
+}
+
+bool SQLiteConnection::streamRestore(const RestoreSource& source) {
+    DB_TRY_CATCH_LOG("SQLiteConnection", {
+        if (!db) {
+            DB_THROW(RestoreError, "Not connected to SQLite database");
+        }
+
+        // Collect the image in SQLite-owned memory so it can be handed to
+        // sqlite3_deserialize without another copy
+        unsigned char* image = nullptr;
+        sqlite3_int64 size = 0;
+        sqlite3_int64 capacity = 0;
+        bool ok;
+        try {
+            ok = source([&](const char* data, size_t n) {
+                if (size + static_cast<sqlite3_int64>(n) > capacity) {
+                    sqlite3_int64 grown = std::max(capacity * 2, size + static_cast<sqlite3_int64>(n));
+                    auto* resized = static_cast<unsigned char*>(sqlite3_realloc64(image, grown));
+                    if (!resized) {
+                        return false;
+                    }
+                    image = resized;
+                    capacity = grown;
+                }
+                std::memcpy(image + size, data, n);
+                size += static_cast<sqlite3_int64>(n);
+                return true;
+            });
+        } catch (...) {
+            sqlite3_free(image);
+            throw;
+        }
+        if (!ok || size == 0) {
+            sqlite3_free(image);
+            DB_THROW(RestoreError, "Failed to read restore stream");
+        }
+
+        sqlite3* backupDb = nullptr;
+        int rc = sqlite3_open(":memory:", &backupDb);
+        if (rc != SQLITE_OK) {
+            sqlite3_free(image);
+            sqlite3_close(backupDb);
+            DB_THROW(RestoreError, "Failed to open in-memory database");
+        }
+
+        // FREEONCLOSE hands ownership of image to backupDb
+        rc = sqlite3_deserialize(backupDb, "main", image, size, capacity,
+                                 SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_READONLY);
+        if (rc != SQLITE_OK) {
+            std::string error = sqlite3_errmsg(backupDb);
+            sqlite3_close(backupDb);
+            DB_THROW(RestoreError, "Failed to load backup image: " + error);
+        }
+
+        // Copy the image into the live database, as restoreBackup does from a file
+        sqlite3_backup* backup = sqlite3_backup_init(db, "main", backupDb, "main");
+        if (!backup) {
+            std::string error = sqlite3_errmsg(db);
+            sqlite3_close(backupDb);
+            DB_THROW(RestoreError, "Failed to initialize restore: " + error);
+        }
+
+        rc = sqlite3_backup_step(backup, -1);
+        if (rc != SQLITE_DONE) {
+            std::string error = sqlite3_errmsg(db);
+            sqlite3_backup_finish(backup);
+            sqlite3_close(backupDb);
+            DB_THROW(RestoreError, "Failed to complete restore: " + error);
+        }
+
+        sqlite3_backup_finish(backup);
+        sqlite3_close(backupDb);
+        
+        return true;
+    });
+    
+    return false;
+}
+
+uint64_t SQLiteConnection::estimatedBackupSize() {
+    // A backup is a copy of the database file
+    std::error_code unknown;
+    uintmax_t size = std::filesystem::file_size(currentDatabase, unknown);
+    return unknown ? 0 : size;
+}
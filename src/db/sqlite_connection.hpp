@@ -13,6 +13,9 @@ public:
     bool disconnect() override;
     bool createBackup(const std::string& backupPath) override;
     bool restoreBackup(const std::string& backupPath) override;
+    bool streamBackup(const BackupSink& sink) override;
+    bool streamRestore(const RestoreSource& source) override;
+    uint64_t estimatedBackupSize() override;
 
 private:
     dbbackup::DatabaseConfig currentConfig;  // Store config for backup/restore operations
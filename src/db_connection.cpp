@@ -4,6 +4,17 @@
 #include "db/mongodb_connection.hpp"
 #include "db/sqlite_connection.hpp"
 #include "error/ErrorUtils.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <csignal>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
 
 using namespace dbbackup::error;
 
@@ -38,4 +49,194 @@ std::unique_ptr<IDBConnection> createDBConnection(const dbbackup::DatabaseConfig
         }
     });
     return nullptr;
-} 
\ No newline at end of file
+}
+
+namespace {
+    constexpr size_t STREAM_CHUNK_SIZE = 65536;  // 64KB pipe reads
+
+    std::filesystem::path makeStagingPath() {
+        static std::atomic<unsigned> counter{0};
+        return std::filesystem::temp_directory_path() /
+            (".hegemon_stream_" + std::to_string(getpid()) + "_" + std::to_string(counter++) + ".dump");
+    }
+}
+
+bool IDBConnection::streamBackup(const BackupSink& sink) {
+    DB_TRY_CATCH_LOG("DBConnection", {
+        std::filesystem::path tempPath = makeStagingPath();
+
+        if (!createBackup(tempPath.string())) {
+            std::filesystem::remove(tempPath);
+            return false;
+        }
+
+        bool ok = true;
+        {
+            std::ifstream inFile(tempPath, std::ios::binary);
+            if (!inFile) {
+                std::filesystem::remove(tempPath);
+                DB_THROW(BackupError, "Failed to open staged backup: " + tempPath.string());
+            }
+            std::vector<char> buffer(STREAM_CHUNK_SIZE);
+            while (ok && (inFile.read(buffer.data(), buffer.size()) || inFile.gcount() > 0)) {
+                ok = sink(buffer.data(), static_cast<size_t>(inFile.gcount()));
+            }
+        }
+
+        std::filesystem::remove(tempPath);
+        return ok;
+    });
+    return false;
+}
+
+bool IDBConnection::streamRestore(const RestoreSource& source) {
+    DB_TRY_CATCH_LOG("DBConnection", {
+        std::filesystem::path tempPath = makeStagingPath();
+
+        bool ok;
+        {
+            std::ofstream outFile(tempPath, std::ios::binary);
+            if (!outFile) {
+                DB_THROW(RestoreError, "Failed to create staging file: " + tempPath.string());
+            }
+            try {
+                ok = source([&outFile](const char* data, size_t size) {
+                    outFile.write(data, size);
+                    return static_cast<bool>(outFile);
+                });
+            } catch (...) {
+                outFile.close();
+                std::filesystem::remove(tempPath);
+                throw;
+            }
+        }
+
+        if (ok) {
+            try {
+                ok = restoreBackup(tempPath.string());
+            } catch (...) {
+                std::filesystem::remove(tempPath);
+                throw;
+            }
+        }
+
+        std::filesystem::remove(tempPath);
+        return ok;
+    });
+    return false;
+}
+
+std::string writeSecretFile(const std::string& contents) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::error_code ignored;
+    if (const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+        runtimeDir && *runtimeDir && std::filesystem::is_directory(runtimeDir, ignored)) {
+        dir = runtimeDir;
+    }
+
+    std::string path = (dir / ".hegemon_XXXXXX").string();
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+        DB_THROW(BackupError, "Failed to create password file in " + dir.string());
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t n = ::write(fd, contents.data() + written, contents.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    if (::close(fd) != 0 || written != contents.size()) {
+        std::filesystem::remove(path, ignored);
+        DB_THROW(BackupError, "Failed to write password file: " + path);
+    }
+    return path;
+}
+
+int runCommandToSink(const std::string& cmd, const BackupSink& sink) {
+    FILE* pipe = popen(cmd.c_str(), "r");
+    if (!pipe) {
+        return -1;
+    }
+
+    std::vector<char> buffer(STREAM_CHUNK_SIZE);
+    bool aborted = false;
+    try {
+        size_t n;
+        while ((n = fread(buffer.data(), 1, buffer.size(), pipe)) > 0) {
+            if (!sink(buffer.data(), n)) {
+                aborted = true;
+                break;
+            }
+        }
+    } catch (...) {
+        // Closing our end makes the command fail its next write and exit
+        pclose(pipe);
+        throw;
+    }
+
+    int status = pclose(pipe);
+    return aborted ? -1 : status;
+}
+
+namespace {
+
+// Blocks SIGPIPE for the calling thread only, so a client that exits early surfaces
+// as a failed write (EPIPE) without touching how other threads handle the signal.
+// A SIGPIPE raised meanwhile is consumed before the mask is restored.
+class SigpipeBlock {
+public:
+    SigpipeBlock() {
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipe, &previous);
+    }
+
+    ~SigpipeBlock() {
+        if (!sigismember(&previous, SIGPIPE)) {
+            sigset_t pending;
+            sigpending(&pending);
+            if (sigismember(&pending, SIGPIPE)) {
+                struct timespec now{};
+                sigtimedwait(&sigpipe, nullptr, &now);
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+    SigpipeBlock(const SigpipeBlock&) = delete;
+    SigpipeBlock& operator=(const SigpipeBlock&) = delete;
+
+private:
+    sigset_t sigpipe;
+    sigset_t previous;
+};
+
+}
+
+int runCommandFromSource(const std::string& cmd, const RestoreSource& source) {
+    // A client that exits early must surface as a failed write, not kill us
+    SigpipeBlock blocked;
+
+    FILE* pipe = popen(cmd.c_str(), "w");
+    if (!pipe) {
+        return -1;
+    }
+
+    bool ok;
+    try {
+        ok = source([pipe](const char* data, size_t size) {
+            return fwrite(data, 1, size, pipe) == size;
+        });
+    } catch (...) {
+        pclose(pipe);
+        throw;
+    }
+
+    int status = pclose(pipe);
+    return ok ? status : -1;
+}
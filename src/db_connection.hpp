@@ -1,8 +1,16 @@
 #pragma once
 
 #include "config.hpp"
+#include <cstdint>
 #include <string>
 #include <memory>
+#include <functional>
+
+/// Receives a chunk of dump output. Returns false to abort the dump.
+using BackupSink = std::function<bool(const char* data, size_t size)>;
+
+/// Pushes a complete restore stream into the given sink. Returns true on success.
+using RestoreSource = std::function<bool(const BackupSink& sink)>;
 
 /// Interface for database connections
 class IDBConnection {
@@ -14,7 +22,35 @@ public:
     /// Create a backup at the specified path
     virtual bool createBackup(const std::string& backupPath) = 0;
     virtual bool restoreBackup(const std::string& backupPath) = 0;
+
+    /// Stream a backup into sink as it is produced, without writing it to disk.
+    /// The default implementation stages the dump in a temporary file.
+    virtual bool streamBackup(const BackupSink& sink);
+
+    /// Restore from a stream fed by source, without reading a dump file from disk.
+    /// The default implementation stages the stream in a temporary file.
+    virtual bool streamRestore(const RestoreSource& source);
+
+    /// Rough size of an uncompressed backup of the connected database, for reserving
+    /// storage space before it is taken; 0 if the database can't tell
+    virtual uint64_t estimatedBackupSize() { return 0; }
 };
 
 /// Factory function to create a database connection object depending on dbConfig.type
 std::unique_ptr<IDBConnection> createDBConnection(const dbbackup::DatabaseConfig& dbConfig);
+
+/// Writes contents to a new file only this user can read, for a command that takes a
+/// password from a file. The file is created by mkstemp (mode 0600, a fresh random
+/// name, never an existing file or symlink) in $XDG_RUNTIME_DIR, which is private to
+/// the user, or else the temp directory. Returns its path; the caller removes it.
+/// Throws BackupError if it can't be written.
+std::string writeSecretFile(const std::string& contents);
+
+/// Runs a shell command and forwards its stdout to sink as it is produced.
+/// Returns the command's exit status, or -1 if it could not be started or sink aborted.
+int runCommandToSink(const std::string& cmd, const BackupSink& sink);
+
+/// Runs a shell command and feeds its stdin from source. Writes block while the
+/// command is busy, so source is throttled to the command's pace.
+/// Returns the command's exit status, or -1 if it could not be started or source failed.
+int runCommandFromSource(const std::string& cmd, const RestoreSource& source);
@@ -0,0 +1,168 @@
+#include "dictionary_store.hpp"
+#include "../include/compression.hpp"
+#include "storage.hpp"
+#include "sql_transform.hpp"
+#include "error/ErrorUtils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#ifdef USE_ZSTD
+#include <zdict.h>
+#endif
+
+namespace fs = std::filesystem;
+using namespace dbbackup::error;
+
+namespace dbbackup {
+
+namespace {
+    // IDs below 32768 are reserved by zstd for a future public registry
+    constexpr uint32_t FIRST_DICTIONARY_ID = 32768;
+    constexpr size_t DICTIONARY_CAPACITY = 112640;             // zstd CLI default (110KB)
+    constexpr size_t TRAINING_SAMPLE_SIZE = 16 * 1024;         // Backups are cut into samples this size
+    constexpr size_t MAX_TRAINING_BYTES = 100 * DICTIONARY_CAPACITY;  // ~100x the dictionary, per zstd guidance
+    constexpr size_t DICTIONARY_ID_OFFSET = 4;                 // After the 4-byte dictionary magic
+
+    const std::string DICTIONARY_PREFIX = "zstd_";
+    const std::string DICTIONARY_SUFFIX = ".dict";
+}
+
+DictionaryStore::DictionaryStore(const std::string& directory) : directory(directory) {
+}
+
+std::string DictionaryStore::pathFor(uint32_t id) const {
+    return (fs::path(directory) / (DICTIONARY_PREFIX + std::to_string(id) + DICTIONARY_SUFFIX)).string();
+}
+
+uint32_t DictionaryStore::latestId() const {
+    uint32_t latest = 0;
+    if (!fs::exists(directory)) {
+        return latest;
+    }
+
+    for (const auto& entry : fs::directory_iterator(directory)) {
+        std::string name = entry.path().filename().string();
+        if (name.size() <= DICTIONARY_PREFIX.size() + DICTIONARY_SUFFIX.size() ||
+            name.compare(0, DICTIONARY_PREFIX.size(), DICTIONARY_PREFIX) != 0 ||
+            name.compare(name.size() - DICTIONARY_SUFFIX.size(), DICTIONARY_SUFFIX.size(), DICTIONARY_SUFFIX) != 0) {
+            continue;
+        }
+
+        std::string digits = name.substr(DICTIONARY_PREFIX.size(),
+                                         name.size() - DICTIONARY_PREFIX.size() - DICTIONARY_SUFFIX.size());
+        if (!digits.empty() && std::all_of(digits.begin(), digits.end(), ::isdigit)) {
+            latest = std::max(latest, static_cast<uint32_t>(std::stoul(digits)));
+        }
+    }
+    return latest;
+}
+
+std::vector<char> DictionaryStore::load(uint32_t id) const {
+    std::ifstream inFile(pathFor(id), std::ios::binary);
+    if (!inFile) {
+        DB_THROW(CompressionError, "Compression dictionary " + std::to_string(id) + " not found in " + directory);
+    }
+    return std::vector<char>((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+}
+
+uint32_t DictionaryStore::trainFromBackups(const std::vector<std::string>& backupPaths,
+                                           const CompressionConfig& config) {
+    std::vector<std::vector<char>> samples;
+    size_t collected = 0;
+
+    for (const std::string& path : backupPaths) {
+        if (collected >= MAX_TRAINING_BYTES) {
+            break;
+        }
+
+        // Backups are sampled as they would be compressed, so they are read back as a
+        // restore would: deltas through their chain, compressed ones with this store in
+        // case they used an older dictionary
+        CompressionConfig readConfig = config;
+        readConfig.dictionaryDir = directory;
+
+        std::vector<char> current;
+        auto collect = [&](const char* data, size_t size) {
+            while (size > 0 && collected < MAX_TRAINING_BYTES) {
+                size_t take = std::min(size, TRAINING_SAMPLE_SIZE - current.size());
+                current.insert(current.end(), data, data + take);
+                data += take;
+                size -= take;
+                collected += take;
+                if (current.size() == TRAINING_SAMPLE_SIZE) {
+                    samples.push_back(std::move(current));
+                    current.clear();
+                }
+            }
+            return true;
+        };
+
+        // With the SQL transform on, zstd and so the dictionary see the transformed
+        // stream, not the restored dump
+        SqlTransformStage transform;
+        transform.init();
+        bool read = streamBackupChain(path, readConfig, [&](const char* data, size_t size) {
+            if (config.transform == "sql") {
+                transform.process(ByteSpan{data, size}, collect);
+            } else {
+                collect(data, size);
+            }
+            return true;
+        });
+        if (!read) {
+            DB_THROW(CompressionError, "Failed to read backup for dictionary training: " + path);
+        }
+        if (config.transform == "sql") {
+            transform.finish(collect);
+        }
+        if (!current.empty()) {
+            samples.push_back(std::move(current));
+        }
+    }
+
+    return train(samples);
+}
+
+uint32_t DictionaryStore::train(const std::vector<std::vector<char>>& samples) {
+#ifdef USE_ZSTD
+    std::vector<char> buffer;
+    std::vector<size_t> sizes;
+    for (const auto& sample : samples) {
+        buffer.insert(buffer.end(), sample.begin(), sample.end());
+        sizes.push_back(sample.size());
+    }
+
+    std::vector<char> dictionary(DICTIONARY_CAPACITY);
+    size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), buffer.data(),
+                                        sizes.data(), static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(size)) {
+        DB_THROW(CompressionError, std::string("Dictionary training failed: ") + ZDICT_getErrorName(size));
+    }
+    dictionary.resize(size);
+
+    // The trainer picks a random ID; replace it with the next version number
+    uint32_t id = std::max(latestId() + 1, FIRST_DICTIONARY_ID);
+    for (size_t i = 0; i < 4; i++) {
+        dictionary[DICTIONARY_ID_OFFSET + i] = static_cast<char>((id >> (8 * i)) & 0xff);
+    }
+
+    fs::create_directories(directory);
+    std::string finalPath = pathFor(id);
+    std::string tempPath = finalPath + ".tmp";
+    {
+        std::ofstream outFile(tempPath, std::ios::binary);
+        outFile.write(dictionary.data(), dictionary.size());
+        if (!outFile) {
+            DB_THROW(CompressionError, "Failed to write compression dictionary: " + tempPath);
+        }
+    }
+    fs::rename(tempPath, finalPath);
+    return id;
+#else
+    (void)samples;
+    DB_THROW(ConfigurationError, "zstd support not enabled");
+#endif
+}
+
+} // namespace dbbackup
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "config.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dbbackup {
+
+/// Versioned zstd dictionaries kept in the backup repository.
+/// Each one is saved as zstd_<id>.dict. zstd also writes the ID into the header of
+/// every frame compressed with it, which is how restore finds the right version.
+class DictionaryStore {
+public:
+    explicit DictionaryStore(const std::string& directory);
+
+    /// Trains a dictionary on the given backups (newest first) as zstd would see them with
+    /// config: uncompressed, and transformed if the SQL transform is on. Saves it as the
+    /// next version and returns its ID.
+    uint32_t trainFromBackups(const std::vector<std::string>& backupPaths,
+                              const CompressionConfig& config);
+
+    /// Trains a dictionary on raw samples, saves it as the next version and returns its ID
+    uint32_t train(const std::vector<std::vector<char>>& samples);
+
+    /// ID of the newest dictionary, or 0 if none has been trained
+    uint32_t latestId() const;
+
+    /// Loads a dictionary by ID; throws CompressionError if it is not in the store
+    std::vector<char> load(uint32_t id) const;
+
+    /// Path a dictionary with the given ID is stored at
+    std::string pathFor(uint32_t id) const;
+
+private:
+    std::string directory;
+};
+
+} // namespace dbbackup
@@ -0,0 +1,797 @@
+#include "io_engine.hpp"
+#include "error/ErrorUtils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+#ifdef USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace dbbackup {
+
+namespace {
+    constexpr size_t IO_ALIGNMENT = 4096;
+
+    // Page-aligned memory, as the kernel pins it for registered buffers
+    class AlignedBuffer {
+    public:
+        explicit AlignedBuffer(size_t size) {
+            void* memory = nullptr;
+            if (posix_memalign(&memory, IO_ALIGNMENT, std::max<size_t>(size, 1)) != 0) {
+                throw std::bad_alloc();
+            }
+            data = static_cast<char*>(memory);
+        }
+
+        ~AlignedBuffer() { free(data); }
+
+        AlignedBuffer(const AlignedBuffer&) = delete;
+        AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+        char* data;
+    };
+
+    constexpr uint64_t DROP_BEHIND_WINDOW = 8 * 1024 * 1024;  // Written bytes per writeback request
+
+    std::atomic<CachePolicy> currentPolicy{CachePolicy::Buffered};
+
+    bool isRegularFile(int fd) {
+        struct stat info = {};
+        return fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    }
+
+    // Puts fd in O_DIRECT until end(), if wanted and the filesystem supports it
+    class DirectMode {
+    public:
+        DirectMode(int fd, bool wanted) : fd(fd) {
+#ifdef __linux__
+            flags = fcntl(fd, F_GETFL);
+            active = wanted && flags >= 0 && fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+#else
+            (void)wanted;
+#endif
+        }
+
+        ~DirectMode() { end(); }
+
+        DirectMode(const DirectMode&) = delete;
+        DirectMode& operator=(const DirectMode&) = delete;
+
+        void end() {
+            if (active) {
+                fcntl(fd, F_SETFL, flags);
+                active = false;
+            }
+        }
+
+        bool active = false;
+
+    private:
+        int fd;
+        int flags = 0;
+    };
+
+    // Tells the kernel the cached pages of a range won't be wanted again
+    void dropCached(int fd, uint64_t offset, uint64_t size) {
+#ifdef __linux__
+        posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+#else
+        (void)fd;
+        (void)offset;
+        (void)size;
+#endif
+    }
+
+    // Whether a read that has filled this much of a block has hit the end of the file.
+    // O_DIRECT only returns part of a block there, and can't resume mid-block.
+    bool endOfFile(ssize_t result, size_t filled, bool direct) {
+        return result == 0 || (direct && filled % IO_ALIGNMENT != 0);
+    }
+
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // Network and FUSE filesystems can fail a page fault, which kills the process with
+    // SIGBUS where read() would have returned an error, so only local files are mapped
+    bool onLocalDisk(int fd) {
+#ifdef __linux__
+        static const long remoteFilesystems[] = {
+            0x6969,      // NFS
+            0x517B,      // SMB
+            0xFF534D42,  // CIFS
+            0xFE534D42,  // SMB2
+            0x65735546,  // FUSE
+            0x00C36400,  // Ceph
+            0x01021997,  // 9p
+            0x5346414F,  // AFS
+            0x6B414653,  // kAFS
+            0x73757245,  // Coda
+        };
+        struct statfs info = {};
+        if (fstatfs(fd, &info) != 0) {
+            return false;
+        }
+        for (long type : remoteFilesystems) {
+            if (static_cast<long>(info.f_type) == type) {
+                return false;
+            }
+        }
+        return true;
+#else
+        (void)fd;
+        return true;
+#endif
+    }
+
+    // Read-only mapping of part of a file at a huge-page-aligned address, so the kernel
+    // can back it with huge pages where the filesystem caches large folios
+    class MappedWindow {
+    public:
+        MappedWindow(int fd, uint64_t offset, size_t size) {
+            static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            length = (size + pageSize - 1) / pageSize * pageSize;
+
+            // Reserve enough address space to align inside, then map over the aligned part
+            size_t reserved = length + HUGE_PAGE_SIZE;
+            void* area = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (area == MAP_FAILED) {
+                return;
+            }
+            char* start = static_cast<char*>(area);
+            char* aligned = reinterpret_cast<char*>(
+                (reinterpret_cast<uintptr_t>(start) + HUGE_PAGE_SIZE - 1) & ~(uintptr_t(HUGE_PAGE_SIZE) - 1));
+            void* mapped = mmap(aligned, length, PROT_READ, MAP_SHARED | MAP_FIXED, fd, static_cast<off_t>(offset));
+            if (mapped == MAP_FAILED) {
+                munmap(area, reserved);
+                return;
+            }
+            if (aligned > start) {
+                munmap(start, static_cast<size_t>(aligned - start));
+            }
+            if (start + reserved > aligned + length) {
+                munmap(aligned + length, static_cast<size_t>(start + reserved - (aligned + length)));
+            }
+            data = aligned;
+
+            madvise(data, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            madvise(data, length, MADV_HUGEPAGE);
+#endif
+        }
+
+        ~MappedWindow() {
+            if (data) {
+                munmap(data, length);
+            }
+        }
+
+        MappedWindow(const MappedWindow&) = delete;
+        MappedWindow& operator=(const MappedWindow&) = delete;
+
+        char* data = nullptr;
+
+    private:
+        size_t length = 0;
+    };
+
+    // Hands a file of the given size to sink in blockSize pieces straight out of the page
+    // cache, without copying, mapping MAP_WINDOW_SIZE at a time. mapped is false if the
+    // first window couldn't be mapped and nothing was read.
+    bool readMapped(int fd, uint64_t size, const DataSink& sink, size_t blockSize, bool& mapped) {
+        mapped = false;
+        for (uint64_t offset = 0; offset < size; offset += MAP_WINDOW_SIZE) {
+            size_t windowSize = static_cast<size_t>(std::min<uint64_t>(MAP_WINDOW_SIZE, size - offset));
+            MappedWindow window(fd, offset, windowSize);
+            if (!window.data) {
+                return false;
+            }
+            mapped = true;
+            for (size_t position = 0; position < windowSize; position += blockSize) {
+                if (!sink(window.data + position, std::min(blockSize, windowSize - position))) {
+                    return false;
+                }
+            }
+        }
+        mapped = true;
+        return true;
+    }
+
+    // Blocking read of up to size bytes at offset; fewer means the file ended
+    ssize_t preadFull(int fd, char* data, size_t size, uint64_t offset, bool direct) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t got = ::pread(fd, data + done, size - done, static_cast<off_t>(offset + done));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                return -1;
+            }
+            done += static_cast<size_t>(got);
+            if (endOfFile(got, done, direct)) {
+                break;
+            }
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    bool readBlocking(int fd, const DataSink& sink, size_t blockSize, bool direct) {
+        AlignedBuffer buffer(blockSize);
+        for (uint64_t offset = 0;; offset += blockSize) {
+            ssize_t got = preadFull(fd, buffer.data, blockSize, offset, direct);
+            if (got < 0) {
+                return false;
+            }
+            if (got > 0 && !sink(buffer.data, static_cast<size_t>(got))) {
+                return false;
+            }
+            if (static_cast<size_t>(got) < blockSize) {
+                return true;
+            }
+        }
+    }
+
+#ifdef USE_IO_URING
+    struct Completion {
+        uint64_t tag;
+        int result;
+    };
+
+    // io_uring driven through the raw system calls, so there is no liburing dependency.
+    // One thread submits; every request uses one of the buffers registered at creation.
+    class IoRing {
+    public:
+        // nullptr if the kernel refuses the ring or the buffers (too old, blocked by
+        // seccomp, memlock limit), in which case the caller blocks instead
+        static std::unique_ptr<IoRing> create(unsigned entries, char* buffers, size_t bufferSize) {
+            io_uring_params params = {};
+            int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if (fd < 0) {
+                return nullptr;
+            }
+            std::unique_ptr<IoRing> ring(new IoRing(fd));
+
+            ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (singleMap) {
+                ring->sqRingSize = ring->cqRingSize = std::max(ring->sqRingSize, ring->cqRingSize);
+            }
+            ring->sqRing = mapRing(fd, ring->sqRingSize, IORING_OFF_SQ_RING);
+            if (!ring->sqRing) {
+                return nullptr;
+            }
+            if (singleMap) {
+                ring->cqRing = ring->sqRing;
+            } else {
+                ring->cqRing = mapRing(fd, ring->cqRingSize, IORING_OFF_CQ_RING);
+                if (!ring->cqRing) {
+                    return nullptr;
+                }
+            }
+            ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            ring->sqes = static_cast<io_uring_sqe*>(mapRing(fd, ring->sqesSize, IORING_OFF_SQES));
+            if (!ring->sqes) {
+                return nullptr;
+            }
+
+            char* sq = static_cast<char*>(ring->sqRing);
+            ring->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            ring->sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            ring->sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            char* cq = static_cast<char*>(ring->cqRing);
+            ring->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            ring->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            ring->cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            // Registered once, so requests skip mapping user pages each time
+            std::vector<iovec> iovecs(entries);
+            for (unsigned i = 0; i < entries; i++) {
+                iovecs[i].iov_base = buffers + i * bufferSize;
+                iovecs[i].iov_len = bufferSize;
+            }
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iovecs.data(), entries) != 0) {
+                return nullptr;
+            }
+            return ring;
+        }
+
+        // Waits for requests still in flight, since they point into the caller's buffers
+        ~IoRing() {
+            Completion ignored;
+            while (outstanding > 0 && wait(ignored)) {
+            }
+            if (sqes) {
+                munmap(sqes, sqesSize);
+            }
+            if (cqRing && cqRing != sqRing) {
+                munmap(cqRing, cqRingSize);
+            }
+            if (sqRing) {
+                munmap(sqRing, sqRingSize);
+            }
+            ::close(ringFd);
+        }
+
+        IoRing(const IoRing&) = delete;
+        IoRing& operator=(const IoRing&) = delete;
+
+        // Queues a read or write on registered buffer bufferIndex; data lies inside it
+        void push(uint8_t opcode, int fd, unsigned bufferIndex, char* data, size_t size, uint64_t offset,
+                  uint64_t tag) {
+            unsigned tail = *sqTail;
+            unsigned index = tail & *sqMask;
+            io_uring_sqe* sqe = &sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(data);
+            sqe->len = static_cast<uint32_t>(size);
+            sqe->off = offset;
+            sqe->buf_index = static_cast<uint16_t>(bufferIndex);
+            sqe->user_data = tag;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            pending++;
+            outstanding++;
+        }
+
+        // Hands queued requests to the kernel without waiting for them
+        bool submit() {
+            return pending == 0 || enter(0);
+        }
+
+        // Next finished request; false if the ring itself failed
+        bool wait(Completion& completion) {
+            for (;;) {
+                unsigned head = *cqHead;
+                if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                    const io_uring_cqe& cqe = cqes[head & *cqMask];
+                    completion = Completion{cqe.user_data, cqe.res};
+                    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                    outstanding--;
+                    return true;
+                }
+                if (!enter(1)) {
+                    return false;
+                }
+            }
+        }
+
+        unsigned inFlight() const { return outstanding; }
+
+    private:
+        explicit IoRing(int fd) : ringFd(fd) {}
+
+        static void* mapRing(int fd, size_t size, off_t offset) {
+            void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+            return mapped == MAP_FAILED ? nullptr : mapped;
+        }
+
+        bool enter(unsigned minComplete) {
+            for (;;) {
+                long submitted = syscall(__NR_io_uring_enter, ringFd, pending, minComplete,
+                                         minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (submitted >= 0) {
+                    pending -= static_cast<unsigned>(submitted);
+                    return true;
+                }
+                if (errno != EINTR) {
+                    return false;
+                }
+            }
+        }
+
+        int ringFd;
+        void* sqRing = nullptr;
+        void* cqRing = nullptr;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqRingSize = 0;
+        size_t cqRingSize = 0;
+        size_t sqesSize = 0;
+        unsigned* sqTail = nullptr;
+        unsigned* sqMask = nullptr;
+        unsigned* sqArray = nullptr;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned* cqMask = nullptr;
+        io_uring_cqe* cqes = nullptr;
+        unsigned pending = 0;      // Queued, not yet handed to the kernel
+        unsigned outstanding = 0;  // Queued or in the kernel, not yet reaped
+    };
+
+    bool ioUringAvailable() {
+        static const bool available = [] {
+            io_uring_params params = {};
+            int fd = static_cast<int>(syscall(__NR_io_uring_setup, 1, &params));
+            if (fd < 0) {
+                return false;
+            }
+            ::close(fd);
+            return true;
+        }();
+        return available;
+    }
+
+    bool retryable(int result) {
+        return result == -EINTR || result == -EAGAIN;
+    }
+
+    // Keeps every buffer reading ahead and hands blocks to sink in file order. A short
+    // read is resumed where it stopped; a read returning nothing is the end of the file.
+    bool readWithRing(IoRing& ring, int fd, char* buffers, size_t blockSize, unsigned depth, bool direct,
+                      const DataSink& sink) {
+        struct Slot {
+            uint64_t offset;
+            size_t filled;
+            bool done;
+        };
+        std::vector<Slot> slots(depth);
+        uint64_t nextOffset = 0;
+
+        auto issue = [&](unsigned index) {
+            Slot& slot = slots[index];
+            ring.push(IORING_OP_READ_FIXED, fd, index, buffers + index * blockSize + slot.filled,
+                      blockSize - slot.filled, slot.offset + slot.filled, index);
+        };
+        auto start = [&](unsigned index) {
+            slots[index] = Slot{nextOffset, 0, false};
+            nextOffset += blockSize;
+            issue(index);
+        };
+
+        for (unsigned i = 0; i < depth; i++) {
+            start(i);
+        }
+        if (!ring.submit()) {
+            return false;
+        }
+
+        for (unsigned next = 0;; next = (next + 1) % depth) {
+            while (!slots[next].done) {
+                Completion completion;
+                if (!ring.wait(completion)) {
+                    return false;
+                }
+                unsigned index = static_cast<unsigned>(completion.tag);
+                Slot& slot = slots[index];
+                if (retryable(completion.result)) {
+                    issue(index);
+                } else if (completion.result < 0) {
+                    return false;
+                } else {
+                    slot.filled += static_cast<size_t>(completion.result);
+                    slot.done = slot.filled == blockSize || endOfFile(completion.result, slot.filled, direct);
+                    if (!slot.done) {
+                        issue(index);
+                    }
+                }
+                if (!ring.submit()) {
+                    return false;
+                }
+            }
+
+            const Slot& slot = slots[next];
+            if (slot.filled > 0 && !sink(buffers + next * blockSize, slot.filled)) {
+                return false;
+            }
+            if (slot.filled < blockSize) {
+                return true;
+            }
+            start(next);
+            if (!ring.submit()) {
+                return false;
+            }
+        }
+    }
+#else
+    bool ioUringAvailable() {
+        return false;
+    }
+#endif
+} // namespace
+
+const char* ioBackendName() {
+    return ioUringAvailable() ? "io_uring" : "blocking";
+}
+
+void setCachePolicy(CachePolicy policy) {
+    currentPolicy = policy;
+}
+
+CachePolicy cachePolicy() {
+    return currentPolicy;
+}
+
+CachePolicy cachePolicyFromName(const std::string& name) {
+    if (name == "buffered") {
+        return CachePolicy::Buffered;
+    }
+    if (name == "dropbehind") {
+        return CachePolicy::DropBehind;
+    }
+    if (name == "direct") {
+        return CachePolicy::Direct;
+    }
+    DB_THROW(error::ConfigurationError, "Unknown I/O mode: " + name);
+}
+
+bool readBlocks(int fd, const DataSink& sink, size_t blockSize) {
+    if (!isRegularFile(fd)) {
+        return fdSource(fd, blockSize)(sink);
+    }
+
+    CachePolicy policy = cachePolicy();
+    struct stat info = {};
+    if (policy == CachePolicy::Buffered && fstat(fd, &info) == 0 && info.st_size > 0 && onLocalDisk(fd)) {
+        bool mapped = false;
+        bool read = readMapped(fd, static_cast<uint64_t>(info.st_size), sink, blockSize, mapped);
+        if (mapped) {
+            return read;
+        }
+    }
+
+    DirectMode direct(fd, policy == CachePolicy::Direct && blockSize % IO_ALIGNMENT == 0);
+
+    // Pages are dropped once sink has had them, a whole window at a time: the kernel
+    // keeps a large folio that a range covers only part of, and folios never straddle
+    // window boundaries
+    bool dropBehind = policy != CachePolicy::Buffered && !direct.active;
+    uint64_t consumed = 0;
+    uint64_t dropped = 0;
+    DataSink dropping = [&](const char* data, size_t size) {
+        bool taken = sink(data, size);
+        consumed += size;
+        uint64_t settled = consumed - consumed % DROP_BEHIND_WINDOW;
+        if (settled > dropped) {
+            dropCached(fd, dropped, settled - dropped);
+            dropped = settled;
+        }
+        return taken;
+    };
+    const DataSink& deliver = dropBehind ? dropping : sink;
+
+    bool read = false;
+#ifdef USE_IO_URING
+    std::unique_ptr<IoRing> ring;
+    AlignedBuffer buffers(ioUringAvailable() ? IO_QUEUE_DEPTH * blockSize : 0);
+    if (ioUringAvailable()) {
+        ring = IoRing::create(IO_QUEUE_DEPTH, buffers.data, blockSize);
+    }
+    if (ring) {
+        read = readWithRing(*ring, fd, buffers.data, blockSize, IO_QUEUE_DEPTH, direct.active, deliver);
+        ring.reset();
+    } else
+#endif
+    {
+        read = readBlocking(fd, deliver, blockSize, direct.active);
+    }
+    if (dropBehind) {
+        dropCached(fd, dropped, 0);  // To the end of the file
+    }
+    return read;
+}
+
+struct BlockWriter::Engine {
+    Engine(int fd, size_t blockSize, unsigned slots, off_t position)
+        : fd(fd),
+          blockSize(blockSize),
+          dropBehind(position >= 0 && cachePolicy() != CachePolicy::Buffered),
+          direct(fd, position >= 0 && cachePolicy() == CachePolicy::Direct && position % IO_ALIGNMENT == 0 &&
+                         blockSize % IO_ALIGNMENT == 0),
+          buffers(slots * blockSize) {
+        for (unsigned i = slots; i > 0; i--) {
+            idle.push_back(i - 1);
+        }
+        nextOffset = writebackFrom = droppedTo = position >= 0 ? static_cast<uint64_t>(position) : 0;
+#ifdef USE_IO_URING
+        this->slots.resize(slots);
+#endif
+    }
+
+    char* bufferOf(unsigned index) { return buffers.data + index * blockSize; }
+
+    // Starts writing the current block
+    void issue() {
+        unsigned index = static_cast<unsigned>(current);
+        current = -1;
+        if (direct.active && fill % IO_ALIGNMENT != 0) {
+            // Only the last block of the file is short, and O_DIRECT can't write it
+            drain();
+            direct.end();
+            writebackFrom = droppedTo = nextOffset;
+        }
+#ifdef USE_IO_URING
+        if (ring) {
+            slots[index] = Slot{nextOffset, fill, 0};
+            nextOffset += fill;
+            push(index);
+            failed = failed || !ring->submit();
+            releaseWritten(false);
+            return;
+        }
+#endif
+        failed = failed || !fdSink(fd)(bufferOf(index), fill);
+        nextOffset += fill;
+        idle.push_back(index);
+        releaseWritten(false);
+    }
+
+    // Buffer for the next block, waiting for a write to finish if all are busy
+    bool acquire() {
+        while (idle.empty()) {
+            if (!reap()) {
+                return false;
+            }
+        }
+        current = static_cast<int>(idle.back());
+        idle.pop_back();
+        fill = 0;
+        return true;
+    }
+
+    void drain() {
+#ifdef USE_IO_URING
+        while (ring && ring->inFlight() > 0 && reap()) {
+        }
+#endif
+    }
+
+    // Under DropBehind, starts writeback of each window once it is full and drops the
+    // window before it once that is on disk, so at most two windows of the file are
+    // dirty at a time. all starts and drops everything written so far.
+    void releaseWritten(bool all) {
+#ifdef __linux__
+        if (!dropBehind || direct.active) {
+            return;
+        }
+        while (nextOffset - writebackFrom >= DROP_BEHIND_WINDOW || (all && nextOffset > writebackFrom)) {
+            uint64_t size = std::min(DROP_BEHIND_WINDOW, nextOffset - writebackFrom);
+            sync_file_range(fd, static_cast<off_t>(writebackFrom), static_cast<off_t>(size), SYNC_FILE_RANGE_WRITE);
+            writebackFrom += size;
+        }
+        uint64_t settled = writebackFrom;
+        if (!all) {
+            // One window behind, and on a window boundary so no large folio is cut in two
+            settled -= std::min(settled, DROP_BEHIND_WINDOW);
+            settled -= settled % DROP_BEHIND_WINDOW;
+        }
+        if (settled > droppedTo) {
+            sync_file_range(fd, static_cast<off_t>(droppedTo), static_cast<off_t>(settled - droppedTo),
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            dropCached(fd, droppedTo, settled - droppedTo);
+            droppedTo = settled;
+        }
+#else
+        (void)all;
+#endif
+    }
+
+#ifdef USE_IO_URING
+    struct Slot {
+        uint64_t offset;
+        size_t size;
+        size_t written;
+    };
+
+    void push(unsigned index) {
+        const Slot& slot = slots[index];
+        ring->push(IORING_OP_WRITE_FIXED, fd, index, bufferOf(index) + slot.written, slot.size - slot.written,
+                   slot.offset + slot.written, index);
+    }
+
+    // Handles one finished write; false if the ring itself failed
+    bool reap() {
+        Completion completion;
+        if (!ring || !ring->wait(completion)) {
+            failed = true;
+            return false;
+        }
+        unsigned index = static_cast<unsigned>(completion.tag);
+        Slot& slot = slots[index];
+        if (completion.result > 0) {
+            slot.written += static_cast<size_t>(completion.result);
+        } else if (!retryable(completion.result)) {
+            failed = true;
+            idle.push_back(index);
+            return true;
+        }
+        if (slot.written < slot.size) {
+            push(index);
+            failed = failed || !ring->submit();
+        } else {
+            idle.push_back(index);
+        }
+        return true;
+    }
+
+    std::vector<Slot> slots;
+#else
+    bool reap() {
+        failed = true;
+        return false;
+    }
+#endif
+
+    int fd;
+    size_t blockSize;
+    bool dropBehind;
+    DirectMode direct;
+    AlignedBuffer buffers;
+#ifdef USE_IO_URING
+    std::unique_ptr<IoRing> ring;  // Declared after buffers and direct, so it drains first
+#endif
+    std::vector<unsigned> idle;
+    int current = -1;  // Buffer being filled, or -1
+    size_t fill = 0;
+    uint64_t nextOffset;     // File offset of the next block
+    uint64_t writebackFrom;  // Start of the written bytes writeback hasn't been started for
+    uint64_t droppedTo;      // End of the bytes already dropped from the cache
+    bool failed = false;
+};
+
+BlockWriter::BlockWriter(int fd, size_t blockSize) {
+    off_t position = isRegularFile(fd) ? lseek(fd, 0, SEEK_CUR) : -1;
+#ifdef USE_IO_URING
+    if (position >= 0 && ioUringAvailable()) {
+        engine = std::make_unique<Engine>(fd, blockSize, IO_QUEUE_DEPTH, position);
+        engine->ring = IoRing::create(IO_QUEUE_DEPTH, engine->buffers.data, blockSize);
+        return;
+    }
+#endif
+    engine = std::make_unique<Engine>(fd, blockSize, 1, position);
+}
+
+BlockWriter::~BlockWriter() = default;
+
+bool BlockWriter::write(const char* data, size_t size) {
+    while (size > 0 && !engine->failed) {
+        if (engine->current < 0 && !engine->acquire()) {
+            break;
+        }
+        size_t take = std::min(size, engine->blockSize - engine->fill);
+        std::memcpy(engine->bufferOf(static_cast<unsigned>(engine->current)) + engine->fill, data, take);
+        engine->fill += take;
+        data += take;
+        size -= take;
+        if (engine->fill == engine->blockSize) {
+            engine->issue();
+        }
+    }
+    return !engine->failed;
+}
+
+bool BlockWriter::flush() {
+    if (engine->current >= 0 && engine->fill > 0) {
+        engine->issue();
+    } else if (engine->current >= 0) {
+        engine->idle.push_back(static_cast<unsigned>(engine->current));
+        engine->current = -1;
+    }
+    engine->drain();
+    engine->direct.end();
+    engine->releaseWritten(true);
+#ifdef USE_IO_URING
+    if (engine->ring && !engine->failed &&
+        lseek(engine->fd, static_cast<off_t>(engine->nextOffset), SEEK_SET) < 0) {
+        engine->failed = true;
+    }
+#endif
+    return !engine->failed;
+}
+
+} // namespace dbbackup
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "../include/compression.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace dbbackup {
+
+/// Bytes moved per read or write request
+constexpr size_t IO_BLOCK_SIZE = 1024 * 1024;
+
+/// Requests kept in flight per file
+constexpr unsigned IO_QUEUE_DEPTH = 4;
+
+/// Address space a mapped read holds at a time; larger files slide the window along
+constexpr uint64_t MAP_WINDOW_SIZE = 256 * 1024 * 1024;
+
+/// Name of the engine file reads and writes go through: "io_uring" where the kernel
+/// allows it (built with USE_IO_URING), otherwise "blocking"
+const char* ioBackendName();
+
+/// What backup file I/O leaves in the page cache. When hegemon runs on the database
+/// host, a multi-GB backup read and written through the cache evicts the database's
+/// hot pages.
+enum class CachePolicy {
+    Buffered,    // Leave caching to the kernel
+    DropBehind,  // Drop pages once read, and once written back (started every few MB)
+    Direct,      // O_DIRECT with aligned buffers where the filesystem allows, else DropBehind
+};
+
+/// Policy for every readBlocks and BlockWriter in the process (Linux only; elsewhere
+/// everything is Buffered)
+void setCachePolicy(CachePolicy policy);
+CachePolicy cachePolicy();
+
+/// "buffered", "dropbehind" or "direct" (backup.ioMode); throws ConfigurationError otherwise
+CachePolicy cachePolicyFromName(const std::string& name);
+
+/// Reads fd from the start into sink in blockSize pieces. A regular file on a local
+/// filesystem is mapped (MADV_SEQUENTIAL, huge-page-aligned windows of MAP_WINDOW_SIZE)
+/// and sink gets pointers into the page cache, unless cachePolicy() keeps I/O out of
+/// the cache. Otherwise, with io_uring, the next IO_QUEUE_DEPTH - 1 blocks are already
+/// being read into registered buffers while sink handles one, or each block is a
+/// blocking read. Pipes and other unseekable files are read from their current position
+/// with plain read(). A mapped file must not shrink while it is read. Returns false if
+/// a read fails or sink returns false; fd stays open.
+bool readBlocks(int fd, const DataSink& sink, size_t blockSize = IO_BLOCK_SIZE);
+
+/// Collects small writes into blocks and writes them to fd at its current position,
+/// with up to IO_QUEUE_DEPTH blocks in flight on io_uring. flush() must succeed before
+/// the file can be trusted; fd stays owned by the caller. Regular files follow
+/// cachePolicy(); O_DIRECT needs fd to start at a block-aligned position, and the
+/// unaligned tail of the file goes through the cache and is dropped after.
+class BlockWriter {
+public:
+    explicit BlockWriter(int fd, size_t blockSize = IO_BLOCK_SIZE);
+
+    /// Waits for writes still in flight
+    ~BlockWriter();
+
+    BlockWriter(const BlockWriter&) = delete;
+    BlockWriter& operator=(const BlockWriter&) = delete;
+
+    /// Returns false once any write has failed
+    bool write(const char* data, size_t size);
+
+    /// Writes what is buffered, waits for every write and leaves fd positioned after
+    /// the data. Returns false if any write failed.
+    bool flush();
+
+private:
+    struct Engine;
+    std::unique_ptr<Engine> engine;
+};
+
+} // namespace dbbackup
@@ -2,6 +2,11 @@
 #include "config.hpp"
 #include "backup_manager.hpp"
 #include "restore_manager.hpp"
+#include "dictionary_store.hpp"
+#include "compression_bench.hpp"
+#include "recompress.hpp"
+#include "storage.hpp"
+#include "io_engine.hpp"
 #include "error/ErrorUtils.hpp"
 #include <iostream>
 #include <memory>
@@ -9,6 +14,8 @@
 #include <iomanip>
 #include <ctime>
 #include <fstream>
+#include <thread>
+#include <nlohmann/json.hpp>
 
 using namespace dbbackup::error;
 
@@ -122,34 +129,40 @@ bool verifyBackup(const std::string& backupPath, const dbbackup::Config& config)
     }
     std::cout << "File size: " << formatSize(size) << "\n";
 
-    // Check if it's a gzip file
-    bool isGzip = false;
+    // Identify the codec from the file's magic bytes
     {
         std::ifstream file(backupPath, std::ios::binary);
         if (!file) {
             std::cerr << "Error: Cannot open backup file\n";
             return false;
         }
-
-        unsigned char header[2];
-        file.read(reinterpret_cast<char*>(header), 2);
-        isGzip = (file && header[0] == 0x1f && header[1] == 0x8b);
     }
 
-    std::cout << "Compression: " << (isGzip ? "gzip" : "none") << "\n";
+    std::string format = dbbackup::Compressor::detectFormat(backupPath);
+    bool isCompressed = !format.empty();
+    std::cout << "Compression: " << (isCompressed ? format : "none") << "\n";
 
-    // For gzipped files, try to decompress to verify integrity
-    if (isGzip) {
-        std::cout << "Verifying gzip integrity...\n";
+    // For compressed files, try to decompress to verify integrity
+    if (isCompressed) {
+        std::cout << "Verifying " << format << " integrity...\n";
+        dbbackup::CompressionConfig readConfig = config.backup.compression;
+        readConfig.format = format;
         std::unique_ptr<dbbackup::Compressor> compressor = 
-            std::make_unique<dbbackup::Compressor>(config.backup.compression);
+            std::make_unique<dbbackup::Compressor>(readConfig);
         
-        std::string tempPath = backupPath + ".verify";
-        bool decompressSuccess = compressor->decompressFile(backupPath, tempPath);
+        bool decompressSuccess = false;
+        if (isDeltaBackup(backupPath)) {
+            // A delta only decodes against the backups before it
+            std::cout << "Delta backup; rebuilding its chain\n";
+            decompressSuccess = streamBackupChain(backupPath, readConfig, [](const char*, size_t) { return true; });
+        } else {
+            std::string tempPath = backupPath + ".verify";
+            decompressSuccess = compressor->decompressFile(backupPath, tempPath);
+            std::filesystem::remove(tempPath);
+        }
         
         if (decompressSuccess) {
             std::cout << "Decompression successful\n";
-            std::filesystem::remove(tempPath);
         } else {
             std::cerr << "Error: Failed to decompress file\n";
             return false;
@@ -183,14 +196,163 @@ bool verifyBackup(const std::string& backupPath, const dbbackup::Config& config)
     return true;
 }
 
+// Helper function to train a zstd dictionary from the most recent backups
+bool trainDictionary(const dbbackup::Config& config) {
+    const std::string& backupDir = config.storage.localPath;
+    if (!std::filesystem::exists(backupDir)) {
+        std::cerr << "Error: Backup directory does not exist\n";
+        return false;
+    }
+
+    std::vector<std::filesystem::directory_entry> backups;
+    for (const auto& entry : std::filesystem::directory_iterator(backupDir)) {
+        if (entry.is_regular_file() && startsWith(entry.path().filename().string(), "backup_")) {
+            backups.push_back(entry);
+        }
+    }
+
+    // Newest first, so training favours what current backups look like
+    std::sort(backups.begin(), backups.end(),
+              [](const auto& a, const auto& b) {
+                  return a.last_write_time() > b.last_write_time();
+              });
+
+    std::vector<std::string> paths;
+    for (const auto& backup : backups) {
+        paths.push_back(backup.path().string());
+    }
+    if (paths.empty()) {
+        std::cerr << "Error: No backups to train on\n";
+        return false;
+    }
+
+    dbbackup::DictionaryStore store(config.backup.compression.dictionaryDir);
+    uint32_t id = store.trainFromBackups(paths, config.backup.compression);
+    std::cout << "Trained dictionary " << id << " from " << paths.size() << " backups: "
+              << store.pathFor(id) << "\n";
+    if (!config.backup.compression.dictionary) {
+        std::cout << "Set \"dictionary\": true in the compression config to use it\n";
+    }
+    return true;
+}
+
+// Helper function to benchmark every codec on a backup or sample file
+bool benchCompression(const CLIOptions& options, const dbbackup::Config& config) {
+    std::vector<int> threadCounts = options.benchThreads;
+    if (threadCounts.empty()) {
+        threadCounts.push_back(1);
+        int cores = static_cast<int>(std::thread::hardware_concurrency());
+        if (cores > 1) {
+            threadCounts.push_back(cores);
+        }
+    }
+
+    std::vector<char> sample = dbbackup::loadBenchSample(options.restorePath, options.benchSampleMB * 1024 * 1024,
+                                                         config.backup.compression);
+    if (sample.empty()) {
+        std::cerr << "Error: Benchmark input is empty\n";
+        return false;
+    }
+    if (!options.json) {
+        std::cout << "Benchmarking on " << formatSize(sample.size()) << " of " << options.restorePath << "\n\n";
+    }
+
+    std::string scratchDir = config.storage.localPath.empty() ? std::filesystem::temp_directory_path().string()
+                                                              : config.storage.localPath;
+    std::vector<dbbackup::CodecBenchmark> results =
+        dbbackup::benchmarkCodecs(sample, config.backup.compression, threadCounts, scratchDir);
+
+    bool allPassed = true;
+    if (options.json) {
+        nlohmann::json report = nlohmann::json::array();
+        for (const auto& result : results) {
+            nlohmann::json entry = {
+                {"format", result.format},
+                {"level", result.level},
+                {"threads", result.threads},
+                {"input_bytes", result.inputBytes},
+                {"compressed_bytes", result.compressedBytes},
+                {"ratio", result.ratio},
+                {"compress_mbps", result.compressMBps},
+                {"decompress_mbps", result.decompressMBps},
+                {"peak_rss_kb", result.peakRssKB}
+            };
+            if (!result.error.empty()) {
+                entry["error"] = result.error;
+                allPassed = false;
+            }
+            report.push_back(entry);
+        }
+        std::cout << report.dump(2) << "\n";
+        return allPassed;
+    }
+
+    std::cout << std::left
+              << std::setw(14) << "Format"
+              << std::setw(8) << "Level"
+              << std::setw(9) << "Threads"
+              << std::setw(8) << "Ratio"
+              << std::setw(13) << "Comp MB/s"
+              << std::setw(13) << "Decomp MB/s"
+              << "Peak RSS\n"
+              << std::string(75, '-') << "\n";
+    for (const auto& result : results) {
+        std::cout << std::left
+                  << std::setw(14) << result.format
+                  << std::setw(8) << result.level
+                  << std::setw(9) << result.threads;
+        if (!result.error.empty()) {
+            std::cout << "failed: " << result.error << "\n";
+            allPassed = false;
+            continue;
+        }
+        std::cout << std::fixed << std::setprecision(3)
+                  << std::setw(8) << result.ratio
+                  << std::setprecision(1)
+                  << std::setw(13) << result.compressMBps
+                  << std::setw(13) << result.decompressMBps
+                  << formatSize(static_cast<uintmax_t>(result.peakRssKB) * 1024) << "\n";
+    }
+    return allPassed;
+}
+
+// Helper function to rewrite older backups with the configured (or requested) codec
+bool recompressBackups(const CLIOptions& options, const dbbackup::Config& config) {
+    if (!std::filesystem::exists(config.storage.localPath)) {
+        std::cerr << "Error: Backup directory does not exist\n";
+        return false;
+    }
+
+    dbbackup::RecompressOptions recompressOptions;
+    recompressOptions.target = config.backup.compression;
+    recompressOptions.maxMBps = options.maxRateMBps;
+    if (!recompressOptions.target.enabled) {
+        std::cerr << "Error: Compression is disabled; pass --to <format>\n";
+        return false;
+    }
+
+    // This is housekeeping; backups and the database come first
+    dbbackup::runAtIdlePriority();
+    dbbackup::RecompressStats stats =
+        dbbackup::recompressBackups(config.storage, config.backup.compression, recompressOptions);
+
+    std::cout << "Recompressed " << stats.converted << " backups to " << recompressOptions.target.format;
+    if (stats.converted > 0) {
+        std::cout << ": " << formatSize(stats.bytesBefore) << " -> " << formatSize(stats.bytesAfter);
+    }
+    std::cout << "\n" << stats.skipped << " skipped, " << stats.failed << " failed\n";
+    return stats.failed == 0;
+}
+
 int main(int argc, char* argv[]) {
     try {
         // Parse command line arguments
         CLI cli(argc, argv);
         CLIOptions options = cli.parse();
 
-        // Load configuration from file
-        dbbackup::Config config = dbbackup::Config::fromFile(options.configPath);
+        // Load configuration from file; bench works from the defaults without one
+        bool useDefaults = options.command == "bench" && !std::filesystem::exists(options.configPath);
+        dbbackup::Config config = useDefaults ? dbbackup::Config() : dbbackup::Config::fromFile(options.configPath);
 
         // Override config with command line options if provided
         if (!options.dbType.empty()) {
@@ -224,12 +386,18 @@ int main(int argc, char* argv[]) {
                 config.backup.compression.format = options.compression;
             }
         }
+        if (!options.compressionLevel.empty()) {
+            config.backup.compression.level = options.compressionLevel;
+        }
 
         // Override logging settings
         if (options.verbose) {
             config.logging.logLevel = "debug";
         }
 
+        // Applies to every backup file read and written from here on
+        dbbackup::setCachePolicy(dbbackup::cachePolicyFromName(config.backup.ioMode));
+
         // Execute the appropriate command
         if (options.command == "backup") {
             BackupManager backupMgr(config);
@@ -251,6 +419,21 @@ int main(int argc, char* argv[]) {
                 return 1;
             }
         }
+        else if (options.command == "train-dictionary") {
+            if (!trainDictionary(config)) {
+                return 1;
+            }
+        }
+        else if (options.command == "recompress") {
+            if (!recompressBackups(options, config)) {
+                return 1;
+            }
+        }
+        else if (options.command == "bench") {
+            if (!benchCompression(options, config)) {
+                return 1;
+            }
+        }
         else {
             std::cerr << "Error: No command specified. Use -h or --help for usage information.\n";
             return 1;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "codec_pipeline.hpp"
+#include "error/ErrorUtils.hpp"
+#include <cstddef>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dbbackup {
+
+/// Read-only mapping of a whole file, so a delta reference or a compressed backup the
+/// size of a dump sits in the page cache rather than on the heap, and every thread can
+/// read any part of it
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            DB_THROW(error::CompressionError, "Failed to open " + path);
+        }
+        struct stat info = {};
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            size = static_cast<size_t>(info.st_size);
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            data = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+        }
+        ::close(fd);
+        if (size > 0 && !data) {
+            DB_THROW(error::CompressionError, "Failed to map " + path);
+        }
+    }
+
+    ~MappedFile() {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ByteSpan span() const { return ByteSpan{data, size}; }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+} // namespace dbbackup
@@ -0,0 +1,694 @@
+#include "parallel_inflate.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+#include "error/ErrorUtils.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <zlib.h>
+
+using namespace dbbackup::error;
+
+namespace dbbackup {
+
+namespace {
+    constexpr size_t WINDOW_SIZE = 32768;  // Furthest a deflate back-reference reaches
+    constexpr size_t MAX_MATCH = 258;
+    constexpr uint16_t MARKER_BASE = 256;  // Values from here on stand for window bytes not yet known
+
+    constexpr uint16_t LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    constexpr uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    constexpr uint16_t DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                        8193, 12289, 16385, 24577};
+    constexpr uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    constexpr uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    // LSB-first bit reader over the mapped file. Reads past the end return zeros and
+    // leave position() beyond the data, which callers treat as truncation.
+    class BitReader {
+    public:
+        BitReader(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+        void seek(uint64_t bit) {
+            bytePos = bit / 8;
+            bitBuf = 0;
+            bitCount = 0;
+            refill();
+            skip(static_cast<unsigned>(bit % 8));
+        }
+
+        uint64_t position() const { return bytePos * 8 - bitCount; }
+
+        // Up to 32 bits
+        uint32_t peek(unsigned count) {
+            if (bitCount < count) {
+                refill();
+            }
+            return static_cast<uint32_t>(bitBuf & ((uint64_t(1) << count) - 1));
+        }
+
+        void skip(unsigned count) {
+            bitBuf >>= count;
+            bitCount -= count;
+        }
+
+        uint32_t read(unsigned count) {
+            uint32_t value = peek(count);
+            skip(count);
+            return value;
+        }
+
+    private:
+        void refill() {
+            if (bytePos + 8 <= size) {
+                uint64_t word = 0;
+                for (unsigned i = 0; i < 8; i++) {
+                    word |= uint64_t(data[bytePos + i]) << (8 * i);
+                }
+                bitBuf |= word << bitCount;
+                bytePos += (63 - bitCount) >> 3;
+                bitCount |= 56;
+                return;
+            }
+            while (bitCount <= 56) {
+                uint64_t next = bytePos < size ? data[bytePos] : 0;
+                bitBuf |= next << bitCount;
+                bytePos++;
+                bitCount += 8;
+            }
+        }
+
+        const unsigned char* data;
+        size_t size;
+        uint64_t bytePos = 0;
+        uint64_t bitBuf = 0;
+        unsigned bitCount = 0;
+    };
+
+    // Canonical Huffman code: codes up to FAST_BITS long come from one table lookup,
+    // longer ones are walked a bit at a time
+    class HuffmanCode {
+    public:
+        // False for lengths zlib would reject: over-subscribed, or incomplete with more
+        // than a single one-bit code (never allowed for the code-length code)
+        bool build(const uint8_t* lengths, size_t count, bool codeLengthCode = false) {
+            std::fill(std::begin(counts), std::end(counts), 0);
+            for (size_t i = 0; i < count; i++) {
+                counts[lengths[i]]++;
+            }
+            counts[0] = 0;
+
+            int left = 1;
+            unsigned maxLength = 0;
+            for (unsigned length = 1; length < 16; length++) {
+                left = (left << 1) - counts[length];
+                if (left < 0) {
+                    return false;
+                }
+                if (counts[length] > 0) {
+                    maxLength = length;
+                }
+            }
+            if (maxLength == 0) {
+                return !codeLengthCode;  // An empty distance code is legal; using it is not
+            }
+            if (left > 0 && (codeLengthCode || maxLength != 1)) {
+                return false;
+            }
+
+            uint16_t offsets[16];
+            offsets[1] = 0;
+            for (unsigned length = 1; length < 15; length++) {
+                offsets[length + 1] = offsets[length] + counts[length];
+            }
+            for (size_t i = 0; i < count; i++) {
+                if (lengths[i] != 0) {
+                    symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+                }
+            }
+
+            std::fill(std::begin(fast), std::end(fast), 0);
+            uint32_t code = 0;
+            size_t index = 0;
+            for (unsigned length = 1; length <= FAST_BITS; length++) {
+                for (unsigned k = 0; k < counts[length]; k++, code++) {
+                    uint32_t reversed = 0;
+                    for (unsigned bit = 0; bit < length; bit++) {
+                        reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+                    }
+                    uint16_t entry = static_cast<uint16_t>(symbols[index++] << 4 | length);
+                    for (uint32_t slot = reversed; slot < (1u << FAST_BITS); slot += 1u << length) {
+                        fast[slot] = entry;
+                    }
+                }
+                code <<= 1;
+            }
+            return true;
+        }
+
+        // Next symbol, or -1 for a bit pattern the code doesn't use
+        int decode(BitReader& in) const {
+            uint32_t bits = in.peek(15);
+            uint16_t entry = fast[bits & ((1u << FAST_BITS) - 1)];
+            if (entry != 0) {
+                in.skip(entry & 15);
+                return entry >> 4;
+            }
+            int code = 0;
+            int first = 0;
+            int index = 0;
+            for (unsigned length = 1; length < 16; length++) {
+                code |= (bits >> (length - 1)) & 1;
+                int count = counts[length];
+                if (code - first < count) {
+                    in.skip(length);
+                    return symbols[index + code - first];
+                }
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+            return -1;
+        }
+
+    private:
+        static constexpr unsigned FAST_BITS = 10;
+        uint16_t fast[1u << FAST_BITS] = {};  // symbol << 4 | length, 0 = longer code
+        uint16_t counts[16] = {};
+        uint16_t symbols[288] = {};
+    };
+
+    struct FixedCodes {
+        HuffmanCode literals;
+        HuffmanCode distances;
+
+        FixedCodes() {
+            uint8_t lengths[288];
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            literals.build(lengths, 288);
+            std::fill(lengths, lengths + 32, 5);
+            distances.build(lengths, 32);
+        }
+    };
+
+    const FixedCodes& fixedCodes() {
+        static const FixedCodes codes;
+        return codes;
+    }
+
+    // Reads a dynamic block's code tables; false if they aren't valid
+    bool readDynamicCodes(BitReader& in, HuffmanCode& literals, HuffmanCode& distances) {
+        unsigned literalCount = in.read(5) + 257;
+        unsigned distanceCount = in.read(5) + 1;
+        unsigned codeLengthCount = in.read(4) + 4;
+        if (literalCount > 286 || distanceCount > 30) {
+            return false;
+        }
+
+        uint8_t lengths[286 + 30] = {};
+        for (unsigned i = 0; i < codeLengthCount; i++) {
+            lengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(in.read(3));
+        }
+        HuffmanCode codeLengths;
+        if (!codeLengths.build(lengths, 19, true)) {
+            return false;
+        }
+
+        std::fill(std::begin(lengths), std::end(lengths), 0);
+        unsigned total = literalCount + distanceCount;
+        for (unsigned i = 0; i < total;) {
+            int symbol = codeLengths.decode(in);
+            if (symbol < 0) {
+                return false;
+            }
+            if (symbol < 16) {
+                lengths[i++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+            uint8_t value = 0;
+            unsigned repeat;
+            if (symbol == 16) {
+                if (i == 0) {
+                    return false;
+                }
+                value = lengths[i - 1];
+                repeat = 3 + in.read(2);
+            } else if (symbol == 17) {
+                repeat = 3 + in.read(3);
+            } else {
+                repeat = 11 + in.read(7);
+            }
+            if (i + repeat > total) {
+                return false;
+            }
+            std::fill(lengths + i, lengths + i + repeat, value);
+            i += repeat;
+        }
+
+        return lengths[256] != 0 && literals.build(lengths, literalCount) &&
+               distances.build(lengths + literalCount, distanceCount);
+    }
+
+    struct DecodedChunk {
+        bool found = false;
+        bool final = false;          // Ends with the member's last block
+        uint32_t firstHeader = 0;    // BFINAL and BTYPE of the first block
+        uint64_t startBit = 0;
+        uint64_t endBit = 0;
+        std::vector<uint16_t> marked;  // Leading output, which may reference the unknown window
+        size_t markedBegin = 0;
+        std::vector<char> clean;       // The rest, after 32 KiB in a row came out fully known
+        size_t cleanBegin = 0;
+        uLong cleanCrc = 0;
+    };
+
+    // Inflates a run of blocks. Without a window, output goes into 16-bit symbols where a
+    // copy from before the chunk is a marker for that window position; once a full window
+    // of plain bytes has come out, nothing later can reach a marker and output drops to bytes.
+    class ChunkDecoder {
+    public:
+        ChunkDecoder(const unsigned char* data, size_t size, size_t maxOutput)
+            : in(data, size), data(data), size(size), maxOutput(maxOutput) {}
+
+        // Decodes from startBit until a block ends at or past stopBit, the final block, or
+        // the block that takes the output to maxOutput bytes (endBit is then short of
+        // stopBit). window holds the bytes before startBit, or is nullptr if they aren't
+        // known yet. False if the data isn't a valid run of blocks from there.
+        bool decode(uint64_t startBit, uint64_t stopBit, const std::vector<char>* window, DecodedChunk& chunk) {
+            in.seek(startBit);
+            markedPos = 0;
+            cleanPos = 0;
+            lastMarker = 0;
+            if (window) {
+                clean.assign(window->begin(), window->end());
+                cleanPos = cleanBegin = clean.size();
+                markedBegin = 0;
+                inClean = true;
+            } else {
+                marked.resize(WINDOW_SIZE);
+                for (size_t i = 0; i < WINDOW_SIZE; i++) {
+                    marked[i] = static_cast<uint16_t>(MARKER_BASE + i);
+                }
+                markedPos = markedBegin = lastMarker = WINDOW_SIZE;
+                cleanBegin = 0;
+                inClean = false;
+            }
+
+            bool final = false;
+            uint32_t firstHeader = in.peek(3);
+            while (!final && in.position() < stopBit &&
+                   (markedPos - markedBegin) + (cleanPos - cleanBegin) < maxOutput) {
+                if (!decodeBlock(final) || in.position() > uint64_t(size) * 8) {
+                    return false;
+                }
+                if (!inClean && markedPos - lastMarker >= WINDOW_SIZE) {
+                    clean.assign(marked.begin() + (markedPos - WINDOW_SIZE), marked.begin() + markedPos);
+                    cleanPos = cleanBegin = WINDOW_SIZE;
+                    inClean = true;
+                }
+            }
+
+            marked.resize(markedPos);
+            clean.resize(cleanPos);
+            chunk.found = true;
+            chunk.final = final;
+            chunk.firstHeader = firstHeader;
+            chunk.startBit = startBit;
+            chunk.endBit = in.position();
+            chunk.cleanCrc = crc32(0L, reinterpret_cast<const Bytef*>(clean.data() + cleanBegin),
+                                   static_cast<uInt>(cleanPos - cleanBegin));
+            chunk.marked = std::move(marked);
+            chunk.markedBegin = markedBegin;
+            chunk.clean = std::move(clean);
+            chunk.cleanBegin = cleanBegin;
+            return true;
+        }
+
+    private:
+        bool decodeBlock(bool& final) {
+            uint32_t header = in.read(3);
+            final = header & 1;
+            switch (header >> 1) {
+                case 0:
+                    return copyStored();
+                case 1:
+                    return decodeSymbols(fixedCodes().literals, fixedCodes().distances);
+                case 2:
+                    return readDynamicCodes(in, literals, distances) && decodeSymbols(literals, distances);
+                default:
+                    return false;
+            }
+        }
+
+        bool copyStored() {
+            in.seek((in.position() + 7) & ~uint64_t(7));
+            uint32_t length = in.read(16);
+            if (length != (~in.read(16) & 0xffff)) {
+                return false;
+            }
+            uint64_t from = in.position() / 8;
+            if (from + length > size) {
+                return false;
+            }
+            if (inClean) {
+                clean.resize(std::max(clean.size(), cleanPos + length));
+                std::memcpy(clean.data() + cleanPos, data + from, length);
+                cleanPos += length;
+            } else {
+                marked.resize(std::max(marked.size(), markedPos + length));
+                std::copy(data + from, data + from + length, marked.begin() + markedPos);
+                markedPos += length;
+            }
+            in.seek((from + length) * 8);
+            return true;
+        }
+
+        bool decodeSymbols(const HuffmanCode& literalCode, const HuffmanCode& distanceCode) {
+            return inClean ? decodeSymbols(literalCode, distanceCode, clean, cleanPos)
+                           : decodeSymbols(literalCode, distanceCode, marked, markedPos);
+        }
+
+        template <typename T>
+        bool decodeSymbols(const HuffmanCode& literalCode, const HuffmanCode& distanceCode,
+                           std::vector<T>& out, size_t& pos) {
+            const uint64_t endBit = uint64_t(size) * 8;
+            for (;;) {
+                if (out.size() < pos + MAX_MATCH) {
+                    out.resize(std::max(out.size() * 2, pos + MAX_MATCH + WINDOW_SIZE));
+                }
+                int symbol = literalCode.decode(in);
+                if (symbol < 256) {
+                    if (symbol < 0) {
+                        return false;
+                    }
+                    out[pos++] = static_cast<T>(symbol);
+                } else if (symbol == 256) {
+                    return true;
+                } else {
+                    symbol -= 257;
+                    if (symbol >= 29) {
+                        return false;
+                    }
+                    size_t length = LENGTH_BASE[symbol] + in.read(LENGTH_EXTRA[symbol]);
+                    int code = distanceCode.decode(in);
+                    if (code < 0 || code >= 30) {
+                        return false;
+                    }
+                    size_t distance = DIST_BASE[code] + in.read(DIST_EXTRA[code]);
+                    if (distance > pos) {
+                        return false;
+                    }
+                    T* to = out.data() + pos;
+                    const T* from = to - distance;
+                    for (size_t k = 0; k < length; k++) {
+                        to[k] = from[k];
+                    }
+                    if constexpr (std::is_same_v<T, uint16_t>) {
+                        for (size_t k = length; k-- > 0;) {
+                            if (to[k] >= MARKER_BASE) {
+                                lastMarker = pos + k + 1;
+                                break;
+                            }
+                        }
+                    }
+                    pos += length;
+                }
+                if (in.position() > endBit) {
+                    return false;
+                }
+            }
+        }
+
+        BitReader in;
+        const unsigned char* data;
+        size_t size;
+        size_t maxOutput;
+        HuffmanCode literals;
+        HuffmanCode distances;
+        std::vector<uint16_t> marked;
+        size_t markedPos = 0;
+        size_t markedBegin = 0;
+        size_t lastMarker = 0;  // Just past the last marker written
+        std::vector<char> clean;
+        size_t cleanPos = 0;
+        size_t cleanBegin = 0;
+        bool inClean = false;
+    };
+
+    // Cheap test that a dynamic or stored block header could start at bit. Fixed-code
+    // blocks match almost anywhere, so they are left for the sequential fallback, and so
+    // are final blocks: one would end the trial decode before it proved anything.
+    bool plausibleBlockStart(BitReader& probe, uint64_t bit, HuffmanCode& literals, HuffmanCode& distances) {
+        probe.seek(bit);
+        uint32_t header = probe.read(3);
+        if (header & 1) {
+            return false;
+        }
+        switch (header >> 1) {
+            case 0: {
+                probe.seek((probe.position() + 7) & ~uint64_t(7));
+                uint32_t length = probe.read(16);
+                return length == (~probe.read(16) & 0xffff);
+            }
+            case 2:
+                return readDynamicCodes(probe, literals, distances);
+            default:
+                return false;
+        }
+    }
+
+    // Finds the first offset in [fromBit, stopBit) that decodes cleanly up to stopBit
+    DecodedChunk findAndDecode(const unsigned char* data, size_t size, uint64_t fromBit, uint64_t stopBit,
+                               size_t maxOutput) {
+        ChunkDecoder decoder(data, size, maxOutput);
+        BitReader probe(data, size);
+        HuffmanCode literals;
+        HuffmanCode distances;
+        DecodedChunk chunk;
+        for (uint64_t bit = fromBit; bit < stopBit; bit++) {
+            if (plausibleBlockStart(probe, bit, literals, distances) && decoder.decode(bit, stopBit, nullptr, chunk)) {
+                break;
+            }
+        }
+        return chunk;
+    }
+
+    // An empty stored block (a sync flush) parses from any of the zero bits before its
+    // header in the same byte, so a chunk found there decodes exactly as one starting at bit
+    bool sameStoredBlock(const unsigned char* data, size_t size, uint64_t bit, const DecodedChunk& chunk) {
+        BitReader reader(data, size);
+        reader.seek(bit);
+        auto aligned = [](uint64_t header) { return (header + 3 + 7) & ~uint64_t(7); };
+        return (chunk.firstHeader >> 1) == 0 && reader.read(3) == chunk.firstHeader &&
+               aligned(bit) == aligned(chunk.startBit);
+    }
+
+    uint64_t gzipHeaderEnd(const unsigned char* data, size_t size, uint64_t offset) {
+        const unsigned char FHCRC = 2;
+        const unsigned char FEXTRA = 4;
+        const unsigned char FNAME = 8;
+        const unsigned char FCOMMENT = 16;
+
+        DB_CHECK(offset + 10 <= size && data[offset] == 0x1f && data[offset + 1] == 0x8b &&
+                 data[offset + 2] == 8 && (data[offset + 3] & 0xe0) == 0,
+                 CompressionError, "Decompression error");
+        unsigned char flags = data[offset + 3];
+        uint64_t pos = offset + 10;
+        if ((flags & FEXTRA) && pos + 2 <= size) {
+            pos += 2 + (data[pos] | (data[pos + 1] << 8));
+        }
+        for (unsigned char field : {FNAME, FCOMMENT}) {
+            if (flags & field) {
+                while (pos < size && data[pos] != 0) {
+                    pos++;
+                }
+                pos++;
+            }
+        }
+        if (flags & FHCRC) {
+            pos += 2;
+        }
+        DB_CHECK(pos <= size, CompressionError, "Incomplete or corrupted compressed data");
+        return pos;
+    }
+
+    uint32_t readLE32(const unsigned char* in) {
+        return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+    }
+
+    // Replaces the placeholders in marked[0, count) with the window bytes they stand for
+    void resolveMarkers(const uint16_t* marked, size_t count, const std::vector<char>& window, char* out) {
+        for (size_t i = 0; i < count; i++) {
+            uint16_t value = marked[i];
+            if (value < MARKER_BASE) {
+                out[i] = static_cast<char>(value);
+                continue;
+            }
+            size_t back = WINDOW_SIZE - (value - MARKER_BASE);
+            DB_CHECK(back <= window.size(), CompressionError, "Decompression error");
+            out[i] = window[window.size() - back];
+        }
+    }
+
+    struct ResolvedChunk {
+        std::vector<char> head;               // The placeholder part, filled in
+        std::shared_ptr<DecodedChunk> chunk;  // Holds the plain part
+        uLong crc;
+    };
+
+    // Inflates the member at offset into sink; returns the offset just past its trailer
+    uint64_t inflateMember(const unsigned char* data, size_t size, uint64_t offset, size_t chunkSize,
+                           ThreadPool& pool, const DataSink& sink) {
+        const uint64_t start = gzipHeaderEnd(data, size, offset);
+        const size_t maxOutput = chunkSize * PARALLEL_INFLATE_EXPANSION;
+        auto chunkStart = [&](uint64_t index) {
+            return std::min<uint64_t>(start + index * chunkSize, size) * 8;
+        };
+
+        // Decoding runs ahead on the pool; only the seams between chunks are checked
+        // here, and filling in placeholders goes back to the pool
+        std::deque<std::future<DecodedChunk>> decoding;
+        std::deque<std::future<ResolvedChunk>> resolving;
+        uint64_t submitted = 0;
+        auto decodeNext = [&]() {
+            uint64_t from = chunkStart(submitted);
+            uint64_t stop = chunkStart(submitted + 1);
+            if (submitted == 0) {
+                // The member's first chunk starts on a block with nothing before it
+                decoding.push_back(pool.submit([data, size, from, stop, maxOutput]() {
+                    DecodedChunk chunk;
+                    std::vector<char> nothing;
+                    ChunkDecoder(data, size, maxOutput).decode(from, stop, &nothing, chunk);
+                    return chunk;
+                }));
+            } else {
+                decoding.push_back(pool.submit([data, size, from, stop, maxOutput]() {
+                    return findAndDecode(data, size, from, stop, maxOutput);
+                }));
+            }
+            submitted++;
+        };
+
+        uLong crc = crc32(0L, Z_NULL, 0);
+        uint64_t total = 0;
+        auto writeNext = [&]() {
+            ResolvedChunk resolved = resolving.front().get();
+            resolving.pop_front();
+            const DecodedChunk& chunk = *resolved.chunk;
+            size_t cleanSize = chunk.clean.size() - chunk.cleanBegin;
+            for (const auto& part : {ByteSpan{resolved.head.data(), resolved.head.size()},
+                                     ByteSpan{chunk.clean.data() + chunk.cleanBegin, cleanSize}}) {
+                if (part.size > 0 && !sink(part.data, part.size)) {
+                    DB_THROW(CompressionError, "Failed to write decompressed data");
+                }
+            }
+            crc = crc32_combine(crc, resolved.crc, static_cast<z_off_t>(resolved.head.size() + cleanSize));
+            total += resolved.head.size() + cleanSize;
+        };
+
+        std::vector<char> window;
+        auto remember = [&window](const char* bytes, size_t count) {
+            window.insert(window.end(), bytes + count - std::min(count, WINDOW_SIZE), bytes + count);
+            if (window.size() > WINDOW_SIZE) {
+                window.erase(window.begin(), window.end() - WINDOW_SIZE);
+            }
+        };
+
+        // Every chunk stops at maxOutput, so what is queued and in flight stays within
+        // about 4 * pool.size() * maxOutput however far the data expands. The rest of a
+        // chunk that stopped short is decoded here, where its start and window are known.
+        uint64_t position = start * 8;  // Where the next chunk has to begin
+        uint64_t index = 0;
+        bool rest = false;  // Decoding the rest of chunk index
+        bool final = false;
+        while (!final) {
+            while (decoding.size() < pool.size() * 2 && chunkStart(submitted) < uint64_t(size) * 8) {
+                decodeNext();
+            }
+            auto chunk = std::make_shared<DecodedChunk>();
+            if (!rest && !decoding.empty()) {
+                *chunk = decoding.front().get();
+                decoding.pop_front();
+            }
+            bool aligned = chunk->found &&
+                           (chunk->startBit == position || sameStoredBlock(data, size, position, *chunk));
+            if (!aligned) {
+                // No boundary found or a wrong guess: decode from where the last chunk ended
+                *chunk = DecodedChunk();
+                DB_CHECK(ChunkDecoder(data, size, maxOutput).decode(position, chunkStart(index + 1), &window, *chunk),
+                         CompressionError, "Decompression error");
+            }
+            position = chunk->endBit;
+            final = chunk->final;
+            rest = !final && position < chunkStart(index + 1);
+            if (!rest) {
+                index++;
+            }
+
+            // The chunk's last 32 KiB, filled in now, are the next chunk's window
+            auto before = std::make_shared<const std::vector<char>>(window);
+            size_t markedSize = chunk->marked.size() - chunk->markedBegin;
+            size_t cleanSize = chunk->clean.size() - chunk->cleanBegin;
+            size_t tailSize = std::min(markedSize, WINDOW_SIZE - std::min(cleanSize, WINDOW_SIZE));
+            std::vector<char> tail(tailSize);
+            resolveMarkers(chunk->marked.data() + chunk->marked.size() - tailSize, tailSize, window, tail.data());
+            remember(tail.data(), tail.size());
+            remember(chunk->clean.data() + chunk->cleanBegin, cleanSize);
+
+            resolving.push_back(pool.submit([chunk, before, markedSize]() {
+                ResolvedChunk resolved;
+                resolved.head.resize(markedSize);
+                resolveMarkers(chunk->marked.data() + chunk->markedBegin, markedSize, *before, resolved.head.data());
+                resolved.crc = crc32(0L, reinterpret_cast<const Bytef*>(resolved.head.data()),
+                                     static_cast<uInt>(markedSize));
+                resolved.crc = crc32_combine(resolved.crc, chunk->cleanCrc,
+                                             static_cast<z_off_t>(chunk->clean.size() - chunk->cleanBegin));
+                chunk->marked = std::vector<uint16_t>();
+                resolved.chunk = chunk;
+                return resolved;
+            }));
+            while (resolving.size() > pool.size() * 2) {
+                writeNext();
+            }
+        }
+        while (!resolving.empty()) {
+            writeNext();
+        }
+
+        uint64_t trailer = (position + 7) / 8;
+        DB_CHECK(trailer + 8 <= size, CompressionError, "Incomplete or corrupted compressed data");
+        DB_CHECK(readLE32(data + trailer) == static_cast<uint32_t>(crc) &&
+                 readLE32(data + trailer + 4) == static_cast<uint32_t>(total),
+                 CompressionError, "Decompression error");
+        return trailer + 8;
+    }
+}
+
+bool inflateGzipParallel(const std::string& path, size_t threads, const DataSink& sink, size_t chunkSize) {
+    MappedFile file(path);
+    ByteSpan span = file.span();
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(span.data);
+
+    // Declared after the mapping, so jobs still running when a member ends early are
+    // done with it before it goes
+    ThreadPool pool(threads);
+    uint64_t offset = 0;
+    do {
+        offset = inflateMember(data, span.size, offset, chunkSize, pool, sink);
+    } while (offset < span.size);
+    return true;
+}
+
+} // namespace dbbackup
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "../include/compression.hpp"
+#include <cstddef>
+#include <string>
+
+namespace dbbackup {
+
+/// Compressed bytes each job searches for a block boundary and then decodes
+constexpr size_t PARALLEL_INFLATE_CHUNK = 1024 * 1024;
+
+/// Output a job produces, as a multiple of the chunk size, before it ends its chunk at
+/// the next block boundary. Deflate expands up to about 1000:1, so this is what bounds
+/// the memory decoded chunks take while they wait to be written.
+constexpr size_t PARALLEL_INFLATE_EXPANSION = 16;
+
+/// Decompresses ordinary gzip (one or more members, written by anything) on several threads.
+///
+/// Deflate has no block index, so the file is cut into chunks and each job looks for
+/// the first offset in its chunk where a dynamic or stored block header parses and
+/// decodes cleanly up to the next chunk. The 32 KiB of history a chunk starts with is
+/// unknown while it decodes, so back-references into it are kept as placeholders and
+/// filled in once the chunk before has been decoded. A chunk whose guessed start
+/// doesn't line up with where the previous one ended is decoded again from there, so
+/// a wrong guess only costs time. A chunk that reaches PARALLEL_INFLATE_EXPANSION times
+/// its size in output is finished in order, from where it stopped. The CRC and length
+/// in each trailer are checked.
+/// Throws CompressionError on corrupt data.
+bool inflateGzipParallel(const std::string& path, size_t threads, const DataSink& sink,
+                         size_t chunkSize = PARALLEL_INFLATE_CHUNK);
+
+} // namespace dbbackup
@@ -0,0 +1,262 @@
+#include "recompress.hpp"
+#include "storage.hpp"
+#include "checksum.hpp"
+#include "logging.hpp"
+#include "../include/compression.hpp"
+#include "error/ErrorUtils.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using namespace dbbackup::error;
+
+namespace dbbackup {
+
+namespace {
+    const std::string JOURNAL_NAME = "recompress.journal";  // In the metadata directory
+    const std::string TEMP_PREFIX = ".tmp_recompress_";
+
+    // Sleeps as needed to hold the average rate since the start of the run under the cap
+    class Throttle {
+    public:
+        explicit Throttle(double maxMBps)
+            : bytesPerSecond(maxMBps * 1e6), start(std::chrono::steady_clock::now()) {}
+
+        void consume(size_t bytes) {
+            if (bytesPerSecond <= 0) {
+                return;
+            }
+            total += bytes;
+            std::chrono::duration<double> due(total / bytesPerSecond);
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(due));
+        }
+
+    private:
+        double bytesPerSecond;
+        std::chrono::steady_clock::time_point start;
+        uint64_t total = 0;
+    };
+
+    std::string digestOf(const std::string& path, const CompressionConfig& readConfig, Throttle& throttle) {
+        Sha256 digest;
+        bool decoded = decodeBackup(path, "", readConfig,
+                                    [&](const char* data, size_t size) {
+            throttle.consume(size);
+            digest.update(data, size);
+            return true;
+        });
+        if (!decoded) {
+            DB_THROW(CompressionError, "Failed to decompress " + path);
+        }
+        return digest.finish();
+    }
+
+    // backup_x.dump.gz -> backup_x.dump.zst
+    std::string replacementName(const std::string& filename, const std::string& format,
+                                const CompressionConfig& target) {
+        std::string stem = filename;
+        if (!format.empty()) {
+            CompressionConfig oldConfig = target;
+            oldConfig.format = format;
+            std::string oldExtension = Compressor(oldConfig).getFileExtension();
+            if (stem.size() > oldExtension.size() &&
+                stem.compare(stem.size() - oldExtension.size(), oldExtension.size(), oldExtension) == 0) {
+                stem.resize(stem.size() - oldExtension.size());
+            }
+        }
+        return stem + Compressor(target).getFileExtension();
+    }
+
+    void writeJournal(const fs::path& journal, const std::string& from, const std::string& to) {
+        fs::path tempPath = journal;
+        tempPath += ".tmp";
+        std::ofstream out(tempPath, std::ios::trunc);
+        out << from << "\n" << to << "\n";
+        out.close();
+        if (!out) {
+            DB_THROW(StorageError, "Failed to write recompress journal");
+        }
+        commitFile(tempPath.string(), journal.string());
+    }
+
+    // Finishes or discards the swap an interrupted run was in the middle of
+    void recoverJournal(LocalStorage& storage, const fs::path& dir, const fs::path& journal,
+                        const CompressionConfig& readConfig) {
+        if (!fs::exists(journal)) {
+            return;
+        }
+        std::ifstream in(journal);
+        std::string from;
+        std::string to;
+        std::getline(in, from);
+        std::getline(in, to);
+        in.close();
+
+        auto logger = getLogger();
+        std::vector<BackupMetadata> catalog = storage.listBackups();
+        auto catalogued = [&catalog](const std::string& name) {
+            for (const auto& m : catalog) {
+                if (m.filename == name) {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        if (!from.empty() && from == to) {
+            // Replaced in place: the file is either the original or its verified
+            // replacement, so the catalog entry just needs its checksum refreshed
+            if (catalogued(from) && fs::exists(dir / from)) {
+                storage.replaceBackup(from, (dir / from).string());
+            }
+        } else if (!from.empty() && !to.empty()) {
+            bool swapped = catalogued(to);
+            if (!swapped && catalogued(from) && fs::exists(dir / to)) {
+                // Verified before it was renamed into place, but check again before
+                // the original goes
+                Throttle unthrottled(0);
+                if (digestOf((dir / from).string(), readConfig, unthrottled) ==
+                    digestOf((dir / to).string(), readConfig, unthrottled)) {
+                    storage.replaceBackup(from, (dir / to).string());
+                    swapped = true;
+                } else {
+                    fs::remove(dir / to);
+                }
+            }
+            if (swapped) {
+                std::error_code ignored;
+                fs::remove(dir / from, ignored);
+            }
+            logger->info("Recovered interrupted recompression of {}", from);
+        }
+        fs::remove(journal);
+    }
+
+    // Rewrites one backup and swaps it in. Returns the new file name.
+    std::string recompressOne(LocalStorage& storage, const StorageConfig& storageConfig,
+                              const fs::path& dir, const fs::path& journal,
+                              const BackupMetadata& backup, const std::string& format,
+                              const CompressionConfig& readConfig, const CompressionConfig& target,
+                              Throttle& throttle) {
+        if (!storage.verifyChecksum(backup)) {
+            DB_THROW(StorageError, "File does not match its catalog checksum; left as it is");
+        }
+
+        std::string sourcePath = (dir / backup.filename).string();
+        std::string targetName = replacementName(backup.filename, format, target);
+        if (targetName != backup.filename && fs::exists(dir / targetName)) {
+            DB_THROW(StorageError, "Replacement file already exists: " + targetName);
+        }
+        fs::path tempPath = dir / (TEMP_PREFIX + targetName);
+
+        std::string checksum;
+        try {
+            // Decode, digest, re-encode and checksum the new file in one pass
+            // Both copies exist until the swap; the new one is reserved at the old one's size
+            Sha256 sourceDigest;
+            Sha256 digest;
+            SpaceReservation space(storageConfig, tempPath.string(), backup.size);
+            BackupFileWriter output(tempPath.string());
+            output.preallocate(space.size());
+            bool encoded = Compressor(target).compressStream([&](const DataSink& sink) {
+                return decodeBackup(sourcePath, "", readConfig, [&](const char* data, size_t size) {
+                    throttle.consume(size);
+                    sourceDigest.update(data, size);
+                    return sink(data, size);
+                });
+            }, output.asSink(), &digest);
+            if (!encoded) {
+                DB_THROW(CompressionError, "Failed to recompress backup");
+            }
+            output.finish();
+            checksum = digest.finish();
+
+            // The new file has to decode to the same bytes before it replaces anything
+            if (digestOf(tempPath.string(), readConfig, throttle) != sourceDigest.finish()) {
+                DB_THROW(CompressionError, "Recompressed backup does not match the original");
+            }
+        } catch (...) {
+            std::error_code ignored;
+            fs::remove(tempPath, ignored);
+            throw;
+        }
+
+        writeJournal(journal, backup.filename, targetName);
+        fs::rename(tempPath, dir / targetName);
+        syncDirectory(dir.string());
+        storage.replaceBackup(backup.filename, (dir / targetName).string(), checksum);
+        if (targetName != backup.filename) {
+            fs::remove(sourcePath);
+        }
+        fs::remove(journal);
+        return targetName;
+    }
+}
+
+RecompressStats recompressBackups(const StorageConfig& storageConfig, const CompressionConfig& readConfig,
+                                  const RecompressOptions& options) {
+    if (options.target.format == "auto") {
+        DB_THROW(ConfigurationError, "Recompression needs a fixed target format");
+    }
+    Compressor checkTarget(options.target);  // Rejects unknown formats and levels up front
+
+    LocalStorage storage(storageConfig);
+    fs::path dir(storageConfig.localPath);
+    fs::path journal = dir / "metadata" / JOURNAL_NAME;
+    auto logger = getLogger();
+
+    recoverJournal(storage, dir, journal, readConfig);
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        if (entry.path().filename().string().compare(0, TEMP_PREFIX.size(), TEMP_PREFIX) == 0) {
+            fs::remove(entry.path());
+        }
+    }
+
+    Throttle throttle(options.maxMBps);
+    RecompressStats stats;
+    for (const BackupMetadata& backup : storage.listBackups()) {
+        std::string path = (dir / backup.filename).string();
+        if (!fs::exists(path)) {
+            logger->warn("Catalogued backup is missing: {}", backup.filename);
+            stats.skipped++;
+            continue;
+        }
+        std::string format = Compressor::detectFormat(path);
+        if (!backup.base.empty() || format == options.target.format) {
+            stats.skipped++;
+            continue;
+        }
+
+        try {
+            std::string replacement = recompressOne(storage, storageConfig, dir, journal, backup, format,
+                                                    readConfig, options.target, throttle);
+            uint64_t after = fs::file_size(dir / replacement);
+            logger->info("Recompressed {} -> {} ({} -> {} bytes)", backup.filename, replacement, backup.size, after);
+            stats.converted++;
+            stats.bytesBefore += backup.size;
+            stats.bytesAfter += after;
+        } catch (const std::exception& e) {
+            logger->error("Failed to recompress {}: {}", backup.filename, e.what());
+            stats.failed++;
+        }
+    }
+    return stats;
+}
+
+void runAtIdlePriority() {
+    setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SYS_ioprio_set
+    // ioprio_set(IOPRIO_WHO_PROCESS, self, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)); glibc has no wrapper
+    const int whoProcess = 1;
+    const int idleClass = 3;
+    syscall(SYS_ioprio_set, whoProcess, 0, idleClass << 13);
+#endif
+}
+
+} // namespace dbbackup
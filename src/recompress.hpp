@@ -0,0 +1,38 @@
+#pragma once
+
+#include "config.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dbbackup {
+
+struct RecompressOptions {
+    CompressionConfig target;   // Codec and level to rewrite backups with; not "auto"
+    double maxMBps = 0.0;       // Cap on data decoded per second, 0 = unthrottled
+};
+
+struct RecompressStats {
+    size_t converted = 0;
+    size_t skipped = 0;         // Already in the target format, or deltas
+    size_t failed = 0;          // Left as they were; see the log
+    uint64_t bytesBefore = 0;   // Of the converted backups
+    uint64_t bytesAfter = 0;
+};
+
+/// Rewrites every catalogued backup that isn't already in the target format: decodes
+/// it, re-encodes it to a temporary file, checks the new file decodes to the same
+/// bytes, then swaps it in and updates backups.json. A backup whose file no longer
+/// matches its catalog checksum is left alone. Deltas stay as they are; the backups
+/// they are based on can be rewritten, since deltas apply to the uncompressed dump.
+///
+/// Each swap is journalled, so a run that is interrupted can simply be started again:
+/// it finishes or discards the swap in progress and carries on with what is left.
+RecompressStats recompressBackups(const StorageConfig& storage, const CompressionConfig& readConfig,
+                                  const RecompressOptions& options);
+
+/// Lowers this process to the idle CPU and I/O scheduling classes, so a long-running
+/// job only uses what interactive work leaves. Best effort.
+void runAtIdlePriority();
+
+} // namespace dbbackup
@@ -1,8 +1,11 @@
 #include "restore_manager.hpp"
-#include "compression.hpp"
+#include "../include/compression.hpp"
 #include "logging.hpp"
 #include "notifications.hpp"
+#include "storage.hpp"
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 
 using namespace dbbackup;
@@ -18,18 +21,47 @@ bool RestoreManager::restore(const std::string& backupFilePath, bool selectiveRe
     auto logger = getLogger();
     logger->info("Starting restore from file: {}", backupFilePath);
 
-    // Potentially check if it's compressed
-    // For simplicity, assume anything ending in .gz is compressed
+    // Identify the codec from the file's magic bytes rather than its suffix
     std::string actualBackupPath = backupFilePath;
-    bool isCompressed = false;
-    if(backupFilePath.size() > 3 && backupFilePath.substr(backupFilePath.size()-3) == ".gz") {
-        isCompressed = true;
-    }
+    std::string detectedFormat = Compressor::detectFormat(backupFilePath);
+    bool isCompressed = !detectedFormat.empty();
+
+    CompressionConfig readConfig = m_config.backup.compression;
+    readConfig.format = isCompressed ? detectedFormat : readConfig.format;
+
+    // A delta is rebuilt through the chain of backups the catalog says it builds on
+    bool isDelta = isCompressed && isDeltaBackup(backupFilePath);
+    auto decompressInto = [&](const BackupSink& sink) {
+        return isDelta ? streamBackupChain(backupFilePath, readConfig, sink)
+                       : Compressor(readConfig).decompressStream(backupFilePath, sink);
+    };
+
+    // When streaming, the decompressor feeds the restore client directly
+    // once connected instead of writing an uncompressed copy first
+    bool streamDecompress = isCompressed && m_config.backup.streaming;
 
     // Decompress if needed
-    if(isCompressed) {
-        std::string decompressedFilePath = backupFilePath.substr(0, backupFilePath.size()-3);
-        if(!dbbackup::decompressFile(backupFilePath, decompressedFilePath)) {
+    if(isCompressed && !streamDecompress) {
+        std::string decompressedFilePath = std::filesystem::path(backupFilePath).replace_extension().string();
+        if(decompressedFilePath == backupFilePath) {
+            decompressedFilePath += ".restore";
+        }
+        bool decompressed = false;
+        try {
+            if (isDelta) {
+                std::ofstream decompressedFile(decompressedFilePath, std::ios::binary);
+                decompressed = decompressInto([&decompressedFile](const char* data, size_t size) {
+                    return static_cast<bool>(decompressedFile.write(data, size));
+                });
+                decompressedFile.close();
+                decompressed = decompressed && !decompressedFile.fail();
+            } else {
+                decompressed = Compressor(readConfig).decompressFile(backupFilePath, decompressedFilePath);
+            }
+        } catch(const std::exception& e) {
+            logger->error("Decompression failed: {}", e.what());
+        }
+        if(!decompressed) {
             logger->error("Failed to decompress backup file.");
             sendNotificationIfNeeded(m_config.logging, "Restore failed: decompression error.");
             return false;
@@ -46,7 +78,18 @@ bool RestoreManager::restore(const std::string& backupFilePath, bool selectiveRe
     }
 
     // Perform restore
-    if(!conn->restoreBackup(actualBackupPath)) {
+    bool restored = false;
+    if(streamDecompress) {
+        try {
+            restored = conn->streamRestore(decompressInto);
+        } catch(const std::exception& e) {
+            logger->error("Streaming restore failed: {}", e.what());
+        }
+    } else {
+        restored = conn->restoreBackup(actualBackupPath);
+    }
+
+    if(!restored) {
         logger->error("Restore operation failed.");
         conn->disconnect();
         sendNotificationIfNeeded(m_config.logging, "Restore failed: restoreBackup error.");
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../include/compression.hpp"
+#include "codec_pipeline.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dbbackup {
+
+/// Reversible preprocessing for plain-text SQL dumps, applied ahead of the codec.
+/// Rows of pg_dump COPY blocks and extended INSERT statements are written out one
+/// column at a time, and integer columns as deltas, so the codec sees long runs of
+/// similar values instead of interleaved rows. Everything else passes through verbatim.
+/// Transformed streams start with a magic header; SqlTransformDecoder passes any
+/// other stream through untouched, so restore can always run it.
+class SqlTransformEncoder {
+public:
+    explicit SqlTransformEncoder(DataSink sink);
+
+    /// Transforms the next piece of the dump. Returns false if the sink aborted.
+    bool write(const char* data, size_t size);
+
+    /// Flushes buffered rows and any unterminated last line. Returns false if the sink aborted.
+    bool finish();
+
+private:
+    bool processLine(std::string_view line, bool terminated);
+    bool flushRows();
+    bool emitInsert(std::string_view line);
+    bool emitColumns(char type, const std::string& payload, std::string_view original);
+    bool appendLiteral(std::string_view bytes);
+    bool flushLiteral();
+    bool emitRecord(char type, std::string_view payload);
+
+    DataSink sink;
+    bool started = false;
+    bool inCopy = false;           // Between a COPY ... FROM stdin; line and its \. terminator
+    bool inLongLine = false;       // Passing through the rest of a line too long to buffer
+    std::string partial;           // Unterminated line carried over between writes
+    std::string literal;           // Verbatim bytes waiting to be emitted
+    std::vector<std::string> rows; // COPY rows waiting to be transposed, without newlines
+    size_t rowColumns = 0;
+    size_t rowBytes = 0;
+};
+
+/// Inverse of SqlTransformEncoder, applied on the fly to decompressed output
+class SqlTransformDecoder {
+public:
+    explicit SqlTransformDecoder(DataSink sink);
+
+    /// Restores the next piece of the stream. Throws CompressionError on malformed input;
+    /// returns false if the sink aborted.
+    bool write(const char* data, size_t size);
+
+    /// Throws CompressionError if the stream ended in the middle of a record
+    bool finish();
+
+private:
+    enum class Mode { Detecting, Passthrough, Decoding };
+
+    bool decodeRecords();
+
+    DataSink sink;
+    Mode mode = Mode::Detecting;
+    std::string buffer;
+    size_t consumed = 0;  // Bytes of buffer already decoded
+};
+
+/// SqlTransformEncoder or SqlTransformDecoder as a codec pipeline stage: the encoder runs
+/// ahead of the codec, the decoder behind it. Output goes straight to the out of the call
+/// that produced it.
+template <typename Transform>
+class SqlTransformStageOf {
+public:
+    void init() {
+        transform = std::make_unique<Transform>([this](const char* data, size_t size) {
+            (*out)(data, size);
+            return true;
+        });
+    }
+
+    template <typename Out>
+    void process(ByteSpan input, Out& next) {
+        ErasedStage::Emit emit = emitTo(next);
+        out = &emit;
+        transform->write(input.data, input.size);
+    }
+
+    template <typename Out>
+    void finish(Out& next) {
+        ErasedStage::Emit emit = emitTo(next);
+        out = &emit;
+        transform->finish();
+    }
+
+private:
+    std::unique_ptr<Transform> transform;
+    const ErasedStage::Emit* out = nullptr;
+};
+
+using SqlTransformStage = SqlTransformStageOf<SqlTransformEncoder>;
+
+/// Passes streams that were never transformed through untouched, so restore always runs it
+using SqlRestoreStage = SqlTransformStageOf<SqlTransformDecoder>;
+
+} // namespace dbbackup
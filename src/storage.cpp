@@ -1,13 +1,32 @@
 #include "storage.hpp"
 #include "error/ErrorUtils.hpp"
+#include "io_engine.hpp"
+#include "checksum.hpp"
+#include "logging.hpp"
 #include <iostream>
 #include <filesystem>
 #include <fstream>
 #include <chrono>
 #include <algorithm>
+#include <atomic>
 #include <sstream>
 #include <iomanip>
-#include <openssl/evp.h>
+#include <set>
+#include <thread>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 namespace fs = std::filesystem;
 using namespace dbbackup::error;
@@ -21,8 +40,172 @@ static std::string getCurrentTimestamp() {
     return ss.str();
 }
 
+// Catalog entry for backupName, or nullptr if it isn't catalogued
+static const BackupMetadata* findBackup(const std::vector<BackupMetadata>& metadata, const std::string& backupName) {
+    for (const auto& m : metadata) {
+        if (m.filename == backupName) {
+            return &m;
+        }
+    }
+    return nullptr;
+}
+
+bool decodeBackup(const std::string& backupPath, const std::string& reference,
+                         const dbbackup::CompressionConfig& compression, const dbbackup::DataSink& sink) {
+    dbbackup::CompressionConfig readConfig = compression;
+    if (!reference.empty()) {
+        readConfig.format = "zstd";
+        return dbbackup::Compressor(readConfig).decompressDelta(backupPath, reference, sink);
+    }
+
+    readConfig.format = dbbackup::Compressor::detectFormat(backupPath);
+    if (readConfig.format.empty()) {
+        return dbbackup::fileSource(backupPath)(sink);  // Stored uncompressed
+    }
+    return dbbackup::Compressor(readConfig).decompressStream(backupPath, sink);
+}
+
+// False once the process is gone, so what it left behind can be cleaned up
+static bool processAlive(pid_t pid) {
+    return ::kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// Name a file being written for path by process pid has until it is committed
+static fs::path partialPath(const fs::path& path, pid_t pid = ::getpid()) {
+    return path.parent_path() / (".partial_" + std::to_string(pid) + "_" + path.filename().string());
+}
+
+std::string scratchPath(const std::string& dir, const std::string& name) {
+    static std::atomic<uint64_t> next{0};
+    return partialPath(fs::path(dir) / (std::to_string(next++) + "_" + name)).string();
+}
+
+ScratchFiles::~ScratchFiles() {
+    std::error_code ignored;
+    for (const auto& path : paths) {
+        fs::remove(path, ignored);
+    }
+}
+
+namespace {
+
+// A small shared file held under an exclusive flock until destroyed; every process
+// and thread that opens the same file waits its turn
+class LockedFile {
+public:
+    explicit LockedFile(const fs::path& path) : path(path), fd(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)) {
+        if (fd < 0) {
+            DB_THROW(StorageError, "Failed to open " + path.string());
+        }
+        if (::flock(fd, LOCK_EX) != 0) {
+            ::close(fd);
+            DB_THROW(StorageError, "Failed to lock " + path.string());
+        }
+    }
+
+    ~LockedFile() {
+        ::close(fd);  // Releases the lock
+    }
+
+    LockedFile(const LockedFile&) = delete;
+    LockedFile& operator=(const LockedFile&) = delete;
+
+    std::string read() const {
+        std::string contents;
+        char buffer[4096];
+        ssize_t got;
+        off_t offset = 0;
+        while ((got = ::pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+            contents.append(buffer, static_cast<size_t>(got));
+            offset += got;
+        }
+        return contents;
+    }
+
+    void write(const std::string& contents) const {
+        if (::ftruncate(fd, 0) != 0 ||
+            ::pwrite(fd, contents.data(), contents.size(), 0) != static_cast<ssize_t>(contents.size())) {
+            DB_THROW(StorageError, "Failed to update " + path.string());
+        }
+    }
+
+private:
+    fs::path path;
+    int fd;
+};
+
+}
+
+void syncFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    bool synced = fd >= 0 && ::fdatasync(fd) == 0;
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (!synced) {
+        DB_THROW(StorageError, "Failed to sync " + path);
+    }
+}
+
+void syncDirectory(const std::string& dir) {
+    // Per directory: calls numbered as they arrive, and the last number the finished
+    // syncs are known to cover
+    struct Group {
+        uint64_t requested = 0;
+        uint64_t synced = 0;
+        bool syncing = false;
+    };
+    static std::mutex mutex;
+    static std::condition_variable synced;
+    static std::map<std::string, Group> groups;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    Group& group = groups[dir];
+    uint64_t ticket = ++group.requested;
+    while (group.synced < ticket) {
+        if (group.syncing) {
+            synced.wait(lock);
+            continue;
+        }
+
+        // Whoever finds no sync running starts one for everything asked for so far
+        group.syncing = true;
+        uint64_t covered = group.requested;
+        lock.unlock();
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        bool ok = fd >= 0 && ::fsync(fd) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        lock.lock();
+        group.syncing = false;
+        if (ok) {
+            group.synced = std::max(group.synced, covered);
+        }
+        synced.notify_all();
+        if (!ok) {
+            DB_THROW(StorageError, "Failed to sync directory " + dir);
+        }
+    }
+}
+
+void commitFile(const std::string& path, const std::string& newPath) {
+    syncFile(path);
+    fs::rename(path, newPath);
+    syncDirectory(fs::path(newPath).parent_path().string());
+}
+
 LocalStorage::LocalStorage(const dbbackup::StorageConfig& config) : config(config) {
     ensureStorageDirectory();
+
+    // Files a crashed job was writing never got their names; nothing refers to them
+    std::error_code ignored;
+    for (const auto& entry : fs::directory_iterator(config.localPath, ignored)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 9, ".partial_") == 0 && !processAlive(std::atoi(name.c_str() + 9))) {
+            fs::remove(entry.path(), ignored);
+        }
+    }
 }
 
 void LocalStorage::ensureStorageDirectory() const {
@@ -42,47 +225,312 @@ void LocalStorage::ensureStorageDirectory() const {
     });
 }
 
-std::string LocalStorage::calculateChecksum(const std::string& filePath) const {
-    std::ifstream file(filePath, std::ios::binary);
-    if (!file) {
+// SHA-256 of the first limit bytes of a file
+static std::string checksumFile(const std::string& filePath, uintmax_t limit) {
+    int fd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         DB_THROW(StorageError, "Failed to open file for checksum calculation");
     }
 
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) {
-        DB_THROW(StorageError, "Failed to create message digest context");
+    dbbackup::Sha256 digest;
+    bool read = false;
+    try {
+        read = dbbackup::readBlocks(fd, [&digest, &limit](const char* data, size_t size) {
+            size_t take = static_cast<size_t>(std::min<uintmax_t>(size, limit));
+            digest.update(data, take);
+            limit -= take;
+            return true;
+        });
+    } catch (...) {
+        ::close(fd);
+        throw;
     }
+    ::close(fd);
+    if (!read) {
+        DB_THROW(StorageError, "Failed to read file for checksum calculation");
+    }
+    return digest.finish();
+}
 
-    if (EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) != 1) {
-        EVP_MD_CTX_free(ctx);
-        DB_THROW(StorageError, "Failed to initialize message digest");
+std::string LocalStorage::calculateChecksum(const std::string& filePath) const {
+    return checksumFile(filePath, UINTMAX_MAX);
+}
+
+// Has the kernel copy size bytes at offset in from to the current position of to;
+// returns how many it copied before it couldn't (e.g. across filesystems on older kernels)
+static size_t copyRange(int from, uint64_t offset, int to, size_t size) {
+    size_t done = 0;
+#ifdef __linux__
+    loff_t position = static_cast<loff_t>(offset);
+    while (done < size) {
+        ssize_t copied = copy_file_range(from, &position, to, nullptr, size - done, 0);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(copied);
     }
+#else
+    (void)from;
+    (void)offset;
+    (void)to;
+    (void)size;
+#endif
+    return done;
+}
 
-    char buffer[4096];
-    while (file.read(buffer, sizeof(buffer))) {
-        if (EVP_DigestUpdate(ctx, buffer, file.gcount()) != 1) {
-            EVP_MD_CTX_free(ctx);
-            DB_THROW(StorageError, "Failed to update message digest");
+// Creates dest sharing source's extents, without copying data (btrfs, XFS, ...).
+// False, with dest removed, where the filesystem can't.
+static bool reflink(const std::string& source, const std::string& dest) {
+#if defined(__linux__) && defined(FICLONE)
+    int from = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (from < 0) {
+        return false;
+    }
+    int to = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool cloned = to >= 0 && ioctl(to, FICLONE, from) == 0;
+    if (to >= 0 && ::close(to) != 0) {
+        cloned = false;
+    }
+    ::close(from);
+    if (!cloned && to >= 0) {
+        std::error_code ignored;
+        fs::remove(dest, ignored);
+    }
+    return cloned;
+#else
+    (void)source;
+    (void)dest;
+    return false;
+#endif
+}
+
+struct BackupFileWriter::State {
+    std::string path;  // Partial file, until finish()
+    std::string finalPath;
+    int fd = -1;
+    std::unique_ptr<dbbackup::BlockWriter> file;  // From the first write, after any kernel copy
+    uint64_t written = 0;
+    uint64_t preallocated = 0;
+    bool finished = false;
+};
+
+BackupFileWriter::BackupFileWriter(const std::string& path) : state(std::make_unique<State>()) {
+    state->path = partialPath(path).string();
+    state->finalPath = path;
+    state->fd = ::open(state->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (state->fd < 0) {
+        DB_THROW(StorageError, "Failed to create backup file: " + path);
+    }
+}
+
+BackupFileWriter::~BackupFileWriter() {
+    state->file.reset();
+    if (state->fd >= 0) {
+        ::close(state->fd);
+    }
+    if (!state->finished) {
+        std::error_code ignored;
+        fs::remove(state->path, ignored);
+    }
+}
+
+bool BackupFileWriter::write(const char* data, size_t size) {
+    if (state->fd < 0) {
+        return false;
+    }
+    if (!state->file) {
+        state->file = std::make_unique<dbbackup::BlockWriter>(state->fd);
+    }
+    if (!state->file->write(data, size)) {
+        return false;
+    }
+    state->written += size;
+    return true;
+}
+
+dbbackup::DataSink BackupFileWriter::asSink() {
+    return [this](const char* data, size_t size) { return write(data, size); };
+}
+
+void BackupFileWriter::preallocate(uint64_t bytes) {
+#ifdef __linux__
+    if (state->fd >= 0 && bytes > state->written &&
+        ::fallocate(state->fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(bytes)) == 0) {
+        state->preallocated = std::max(state->preallocated, bytes);
+    }
+#else
+    (void)bytes;
+#endif
+}
+
+bool BackupFileWriter::copyFrom(const std::string& sourcePath, dbbackup::Sha256& digest) {
+    int source = ::open(sourcePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source < 0) {
+        DB_THROW(StorageError, "Failed to open " + sourcePath);
+    }
+
+    // Kernel copies go through the page cache, so they're left out when the I/O mode
+    // keeps backups out of it; once anything has been written here, writes continue
+    bool kernelCopy = state->fd >= 0 && !state->file && dbbackup::cachePolicy() == dbbackup::CachePolicy::Buffered;
+    uint64_t offset = 0;
+    bool copied = false;
+    try {
+        copied = dbbackup::readBlocks(source, [&](const char* data, size_t size) {
+            size_t moved = kernelCopy ? copyRange(source, offset, state->fd, size) : 0;
+            kernelCopy = kernelCopy && moved == size;
+            offset += size;
+            digest.update(data, size);
+            state->written += moved;
+            return moved == size || write(data + moved, size - moved);
+        });
+    } catch (...) {
+        ::close(source);
+        throw;
+    }
+    ::close(source);
+    return copied;
+}
+
+void BackupFileWriter::finish(const std::string& finalPath) {
+    int fd = state->fd;
+    state->fd = -1;
+    bool flushed = fd >= 0 && (!state->file || state->file->flush());
+    state->file.reset();
+    // Truncating to the size the file already has hands back the preallocated space past it
+    if (flushed && state->preallocated > state->written) {
+        flushed = ::ftruncate(fd, static_cast<off_t>(state->written)) == 0;
+    }
+    flushed = flushed && ::fdatasync(fd) == 0;
+    if (fd < 0 || ::close(fd) != 0 || !flushed) {
+        DB_THROW(StorageError, "Failed to write backup file: " + state->finalPath);
+    }
+
+    std::string target = finalPath.empty() ? state->finalPath : finalPath;
+    fs::rename(state->path, target);
+    state->finished = true;
+    syncDirectory(fs::path(target).parent_path().string());
+}
+
+uint64_t BackupFileWriter::size() const {
+    return state->written;
+}
+
+namespace {
+
+// One job's claim in a storage directory's space ledger
+struct SpaceClaim {
+    pid_t pid;
+    uint64_t bytes;
+    std::string path;
+};
+
+}
+
+// Loads the space ledger of storageDir with it locked against every other process,
+// lets update change the claims, and writes them back. Claims of processes that have
+// exited are dropped on the way.
+static void withLedger(const std::string& storageDir, const std::function<void(std::vector<SpaceClaim>&)>& update) {
+    fs::path ledgerPath = fs::path(storageDir) / "metadata" / "space.ledger";
+    std::error_code ignored;
+    fs::create_directories(ledgerPath.parent_path(), ignored);
+    LockedFile ledger(ledgerPath);
+
+    // One claim per line: pid, bytes and the path, which runs to the end of the line
+    std::vector<SpaceClaim> claims;
+    std::istringstream lines(ledger.read());
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        SpaceClaim claim;
+        if (!(fields >> claim.pid >> claim.bytes) || !std::getline(fields >> std::ws, claim.path)) {
+            continue;
+        }
+        if (processAlive(claim.pid)) {
+            claims.push_back(std::move(claim));
         }
     }
 
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hashLen;
-    if (EVP_DigestFinal_ex(ctx, hash, &hashLen) != 1) {
-        EVP_MD_CTX_free(ctx);
-        DB_THROW(StorageError, "Failed to finalize message digest");
+    update(claims);
+
+    std::string out;
+    for (const auto& claim : claims) {
+        out += std::to_string(claim.pid) + " " + std::to_string(claim.bytes) + " " + claim.path + "\n";
     }
+    ledger.write(out);
+}
 
-    EVP_MD_CTX_free(ctx);
+// Bytes the file at path takes up on disk so far (0 if it doesn't exist yet)
+static uint64_t allocatedBytes(const std::string& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(st.st_blocks) * 512;
+}
 
-    std::stringstream ss;
-    for (unsigned int i = 0; i < hashLen; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+SpaceReservation::SpaceReservation(const dbbackup::StorageConfig& config, const std::string& path, uint64_t bytes)
+    : storageDir(config.localPath), path(path), bytes(bytes) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(config.spaceWaitSeconds);
+    bool waiting = false;
+    while (true) {
+        bool reserved = false;
+        uint64_t held = 0;
+        uint64_t available = 0;
+        withLedger(storageDir, [&](std::vector<SpaceClaim>& claims) {
+            // Claims count for what their files haven't taken up yet; the rest is
+            // already gone from the free space
+            for (const auto& claim : claims) {
+                uint64_t allocated = allocatedBytes(claim.path) +
+                                     allocatedBytes(partialPath(claim.path, claim.pid).string());
+                held += claim.bytes > allocated ? claim.bytes - allocated : 0;
+            }
+            available = fs::space(storageDir).available;
+            if (available >= held && available - held >= bytes) {
+                claims.push_back({::getpid(), bytes, path});
+                reserved = true;
+            }
+        });
+        if (reserved) {
+            return;
+        }
+
+        // Other claims are spent or about to be; releasing them can't make room
+        if (available < bytes) {
+            DB_THROW(StorageError, "Insufficient storage space");
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            DB_THROW(StorageError, "Timed out waiting for storage space other backups have reserved");
+        }
+        if (!waiting) {
+            getLogger()->info("Waiting for {} bytes of storage space reserved by other backups", held);
+            waiting = true;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
     }
-    return ss.str();
 }
 
-BackupMetadata LocalStorage::storeBackup(const std::string& sourcePath) {
+SpaceReservation::~SpaceReservation() {
+    try {
+        pid_t self = ::getpid();
+        withLedger(storageDir, [&](std::vector<SpaceClaim>& claims) {
+            auto mine = std::find_if(claims.begin(), claims.end(), [&](const SpaceClaim& claim) {
+                return claim.pid == self && claim.path == path && claim.bytes == bytes;
+            });
+            if (mine != claims.end()) {
+                claims.erase(mine);
+            }
+        });
+    } catch (...) {
+        // A claim left behind is dropped once this process exits
+    }
+}
+
+BackupMetadata LocalStorage::storeBackup(const std::string& sourcePath,
+                                         const dbbackup::Compressor* compressor,
+                                         bool consumeSource) {
     BackupMetadata metadata;
     DB_TRY_CATCH_LOG("Storage", {
         fs::path source(sourcePath);
@@ -90,25 +538,61 @@ BackupMetadata LocalStorage::storeBackup(const std::string& sourcePath) {
             DB_THROW(StorageError, "Source backup file does not exist");
         }
 
-        // Check available space
-        size_t requiredSpace = fs::file_size(source) * 1.1; // Add 10% buffer
-        if (getAvailableSpace() < requiredSpace) {
-            DB_THROW(StorageError, "Insufficient storage space");
-        }
-
         // Generate unique filename with timestamp
         std::string timestamp = getCurrentTimestamp();
         fs::path destPath = fs::path(config.localPath) / 
             (fs::path(source).stem().string() + "_" + timestamp + fs::path(source).extension().string());
-
-        // Copy file
-        fs::copy_file(source, destPath, fs::copy_options::overwrite_existing);
-
-        // Create metadata
         metadata.filename = destPath.filename().string();
         metadata.timestamp = timestamp;
-        metadata.size = fs::file_size(destPath);
-        metadata.checksum = calculateChecksum(destPath.string());
+
+        // Moving or sharing the bytes costs no space and no copy; the checksum is
+        // the only read of them. Either way the file is synced before it has its name.
+        bool placed = false;
+        if (!compressor && consumeSource) {
+            syncFile(sourcePath);
+            std::error_code crossDevice;
+            fs::rename(source, destPath, crossDevice);
+            placed = !crossDevice;
+            if (placed) {
+                syncDirectory(config.localPath);
+            }
+        }
+        if (!compressor && !placed) {
+            std::string partial = partialPath(destPath).string();
+            placed = reflink(sourcePath, partial);
+            if (placed) {
+                commitFile(partial, destPath.string());
+            }
+        }
+        if (placed) {
+            metadata.size = fs::file_size(destPath);
+            metadata.checksum = calculateChecksum(destPath.string());
+        } else {
+            // Check available space
+            size_t sourceSize = fs::file_size(source);
+            size_t requiredSpace = sourceSize * 1.1; // Add 10% buffer
+            if (compressor) {
+                compressor->selectForFile(sourcePath);
+                requiredSpace = compressor->estimateCompressedSize(sourceSize);
+                destPath += compressor->getFileExtension();
+                metadata.filename = destPath.filename().string();
+            }
+            SpaceReservation space(config, destPath.string(), requiredSpace);
+
+            // The source is read once; the copy is hashed as it is written
+            BackupFileWriter dest(destPath.string());
+            dest.preallocate(space.size());
+            dbbackup::Sha256 digest;
+            bool written = compressor ? compressor->compressStream(dbbackup::fileSource(sourcePath), dest.asSink(),
+                                                                   &digest)
+                                      : dest.copyFrom(sourcePath, digest);
+            if (!written) {
+                DB_THROW(StorageError, "Failed to write backup into storage");
+            }
+            metadata.size = dest.size();
+            dest.finish();
+            metadata.checksum = digest.finish();
+        }
         
         saveMetadata(metadata);
 
@@ -120,6 +604,148 @@ BackupMetadata LocalStorage::storeBackup(const std::string& sourcePath) {
     return metadata;
 }
 
+BackupMetadata LocalStorage::registerBackup(const std::string& backupPath, const std::string& base,
+                                            const std::string& checksum) {
+    BackupMetadata metadata;
+    DB_TRY_CATCH_LOG("Storage", {
+        fs::path path(backupPath);
+        if (!fs::exists(path)) {
+            DB_THROW(StorageError, "Backup file does not exist: " + backupPath);
+        }
+
+        metadata.filename = path.filename().string();
+        metadata.timestamp = getCurrentTimestamp();
+        metadata.size = fs::file_size(path);
+        metadata.checksum = checksum.empty() ? calculateChecksum(backupPath) : checksum;
+        metadata.base = base;
+        saveMetadata(metadata);
+    });
+    return metadata;
+}
+
+std::string LocalStorage::deltaBase(size_t maxChainLength) const {
+    auto metadata = loadMetadata();
+
+    // Timestamps sort as text; on a tie the later entry is the newer backup
+    const BackupMetadata* newest = nullptr;
+    for (const auto& m : metadata) {
+        if ((!newest || m.timestamp >= newest->timestamp) && fs::exists(fs::path(config.localPath) / m.filename)) {
+            newest = &m;
+        }
+    }
+    if (!newest) {
+        return "";
+    }
+
+    // A chain of n backups holds n - 1 deltas. A broken chain can't be built on.
+    try {
+        size_t deltas = backupChain(newest->filename).size() - 1;
+        return deltas < maxChainLength ? newest->filename : "";
+    } catch (const StorageError&) {
+        return "";
+    }
+}
+
+std::vector<BackupMetadata> LocalStorage::backupChain(const std::string& backupName) const {
+    auto metadata = loadMetadata();
+    std::vector<BackupMetadata> chain;
+    std::string next = backupName;
+    while (!next.empty()) {
+        const BackupMetadata* entry = findBackup(metadata, next);
+        if (!entry) {
+            DB_THROW(StorageError, "Backup is not in the catalog: " + next);
+        }
+        if (!fs::exists(fs::path(config.localPath) / next)) {
+            DB_THROW(StorageError, "Backup in delta chain is missing: " + next);
+        }
+        if (chain.size() >= metadata.size()) {
+            DB_THROW(StorageError, "Delta chain of " + backupName + " loops");
+        }
+        chain.push_back(*entry);
+        next = entry->base;
+    }
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+bool LocalStorage::streamBackup(const std::string& backupName, const dbbackup::CompressionConfig& compression,
+                                const dbbackup::DataSink& sink) const {
+    DB_TRY_CATCH_LOG("Storage", {
+        std::vector<BackupMetadata> chain = backupChain(backupName);
+        fs::path dir(config.localPath);
+
+        // Each link is rebuilt as a plain dump for the next one to apply to
+        ScratchFiles rebuilt;
+        std::string reference;
+        for (size_t i = 0; i + 1 < chain.size(); i++) {
+            std::string dumpPath = scratchPath(config.localPath, "rebuild_" + chain[i].filename + ".dump");
+            rebuilt.paths.push_back(dumpPath);
+
+            std::ofstream dump(dumpPath, std::ios::binary | std::ios::trunc);
+            if (!dump) {
+                DB_THROW(StorageError, "Failed to create rebuild file: " + dumpPath);
+            }
+            bool decoded = decodeBackup((dir / chain[i].filename).string(), reference, compression,
+                                        [&dump](const char* data, size_t size) {
+                return static_cast<bool>(dump.write(data, size));
+            });
+            dump.close();
+            if (!decoded || !dump) {
+                DB_THROW(StorageError, "Failed to rebuild backup: " + chain[i].filename);
+            }
+
+            if (!reference.empty()) {
+                fs::remove(reference);
+            }
+            reference = dumpPath;
+        }
+
+        return decodeBackup((dir / chain.back().filename).string(), reference, compression, sink);
+    });
+    return false;
+}
+
+BackupMetadata LocalStorage::replaceBackup(const std::string& backupName, const std::string& replacementPath,
+                                           const std::string& checksum) {
+    BackupMetadata replaced;
+    DB_TRY_CATCH_LOG("Storage", {
+        std::string replacementName = fs::path(replacementPath).filename().string();
+        std::string replacementChecksum = checksum.empty() ? calculateChecksum(replacementPath) : checksum;
+        updateMetadata([&](std::vector<BackupMetadata>& metadata) {
+            bool found = false;
+            for (auto& m : metadata) {
+                if (m.filename == backupName) {
+                    m.filename = replacementName;
+                    m.size = fs::file_size(replacementPath);
+                    m.checksum = replacementChecksum;
+                    replaced = m;
+                    found = true;
+                } else if (m.base == backupName) {
+                    m.base = replacementName;
+                }
+            }
+            if (!found) {
+                DB_THROW(StorageError, "Backup is not in the catalog: " + backupName);
+            }
+            return true;
+        });
+    });
+    return replaced;
+}
+
+bool LocalStorage::verifyChecksum(const BackupMetadata& metadata) const {
+    fs::path backupPath = fs::path(config.localPath) / metadata.filename;
+    if (!fs::exists(backupPath)) {
+        return false;
+    }
+    if (calculateChecksum(backupPath.string()) == metadata.checksum) {
+        return true;
+    }
+    // Entries catalogued before the checksum covered the file's last partial 4 KB
+    uintmax_t size = fs::file_size(backupPath);
+    return size % 4096 != 0 && checksumFile(backupPath.string(), size - size % 4096) == metadata.checksum;
+}
+
 std::string LocalStorage::retrieveBackup(const std::string& backupName) {
     fs::path backupPath = fs::path(config.localPath) / backupName;
     if (!fs::exists(backupPath)) {
@@ -139,24 +765,25 @@ bool LocalStorage::deleteBackup(const std::string& backupName) {
             return false;
         }
 
+        // Update metadata first, so a crash can't leave the catalog naming a removed file
+        updateMetadata([&backupName](std::vector<BackupMetadata>& metadata) {
+            // Deltas can't be restored without their base
+            for (const auto& m : metadata) {
+                if (m.base == backupName) {
+                    DB_THROW(StorageError, "Backup " + backupName + " is the base of delta backup " + m.filename);
+                }
+            }
+            metadata.erase(
+                std::remove_if(metadata.begin(), metadata.end(),
+                    [&backupName](const BackupMetadata& m) { return m.filename == backupName; }),
+                metadata.end()
+            );
+            return true;
+        });
+
         // Remove the file
         fs::remove(backupPath);
 
-        // Update metadata
-        auto metadata = loadMetadata();
-        metadata.erase(
-            std::remove_if(metadata.begin(), metadata.end(),
-                [&backupName](const BackupMetadata& m) { return m.filename == backupName; }),
-            metadata.end()
-        );
-        
-        // Save updated metadata
-        fs::path metadataPath = fs::path(config.localPath) / "metadata" / "backups.json";
-        std::ofstream metadataFile(metadataPath);
-        if (!metadataFile) {
-            DB_THROW(StorageError, "Failed to update metadata after deletion");
-        }
-
         return true;
     });
     return false;
@@ -169,15 +796,27 @@ size_t LocalStorage::cleanOldBackups(size_t keepCount) {
             return 0;
         }
 
-        // Sort by timestamp (newest first)
-        std::sort(metadata.begin(), metadata.end(),
+        // Sort by timestamp (newest first); backups from the same second stay newest
+        // first by catalog order, so a delta never sorts after its base
+        std::reverse(metadata.begin(), metadata.end());
+        std::stable_sort(metadata.begin(), metadata.end(),
             [](const BackupMetadata& a, const BackupMetadata& b) {
                 return a.timestamp > b.timestamp;
             });
 
+        // A kept delta keeps everything its chain starts from
+        std::set<std::string> kept;
+        for (size_t i = 0; i < keepCount; i++) {
+            const BackupMetadata* m = &metadata[i];
+            while (m && kept.insert(m->filename).second) {
+                m = m->base.empty() ? nullptr : findBackup(metadata, m->base);
+            }
+        }
+
+        // Newest first, so a delta goes before the backup it is based on
         size_t deletedCount = 0;
         for (size_t i = keepCount; i < metadata.size(); i++) {
-            if (deleteBackup(metadata[i].filename)) {
+            if (kept.count(metadata[i].filename) == 0 && deleteBackup(metadata[i].filename)) {
                 deletedCount++;
             }
         }
@@ -195,37 +834,150 @@ size_t LocalStorage::getAvailableSpace() const {
     return 0;
 }
 
+// A catalog entry queued in backups.pending, as one line: pid of the job waiting for
+// it, then the entry's fields, tab separated
+static std::string pendingLine(const BackupMetadata& m) {
+    return std::to_string(::getpid()) + "\t" + m.filename + "\t" + m.timestamp + "\t" + std::to_string(m.size) +
+           "\t" + m.base + "\t" + m.checksum + "\n";
+}
+
+static bool parsePendingLine(const std::string& line, pid_t& pid, BackupMetadata& m) {
+    std::istringstream fields(line);
+    std::string pidField;
+    std::string sizeField;
+    if (!std::getline(fields, pidField, '\t') || !std::getline(fields, m.filename, '\t') ||
+        !std::getline(fields, m.timestamp, '\t') || !std::getline(fields, sizeField, '\t') ||
+        !std::getline(fields, m.base, '\t') || !std::getline(fields, m.checksum)) {
+        return false;
+    }
+    try {
+        pid = static_cast<pid_t>(std::stol(pidField));
+        m.size = std::stoull(sizeField);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+// True if the catalog holds m (written by this or any other job)
+static bool catalogued(const std::vector<BackupMetadata>& metadata, const BackupMetadata& m) {
+    const BackupMetadata* entry = findBackup(metadata, m.filename);
+    return entry && entry->checksum == m.checksum;
+}
+
 void LocalStorage::saveMetadata(const BackupMetadata& metadata) const {
     DB_TRY_CATCH_LOG("Storage", {
+        // Queued first: whichever job commits the catalog next takes the entry along,
+        // so when jobs finish together one catalog write and sync covers all of them
+        // and the rest find their entries already there
+        fs::path pendingPath = fs::path(config.localPath) / "metadata" / "backups.pending";
+        std::string line = pendingLine(metadata);
+        {
+            LockedFile pending(pendingPath);
+            pending.write(pending.read() + line);
+        }
+
+        try {
+            updateMetadata([](std::vector<BackupMetadata>&) { return false; });
+        } catch (...) {
+            // Not left for another job to catalog after this one has failed
+            LockedFile pending(pendingPath);
+            std::string contents = pending.read();
+            size_t at = contents.find(line);
+            if (at != std::string::npos) {
+                pending.write(contents.erase(at, line.size()));
+            }
+            throw;
+        }
+    });
+}
+
+void LocalStorage::updateMetadata(const std::function<bool(std::vector<BackupMetadata>&)>& update) const {
+    fs::path metadataDir = fs::path(config.localPath) / "metadata";
+    LockedFile catalogLock(metadataDir / "backups.lock");
+    auto metadata = loadMetadata();
+
+    // Entries queued by jobs still waiting for them; those of jobs that have exited
+    // are dropped
+    bool changed = false;
+    bool queued = false;
+    {
+        LockedFile pending(metadataDir / "backups.pending");
+        std::istringstream lines(pending.read());
+        std::string line;
+        while (std::getline(lines, line)) {
+            pid_t pid;
+            BackupMetadata entry;
+            queued = true;
+            if (parsePendingLine(line, pid, entry) && processAlive(pid) && !catalogued(metadata, entry)) {
+                metadata.push_back(entry);
+                changed = true;
+            }
+        }
+    }
+
+    changed = update(metadata) || changed;
+    if (changed) {
+        writeMetadata(metadata);
+    }
+
+    // Entries queued since were read by nobody yet and stay
+    if (queued) {
+        LockedFile pending(metadataDir / "backups.pending");
+        std::istringstream lines(pending.read());
+        std::string line;
+        std::string kept;
+        while (std::getline(lines, line)) {
+            pid_t pid;
+            BackupMetadata entry;
+            if (parsePendingLine(line, pid, entry) && processAlive(pid) && !catalogued(metadata, entry)) {
+                kept += line + "\n";
+            }
+        }
+        pending.write(kept);
+    }
+}
+
+void LocalStorage::writeMetadata(const std::vector<BackupMetadata>& metadata) const {
+    DB_TRY_CATCH_LOG("Storage", {
+        // Written aside, synced and renamed over the old catalog, so neither readers
+        // nor a crash ever see half of it
         fs::path metadataPath = fs::path(config.localPath) / "metadata" / "backups.json";
-        
-        // Load existing metadata
-        auto existingMetadata = loadMetadata();
-        
-        // Add new metadata
-        existingMetadata.push_back(metadata);
-        
-        // Save updated metadata
-        std::ofstream metadataFile(metadataPath);
+        fs::path tempPath = metadataPath;
+        tempPath += ".tmp";
+        std::ofstream metadataFile(tempPath);
         if (!metadataFile) {
             DB_THROW(StorageError, "Failed to save backup metadata");
         }
         
         // Write metadata as JSON
         metadataFile << "[\n";
-        for (size_t i = 0; i < existingMetadata.size(); i++) {
-            const auto& m = existingMetadata[i];
+        for (size_t i = 0; i < metadata.size(); i++) {
+            const auto& m = metadata[i];
             metadataFile << "  {\n";
             metadataFile << "    \"filename\": \"" << m.filename << "\",\n";
             metadataFile << "    \"timestamp\": \"" << m.timestamp << "\",\n";
             metadataFile << "    \"size\": " << m.size << ",\n";
+            metadataFile << "    \"base\": \"" << m.base << "\",\n";
             metadataFile << "    \"checksum\": \"" << m.checksum << "\"\n";
-            metadataFile << "  }" << (i < existingMetadata.size() - 1 ? "," : "") << "\n";
+            metadataFile << "  }" << (i < metadata.size() - 1 ? "," : "") << "\n";
         }
         metadataFile << "]\n";
+
+        metadataFile.close();
+        if (!metadataFile) {
+            DB_THROW(StorageError, "Failed to save backup metadata");
+        }
+        commitFile(tempPath.string(), metadataPath.string());
     });
 }
 
+// Value of a "key": "value" line, with or without a trailing comma
+static std::string quotedValue(const std::string& line) {
+    size_t start = line.find('"', line.find(':')) + 1;
+    return line.substr(start, line.rfind('"') - start);
+}
+
 std::vector<BackupMetadata> LocalStorage::loadMetadata() const {
     DB_TRY_CATCH_LOG("Storage", {
         fs::path metadataPath = fs::path(config.localPath) / "metadata" / "backups.json";
@@ -244,17 +996,17 @@ std::vector<BackupMetadata> LocalStorage::loadMetadata() const {
         BackupMetadata current;
         while (std::getline(metadataFile, line)) {
             if (line.find("\"filename\"") != std::string::npos) {
-                current.filename = line.substr(line.find(":") + 3);
-                current.filename = current.filename.substr(0, current.filename.length() - 2);
+                current.filename = quotedValue(line);
             } else if (line.find("\"timestamp\"") != std::string::npos) {
-                current.timestamp = line.substr(line.find(":") + 3);
-                current.timestamp = current.timestamp.substr(0, current.timestamp.length() - 2);
+                current.timestamp = quotedValue(line);
             } else if (line.find("\"size\"") != std::string::npos) {
                 current.size = std::stoull(line.substr(line.find(":") + 2));
+            } else if (line.find("\"base\"") != std::string::npos) {
+                current.base = quotedValue(line);
             } else if (line.find("\"checksum\"") != std::string::npos) {
-                current.checksum = line.substr(line.find(":") + 3);
-                current.checksum = current.checksum.substr(0, current.checksum.length() - 2);
+                current.checksum = quotedValue(line);
                 metadata.push_back(current);
+                current = BackupMetadata();
             }
         }
 
@@ -272,3 +1024,37 @@ bool storeBackup(const dbbackup::StorageConfig& storageConfig, const std::string
     });
     return false;
 }
+
+// Catalog for the directory a backup sits in
+static dbbackup::StorageConfig storageFor(const fs::path& backupPath) {
+    dbbackup::StorageConfig storageConfig;
+    storageConfig.localPath = backupPath.has_parent_path() ? backupPath.parent_path().string() : ".";
+    return storageConfig;
+}
+
+bool isDeltaBackup(const std::string& backupPath) {
+    fs::path path(backupPath);
+    dbbackup::StorageConfig storageConfig = storageFor(path);
+    if (!fs::exists(fs::path(storageConfig.localPath) / "metadata" / "backups.json")) {
+        return false;
+    }
+
+    LocalStorage storage(storageConfig);
+    std::vector<BackupMetadata> metadata = storage.listBackups();
+    const BackupMetadata* entry = findBackup(metadata, path.filename().string());
+    return entry && !entry->base.empty();
+}
+
+bool streamBackupChain(const std::string& backupPath, const dbbackup::CompressionConfig& compression,
+                       const dbbackup::DataSink& sink) {
+    DB_TRY_CATCH_LOG("Storage", {
+        if (!isDeltaBackup(backupPath)) {
+            return decodeBackup(backupPath, "", compression, sink);
+        }
+
+        fs::path path(backupPath);
+        LocalStorage storage(storageFor(path));
+        return storage.streamBackup(path.filename().string(), compression, sink);
+    });
+    return false;
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "config.hpp"
+#include "../include/compression.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -8,11 +12,119 @@
 /// Return true on success.
 bool storeBackup(const dbbackup::StorageConfig& storageConfig, const std::string& localBackupPath);
 
+/// True if the catalog in the directory holding backupPath records it as a delta
+bool isDeltaBackup(const std::string& backupPath);
+
+/// Decompresses one backup file into sink: a self-contained backup with whichever codec
+/// wrote it (or as it is, if stored uncompressed), or given the path of the dump it was
+/// taken against, a delta. compression supplies the settings other than the format.
+bool decodeBackup(const std::string& backupPath, const std::string& reference,
+                  const dbbackup::CompressionConfig& compression, const dbbackup::DataSink& sink);
+
+/// Decompresses the backup at backupPath into sink, rebuilding its delta chain from the
+/// catalog beside it if it is a delta
+bool streamBackupChain(const std::string& backupPath, const dbbackup::CompressionConfig& compression,
+                       const dbbackup::DataSink& sink);
+
+/// Flushes the data of the file at path to disk (fdatasync); throws StorageError if it can't
+void syncFile(const std::string& path);
+
+/// Makes files created, renamed or removed in dir survive a crash (fsync of the
+/// directory). Calls for the same directory that overlap share one fsync: each waits
+/// for one that started after it was called, joining it rather than issuing its own.
+void syncDirectory(const std::string& dir);
+
+/// Syncs the file at path, renames it to newPath in the same directory and syncs the
+/// directory. After a crash newPath is either the whole file or what it was before.
+void commitFile(const std::string& path, const std::string& newPath);
+
+/// Path in dir for a scratch file of the calling job, such as a dump rebuilt from a delta
+/// chain. No other job, in this process or another, gets the same one, and it is named
+/// like a partial file so LocalStorage removes it once this process is gone.
+std::string scratchPath(const std::string& dir, const std::string& name);
+
+/// Removes the scratch files in paths, however the job that made them ends
+struct ScratchFiles {
+    std::vector<std::string> paths;
+
+    ~ScratchFiles();
+};
+
 struct BackupMetadata {
     std::string filename;
     std::string timestamp;
     size_t size;
     std::string checksum;
+    std::string base;  // Backup this one is a delta against; empty if self-contained
+};
+
+/// Writes a backup file in the same pass that produces it. The file is written under a
+/// partial name beside path and committed to path by finish(), so a crash never leaves
+/// a torn file under a backup's name. Deletes the file if destroyed before finish().
+/// The catalog checksum comes from the same pass: compressStream() hashes what it writes
+/// here through its checksum stage, and copyFrom() hashes what it copies.
+class BackupFileWriter {
+public:
+    /// Creates the partial file for path; throws StorageError if it can't
+    explicit BackupFileWriter(const std::string& path);
+    ~BackupFileWriter();
+
+    BackupFileWriter(const BackupFileWriter&) = delete;
+    BackupFileWriter& operator=(const BackupFileWriter&) = delete;
+
+    /// Returns false if the file couldn't take the bytes
+    bool write(const char* data, size_t size);
+
+    /// This writer as the output of a codec
+    dbbackup::DataSink asSink();
+
+    /// Allocates bytes for the file up front without changing its size (fallocate), so
+    /// it isn't fragmented and the disk can't fill under it. finish() gives back what
+    /// the file didn't use. Best effort: does nothing where the filesystem can't.
+    void preallocate(uint64_t bytes);
+
+    /// Appends the whole file at sourcePath, hashing it into digest on the way. The kernel
+    /// moves the bytes (copy_file_range) where it can, so they are only read into user
+    /// space for the hash. Throws StorageError if the source can't be opened.
+    bool copyFrom(const std::string& sourcePath, dbbackup::Sha256& digest);
+
+    /// Closes the file and commits it (commitFile) to finalPath, or to the constructor's
+    /// path if empty. Throws StorageError if the file could not be completed.
+    void finish(const std::string& finalPath = "");
+
+    /// Bytes written so far
+    uint64_t size() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+/// Space a job has claimed in a storage directory for a file it is about to write.
+/// Claims are kept in a ledger (metadata/space.ledger, under flock) that every process
+/// using the directory consults, so concurrent backups can't all pass a free-space check
+/// and then fill the disk together. A claim stops counting against free space as its
+/// file takes up the space, and is dropped on release or once its process has exited.
+class SpaceReservation {
+public:
+    /// Claims bytes for the file at path. While other jobs' claims are in the way, waits
+    /// up to config.spaceWaitSeconds for them instead of failing. Throws StorageError if
+    /// the space doesn't come free, and at once if bytes is more than is free at all.
+    SpaceReservation(const dbbackup::StorageConfig& config, const std::string& path, uint64_t bytes);
+
+    /// Releases the claim
+    ~SpaceReservation();
+
+    SpaceReservation(const SpaceReservation&) = delete;
+    SpaceReservation& operator=(const SpaceReservation&) = delete;
+
+    /// Claimed bytes
+    uint64_t size() const { return bytes; }
+
+private:
+    std::string storageDir;
+    std::string path;
+    uint64_t bytes;
 };
 
 class LocalStorage {
@@ -20,9 +132,45 @@ public:
     /// Initialize local storage with given configuration
     explicit LocalStorage(const dbbackup::StorageConfig& config);
 
-    /// Store a backup file with rotation policy
+    /// Store a backup file with rotation policy.
+    /// With a compressor, an uncompressed source is compressed into storage and the
+    /// space check uses the compressor's estimate (measured by sampling in "auto" mode).
+    /// Without one the file goes in as it is: renamed if consumeSource and it is on the
+    /// same filesystem, else reflinked (btrfs, XFS, ...), else copied by the kernel, and
+    /// only read for its checksum. With consumeSource the source may be gone afterwards.
     /// Returns metadata of stored backup on success
-    BackupMetadata storeBackup(const std::string& sourcePath);
+    BackupMetadata storeBackup(const std::string& sourcePath,
+                               const dbbackup::Compressor* compressor = nullptr,
+                               bool consumeSource = false);
+
+    /// Adds a backup already written into the storage directory to the catalog.
+    /// base names the backup it is a delta against, if any. checksum is the one
+    /// BackupFileWriter took while writing the file; the file is read for it if empty.
+    BackupMetadata registerBackup(const std::string& backupPath, const std::string& base = "",
+                                  const std::string& checksum = "");
+
+    /// Newest catalogued backup a delta can be based on without its chain growing past
+    /// maxChainLength deltas; "" when the next backup should be self-contained
+    std::string deltaBase(size_t maxChainLength) const;
+
+    /// The backups needed to rebuild backupName: the self-contained one it starts from
+    /// first, backupName itself last. Throws StorageError if a link is missing.
+    std::vector<BackupMetadata> backupChain(const std::string& backupName) const;
+
+    /// Decompresses a backup into sink. A delta is rebuilt by walking its chain, holding
+    /// at most two uncompressed dumps on disk at a time.
+    bool streamBackup(const std::string& backupName, const dbbackup::CompressionConfig& compression,
+                      const dbbackup::DataSink& sink) const;
+
+    /// Points backupName's catalog entry at replacementPath, a file in the storage directory
+    /// holding the same backup (e.g. recompressed), with its size and checksum (taken from
+    /// the file if not given). Deltas based on it follow the rename. The old file is left
+    /// for the caller to remove.
+    BackupMetadata replaceBackup(const std::string& backupName, const std::string& replacementPath,
+                                 const std::string& checksum = "");
+
+    /// True if the backup still matches the checksum it was catalogued with
+    bool verifyChecksum(const BackupMetadata& metadata) const;
 
     /// Retrieve a backup file by name
     /// Returns path to the backup file
@@ -33,11 +181,11 @@ public:
     std::vector<BackupMetadata> listBackups() const;
 
     /// Delete a backup by name
-    /// Returns true if successful
+    /// Returns true if successful; throws StorageError if a delta is based on it
     bool deleteBackup(const std::string& backupName);
 
-    /// Clean old backups according to retention policy
-    /// Returns number of backups deleted
+    /// Clean old backups according to retention policy, keeping whatever the kept
+    /// deltas are based on. Returns number of backups deleted
     size_t cleanOldBackups(size_t keepCount);
 
     /// Get available storage space
@@ -49,5 +197,7 @@ private:
     std::string calculateChecksum(const std::string& filePath) const;
     void ensureStorageDirectory() const;
     void saveMetadata(const BackupMetadata& metadata) const;
+    void updateMetadata(const std::function<bool(std::vector<BackupMetadata>&)>& update) const;
+    void writeMetadata(const std::vector<BackupMetadata>& metadata) const;
     std::vector<BackupMetadata> loadMetadata() const;
 };
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace dbbackup {
+
+/// Fixed-size pool of worker threads for CPU-bound jobs such as block compression.
+/// Jobs run in submission order; results come back through std::future.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threadCount) {
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        workers.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; i++) {
+            workers.emplace_back([this]() { runWorker(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    /// Queues job for execution. Exceptions thrown by job are rethrown by future::get().
+    template <typename Job>
+    auto submit(Job job) -> std::future<std::invoke_result_t<Job>> {
+        using Result = std::invoke_result_t<Job>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(job));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.emplace_back([task]() { (*task)(); });
+        }
+        wakeup.notify_one();
+        return result;
+    }
+
+    /// Number of threads to use when a config asks for "all cores" (0)
+    static size_t resolveThreadCount(int configured) {
+        if (configured > 0) {
+            return static_cast<size_t>(configured);
+        }
+        unsigned hardware = std::thread::hardware_concurrency();
+        return hardware > 0 ? hardware : 1;
+    }
+
+private:
+    void runWorker() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return;  // stopping and drained
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+};
+
+} // namespace dbbackup
@@ -1,10 +1,20 @@
 #include <gtest/gtest.h>
 #include "../include/compression.hpp"
+#include "../src/dictionary_store.hpp"
+#include "../src/codec_pipeline.hpp"
+#include "../src/checksum.hpp"
+#include "../src/compression_bench.hpp"
+#include "../src/parallel_inflate.hpp"
+#include "../src/io_engine.hpp"
 #include "../include/config.hpp"
 #include "../include/error/DatabaseBackupError.hpp"
+#include <cctype>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <random>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 using namespace dbbackup;
@@ -220,4 +230,1105 @@ TEST_F(CompressionTest, EstimateCompressedSize) {
     // For compressible data, actual size can be much smaller than estimated
     size_t actualPatternSize = fs::file_size(patternCompressedPath);
     EXPECT_LT(actualPatternSize, estimatedSize);  // Should compress better than estimated
-} 
\ No newline at end of file
+} 
+TEST_F(CompressionTest, CompressStreamMatchesFileContent) {
+    fs::path inputPath = testDir / "stream_input.txt";
+    fs::path compressedPath = testDir / "stream_compressed.gz";
+    fs::path decompressedPath = testDir / "stream_decompressed.txt";
+
+    createTestFile(inputPath.string(), 1024 * 1024);
+    auto originalContent = readFileContent(inputPath.string());
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.level = "medium";
+
+    Compressor compressor(config);
+
+    // Push the content in uneven pieces, as a dump pipe would deliver it
+    EXPECT_TRUE(compressor.compressStream([&](const DataSink& sink) {
+        size_t offset = 0;
+        size_t piece = 1000;
+        while (offset < originalContent.size()) {
+            size_t n = std::min(piece, originalContent.size() - offset);
+            if (!sink(originalContent.data() + offset, n)) {
+                return false;
+            }
+            offset += n;
+            piece = piece * 3 % 70000 + 1;
+        }
+        return true;
+    }, compressedPath.string()));
+
+    EXPECT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(originalContent, readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, CompressStreamFailsWhenProducerFails) {
+    fs::path compressedPath = testDir / "failed_stream.gz";
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.level = "medium";
+
+    Compressor compressor(config);
+    EXPECT_THROW(compressor.compressStream([](const DataSink&) { return false; },
+                                           compressedPath.string()),
+                 CompressionError);
+}
+
+TEST_F(CompressionTest, CompressStreamHashesWhatItWrites) {
+    fs::path inputPath = testDir / "hashed.sql";
+    createTestFile(inputPath.string(), 3 * 1024 * 1024);
+    auto content = readFileContent(inputPath.string());
+
+    std::vector<std::string> formats = Compressor::availableFormats();
+    formats.push_back("auto");
+    for (const auto& format : formats) {
+        for (int threads : {1, 4}) {
+            CompressionConfig config;
+            config.enabled = true;
+            config.format = format;
+            config.threads = threads;
+            config.transform = "sql";
+            Compressor compressor(config);
+
+            std::vector<char> compressed;
+            Sha256 digest;
+            ASSERT_TRUE(compressor.compressStream(memorySource(content.data(), content.size()),
+                                                  memorySink(compressed), &digest)) << format;
+            Sha256 expected;
+            expected.update(compressed.data(), compressed.size());
+            EXPECT_EQ(digest.finish(), expected.finish()) << format << " x" << threads;
+
+            std::vector<char> restored;
+            ASSERT_TRUE(compressor.decompressStream(memorySource(compressed.data(), compressed.size()),
+                                                    memorySink(restored))) << format;
+            EXPECT_TRUE(restored == content) << format << " x" << threads;
+        }
+    }
+}
+
+TEST_F(CompressionTest, DecompressStreamDeliversOriginalContent) {
+    fs::path inputPath = testDir / "dstream_input.txt";
+    fs::path compressedPath = testDir / "dstream_compressed.gz";
+
+    createTestFile(inputPath.string(), 2 * 1024 * 1024);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.level = "low";
+
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+
+    std::vector<char> streamed;
+    EXPECT_TRUE(compressor.decompressStream(compressedPath.string(), [&](const char* data, size_t size) {
+        streamed.insert(streamed.end(), data, data + size);
+        return true;
+    }));
+    EXPECT_EQ(readFileContent(inputPath.string()), streamed);
+
+    // A consumer that goes away must stop decompression with an error
+    EXPECT_THROW(compressor.decompressStream(compressedPath.string(),
+                                             [](const char*, size_t) { return false; }),
+                 CompressionError);
+}
+
+TEST_F(CompressionTest, ParallelGzipRoundTrip) {
+    fs::path inputPath = testDir / "parallel_input.txt";
+    fs::path compressedPath = testDir / "parallel_compressed.gz";
+    fs::path decompressedPath = testDir / "parallel_decompressed.txt";
+
+    // Several blocks plus a partial tail, mixing compressible and random data
+    createTestFile(inputPath.string(), 3 * 1024 * 1024 + 12345);
+    {
+        std::ofstream append(inputPath, std::ios::binary | std::ios::app);
+        std::mt19937 gen(42);
+        for (int i = 0; i < 512 * 1024; i++) {
+            append.put(static_cast<char>(gen() & 0xff));
+        }
+    }
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.level = "medium";
+    config.threads = 4;
+
+    Compressor compressor(config);
+    EXPECT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_LT(fs::file_size(compressedPath), fs::file_size(inputPath));
+
+    // Output is one ordinary gzip member, readable by the serial inflater
+    EXPECT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, ParallelGzipEmptyInput) {
+    fs::path inputPath = testDir / "empty_input.txt";
+    fs::path compressedPath = testDir / "empty_compressed.gz";
+    fs::path decompressedPath = testDir / "empty_decompressed.txt";
+    std::ofstream(inputPath.string()).close();
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.level = "medium";
+    config.threads = 4;
+
+    Compressor compressor(config);
+    EXPECT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(fs::file_size(decompressedPath), 0u);
+}
+
+TEST_F(CompressionTest, IndexedGzipRoundTripAndDetection) {
+    fs::path inputPath = testDir / "indexed_input.txt";
+    fs::path compressedPath = testDir / "indexed_compressed.gz";
+    fs::path decompressedPath = testDir / "indexed_decompressed.txt";
+
+    createTestFile(inputPath.string(), 5 * 1024 * 1024 + 777);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip-indexed";
+    config.level = "medium";
+    config.threads = 4;
+
+    Compressor compressor(config);
+    EXPECT_EQ(compressor.getFileExtension(), ".gz");
+    EXPECT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_TRUE(Compressor::isIndexedGzip(compressedPath.string()));
+
+    // A plain gzip compressor detects the format from the file and reads it
+    CompressionConfig gzipConfig;
+    gzipConfig.enabled = true;
+    gzipConfig.format = "gzip";
+    Compressor reader(gzipConfig);
+    EXPECT_TRUE(reader.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, PlainGzipIsNotIndexed) {
+    fs::path inputPath = testDir / "plain_input.txt";
+    fs::path compressedPath = testDir / "plain_compressed.gz";
+    createTestFile(inputPath.string(), 4096);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_FALSE(Compressor::isIndexedGzip(compressedPath.string()));
+}
+
+TEST_F(CompressionTest, DecompressConcatenatedGzipMembers) {
+    fs::path firstPath = testDir / "first.txt";
+    fs::path secondPath = testDir / "second.txt";
+    fs::path firstGz = testDir / "first.gz";
+    fs::path secondGz = testDir / "second.gz";
+    fs::path joinedGz = testDir / "joined.gz";
+    fs::path decompressedPath = testDir / "joined.txt";
+
+    createTestFile(firstPath.string(), 100000);
+    createRandomFile(secondPath.string(), 50000);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.threads = 1;
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(firstPath.string(), firstGz.string()));
+    ASSERT_TRUE(compressor.compressFile(secondPath.string(), secondGz.string()));
+
+    {
+        std::ofstream joined(joinedGz, std::ios::binary);
+        auto first = readFileContent(firstGz.string());
+        auto second = readFileContent(secondGz.string());
+        joined.write(first.data(), first.size());
+        joined.write(second.data(), second.size());
+    }
+
+    EXPECT_TRUE(compressor.decompressFile(joinedGz.string(), decompressedPath.string()));
+    auto expected = readFileContent(firstPath.string());
+    auto tail = readFileContent(secondPath.string());
+    expected.insert(expected.end(), tail.begin(), tail.end());
+    EXPECT_EQ(expected, readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, ParallelInflateMatchesSerialOnPlainGzip) {
+    // Dump rows interleaved with BLOB-like runs, so there are dynamic and stored blocks
+    fs::path inputPath = testDir / "plain_input.bin";
+    std::vector<char> input;
+    {
+        std::mt19937 gen(42);
+        std::string rows;
+        while (rows.size() < 4 * 1024 * 1024) {
+            rows += "INSERT INTO orders VALUES (" + std::to_string(gen() % 100000) + ", 'customer " +
+                    std::to_string(gen() % 5000) + "', " + std::to_string(gen() % 1000) + ".99);\n";
+        }
+        const size_t piece = 512 * 1024;
+        for (size_t offset = 0; offset < rows.size(); offset += piece) {
+            input.insert(input.end(), rows.begin() + offset, rows.begin() + std::min(offset + piece, rows.size()));
+            for (size_t i = 0; i < piece; i++) {
+                input.push_back(static_cast<char>(gen()));
+            }
+        }
+        std::ofstream(inputPath, std::ios::binary).write(input.data(), input.size());
+    }
+
+    // One deflate stream from zlib, and the block-parallel writer's sync-flushed one
+    for (int threads : {1, 4}) {
+        fs::path compressedPath = testDir / ("plain_" + std::to_string(threads) + ".gz");
+        fs::path decompressedPath = testDir / ("plain_out_" + std::to_string(threads) + ".bin");
+        CompressionConfig config;
+        config.enabled = true;
+        config.format = "gzip";
+        config.threads = threads;
+        ASSERT_TRUE(Compressor(config).compressFile(inputPath.string(), compressedPath.string()));
+
+        // Small chunks put many guessed boundaries in the file
+        std::vector<char> inflated;
+        ASSERT_TRUE(inflateGzipParallel(compressedPath.string(), 4, memorySink(inflated), 64 * 1024));
+        EXPECT_EQ(inflated, input);
+
+        config.threads = 4;
+        ASSERT_GE(fs::file_size(compressedPath), 4 * PARALLEL_INFLATE_CHUNK);
+        ASSERT_TRUE(Compressor(config).decompressFile(compressedPath.string(), decompressedPath.string()));
+        EXPECT_EQ(readFileContent(decompressedPath.string()), input);
+    }
+
+    // A damaged CRC is still caught
+    fs::path damagedPath = testDir / "plain_1.gz";
+    {
+        std::fstream damaged(damagedPath, std::ios::in | std::ios::out | std::ios::binary);
+        damaged.seekp(-8, std::ios::end);
+        damaged.put('\x55');
+    }
+    std::vector<char> ignored;
+    EXPECT_THROW(inflateGzipParallel(damagedPath.string(), 4, memorySink(ignored), 64 * 1024), CompressionError);
+}
+
+TEST_F(CompressionTest, ParallelInflateSplitsHighlyExpandingChunks) {
+    // Long zero runs deflate near 1000:1, so each chunk reaches its output cap many times over
+    fs::path inputPath = testDir / "expanding_input.bin";
+    std::vector<char> input;
+    {
+        std::mt19937 gen(7);
+        while (input.size() < 24 * 1024 * 1024) {
+            input.insert(input.end(), 2 * 1024 * 1024 + gen() % 4096, '\0');
+            std::string row = "INSERT INTO events VALUES (" + std::to_string(gen()) + ");\n";
+            input.insert(input.end(), row.begin(), row.end());
+        }
+        std::ofstream(inputPath, std::ios::binary).write(input.data(), input.size());
+    }
+
+    fs::path compressedPath = testDir / "expanding.gz";
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.threads = 1;
+    ASSERT_TRUE(Compressor(config).compressFile(inputPath.string(), compressedPath.string()));
+    ASSERT_LT(fs::file_size(compressedPath) * PARALLEL_INFLATE_EXPANSION * 4, input.size());
+
+    for (size_t chunkSize : {size_t(4 * 1024), size_t(16 * 1024)}) {
+        std::vector<char> inflated;
+        ASSERT_TRUE(inflateGzipParallel(compressedPath.string(), 4, memorySink(inflated), chunkSize));
+        EXPECT_EQ(inflated, input);
+    }
+}
+
+TEST_F(CompressionTest, DetectFormatFromMagicBytes) {
+    fs::path inputPath = testDir / "detect_input.txt";
+    fs::path compressedPath = testDir / "detect_compressed.gz";
+    createTestFile(inputPath.string(), 1024);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+
+    EXPECT_EQ(Compressor::detectFormat(compressedPath.string()), "gzip");
+    EXPECT_EQ(Compressor::detectFormat(inputPath.string()), "");
+    EXPECT_EQ(Compressor::detectFormat((testDir / "missing.gz").string()), "");
+}
+
+#ifdef USE_ZSTD
+TEST_F(CompressionTest, ZstdRoundTrip) {
+    fs::path inputPath = testDir / "zstd_input.txt";
+    fs::path compressedPath = testDir / "zstd_compressed.zst";
+    fs::path decompressedPath = testDir / "zstd_decompressed.txt";
+    createTestFile(inputPath.string(), 200000);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "zstd";
+    config.threads = 1;
+    Compressor compressor(config);
+    EXPECT_EQ(compressor.getFileExtension(), ".zst");
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_LT(fs::file_size(compressedPath), fs::file_size(inputPath));
+    EXPECT_EQ(Compressor::detectFormat(compressedPath.string()), "zstd");
+
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, ZstdMultithreadedLongDistanceRoundTrip) {
+    fs::path inputPath = testDir / "zstd_mt_input.bin";
+    fs::path compressedPath = testDir / "zstd_mt_compressed.zst";
+    fs::path decompressedPath = testDir / "zstd_mt_decompressed.bin";
+    createRandomFile(inputPath.string(), 3 * 1024 * 1024);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "zstd";
+    config.level = "high";
+    config.threads = 4;
+    config.longDistance = true;
+    Compressor compressor(config);
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, ZstdRejectsTruncatedInput) {
+    fs::path inputPath = testDir / "zstd_trunc_input.txt";
+    fs::path compressedPath = testDir / "zstd_trunc.zst";
+    fs::path decompressedPath = testDir / "zstd_trunc.txt";
+    createRandomFile(inputPath.string(), 100000);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "zstd";
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    fs::resize_file(compressedPath, fs::file_size(compressedPath) / 2);
+
+    EXPECT_THROW(compressor.decompressFile(compressedPath.string(), decompressedPath.string()),
+                 CompressionError);
+}
+#endif
+
+#ifdef USE_XZ
+TEST_F(CompressionTest, XzRoundTrip) {
+    fs::path inputPath = testDir / "xz_input.txt";
+    fs::path compressedPath = testDir / "xz_compressed.xz";
+    fs::path decompressedPath = testDir / "xz_decompressed.txt";
+    createTestFile(inputPath.string(), 200000);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "xz";
+    config.level = "low";
+    config.threads = 1;
+    Compressor compressor(config);
+    EXPECT_EQ(compressor.getFileExtension(), ".xz");
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_LT(fs::file_size(compressedPath), fs::file_size(inputPath));
+    EXPECT_EQ(Compressor::detectFormat(compressedPath.string()), "xz");
+
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, XzParallelBlocksRoundTrip) {
+    fs::path inputPath = testDir / "xz_mt_input.bin";
+    fs::path compressedPath = testDir / "xz_mt_compressed.xz";
+    fs::path decompressedPath = testDir / "xz_mt_decompressed.bin";
+    fs::path serialPath = testDir / "xz_mt_serial.bin";
+    createRandomFile(inputPath.string(), 1024 * 1024 + 123);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "xz";
+    config.level = "low";
+    config.threads = 4;
+    config.blockSize = 128 * 1024;
+    Compressor compressor(config);
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+
+    // The same file also decodes as a plain stream
+    config.threads = 1;
+    Compressor serial(config);
+    ASSERT_TRUE(serial.decompressFile(compressedPath.string(), serialPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(serialPath.string()));
+}
+
+TEST_F(CompressionTest, XzRejectsTruncatedInput) {
+    fs::path inputPath = testDir / "xz_trunc_input.txt";
+    fs::path compressedPath = testDir / "xz_trunc.xz";
+    fs::path decompressedPath = testDir / "xz_trunc.txt";
+    createRandomFile(inputPath.string(), 100000);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "xz";
+    config.level = "low";
+    config.threads = 1;
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    fs::resize_file(compressedPath, fs::file_size(compressedPath) / 2);
+
+    EXPECT_THROW(compressor.decompressFile(compressedPath.string(), decompressedPath.string()),
+                 CompressionError);
+}
+#endif
+
+#ifdef USE_BZIP2
+TEST_F(CompressionTest, Bzip2ParallelRoundTrip) {
+    fs::path inputPath = testDir / "bz2_input.txt";
+    fs::path compressedPath = testDir / "bz2_compressed.bz2";
+    fs::path decompressedPath = testDir / "bz2_decompressed.txt";
+    fs::path serialPath = testDir / "bz2_serial.txt";
+    createTestFile(inputPath.string(), 2 * 1024 * 1024 + 77);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "bzip2";
+    config.threads = 4;
+    Compressor compressor(config);
+    EXPECT_EQ(compressor.getFileExtension(), ".bz2");
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_LT(fs::file_size(compressedPath), fs::file_size(inputPath));
+    EXPECT_EQ(Compressor::detectFormat(compressedPath.string()), "bzip2");
+
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+
+    // Multi-stream output also decodes on a single thread
+    config.threads = 1;
+    Compressor serial(config);
+    ASSERT_TRUE(serial.decompressFile(compressedPath.string(), serialPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(serialPath.string()));
+}
+
+TEST_F(CompressionTest, Bzip2EmptyInput) {
+    fs::path inputPath = testDir / "bz2_empty.txt";
+    fs::path compressedPath = testDir / "bz2_empty.bz2";
+    fs::path decompressedPath = testDir / "bz2_empty_out.txt";
+    createTestFile(inputPath.string(), 0);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "bzip2";
+    config.threads = 2;
+    Compressor compressor(config);
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_GT(fs::file_size(compressedPath), 0u);
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(fs::file_size(decompressedPath), 0u);
+}
+
+TEST_F(CompressionTest, Bzip2RejectsTruncatedInput) {
+    fs::path inputPath = testDir / "bz2_trunc_input.txt";
+    fs::path compressedPath = testDir / "bz2_trunc.bz2";
+    fs::path decompressedPath = testDir / "bz2_trunc.txt";
+    createRandomFile(inputPath.string(), 100000);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "bzip2";
+    config.threads = 1;
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    fs::resize_file(compressedPath, fs::file_size(compressedPath) / 2);
+
+    EXPECT_THROW(compressor.decompressFile(compressedPath.string(), decompressedPath.string()),
+                 CompressionError);
+}
+#endif
+
+#ifdef USE_LZ4
+TEST_F(CompressionTest, Lz4RoundTrip) {
+    fs::path inputPath = testDir / "lz4_input.txt";
+    fs::path compressedPath = testDir / "lz4_compressed.lz4";
+    fs::path decompressedPath = testDir / "lz4_decompressed.txt";
+    createTestFile(inputPath.string(), 3 * 1024 * 1024);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "lz4";
+    Compressor compressor(config);
+    EXPECT_EQ(compressor.getFileExtension(), ".lz4");
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    EXPECT_LT(fs::file_size(compressedPath), fs::file_size(inputPath));
+    EXPECT_EQ(Compressor::detectFormat(compressedPath.string()), "lz4");
+
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, Lz4RejectsTruncatedInput) {
+    fs::path inputPath = testDir / "lz4_trunc_input.txt";
+    fs::path compressedPath = testDir / "lz4_trunc.lz4";
+    fs::path decompressedPath = testDir / "lz4_trunc.txt";
+    createRandomFile(inputPath.string(), 100000);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "lz4";
+    config.level = "high";
+    Compressor compressor(config);
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    fs::resize_file(compressedPath, fs::file_size(compressedPath) / 2);
+
+    EXPECT_THROW(compressor.decompressFile(compressedPath.string(), decompressedPath.string()),
+                 CompressionError);
+}
+
+TEST_F(CompressionTest, Lz4EstimateIsRealistic) {
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "lz4";
+    Compressor compressor(config);
+
+    size_t inputSize = 10 * 1024 * 1024;
+    size_t estimate = compressor.estimateCompressedSize(inputSize);
+    EXPECT_GT(estimate, inputSize / 4);
+    EXPECT_LT(estimate, inputSize);
+}
+#endif
+
+TEST_F(CompressionTest, AutoPicksDensestCodecWhenEverythingIsFastEnough) {
+    fs::path inputPath = testDir / "auto_input.txt";
+    fs::path compressedPath = testDir / "auto_compressed";
+    fs::path gzipPath = testDir / "auto_reference.gz";
+    fs::path decompressedPath = testDir / "auto_decompressed.txt";
+    createTestFile(inputPath.string(), 512 * 1024);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "auto";
+    config.threads = 1;
+    config.targetThroughput = 0.001;
+    Compressor compressor(config);
+    EXPECT_EQ(compressor.getSelectedProfile(), nullptr);
+    EXPECT_EQ(compressor.getFileExtension(), "");
+
+    ASSERT_TRUE(compressor.compressFile(inputPath.string(), compressedPath.string()));
+    const CompressionProfile* profile = compressor.getSelectedProfile();
+    ASSERT_NE(profile, nullptr);
+    EXPECT_EQ(Compressor::detectFormat(compressedPath.string()).rfind(profile->format, 0), 0u);
+    EXPECT_FALSE(compressor.getFileExtension().empty());
+
+    // Nothing compresses this sample better than the pick
+    CompressionConfig gzipConfig;
+    gzipConfig.enabled = true;
+    gzipConfig.format = "gzip";
+    gzipConfig.level = "high";
+    gzipConfig.threads = 1;
+    ASSERT_TRUE(Compressor(gzipConfig).compressFile(inputPath.string(), gzipPath.string()));
+    double gzipRatio = static_cast<double>(fs::file_size(gzipPath)) / fs::file_size(inputPath);
+    EXPECT_LE(profile->ratio, gzipRatio + 1e-9);
+
+    // The recorded ratio drives the size estimate
+    EXPECT_LT(compressor.estimateCompressedSize(1000000), 1000000 * gzipRatio * 1.1 + 1025);
+
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, AutoStreamReplaysSampleIntoChosenCodec) {
+    fs::path inputPath = testDir / "auto_stream_input.bin";
+    fs::path compressedPath = testDir / "auto_stream_compressed";
+    fs::path decompressedPath = testDir / "auto_stream_decompressed.bin";
+    createTestFile(inputPath.string(), 5 * 1024 * 1024 + 99);
+    auto content = readFileContent(inputPath.string());
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "auto";
+    config.threads = 1;
+    config.targetThroughput = 1e9;  // Unreachable, so the fastest codec wins
+    Compressor compressor(config);
+
+    ASSERT_TRUE(compressor.compressStream([&](const DataSink& sink) {
+        for (size_t offset = 0; offset < content.size(); offset += 70000) {
+            if (!sink(content.data() + offset, std::min<size_t>(70000, content.size() - offset))) {
+                return false;
+            }
+        }
+        return true;
+    }, compressedPath.string()));
+    ASSERT_NE(compressor.getSelectedProfile(), nullptr);
+
+    ASSERT_TRUE(compressor.decompressFile(compressedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(content, readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, AutoStreamPropagatesProducerFailure) {
+    fs::path compressedPath = testDir / "auto_fail_compressed";
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "auto";
+    config.threads = 1;
+    Compressor compressor(config);
+
+    std::string data(100000, 'x');
+    EXPECT_THROW(compressor.compressStream([&](const DataSink& sink) {
+        sink(data.data(), data.size());
+        return false;
+    }, compressedPath.string()), CompressionError);
+}
+
+#ifdef USE_ZSTD
+TEST_F(CompressionTest, ZstdDictionaryTrainedFromBackupsShrinksSmallFiles) {
+    // A fleet of small, similar files: shared schema text with varying rows
+    std::vector<std::string> backups;
+    for (int i = 0; i < 40; i++) {
+        fs::path path = testDir / ("small_" + std::to_string(i) + ".db");
+        std::ofstream out(path, std::ios::binary);
+        out << "CREATE TABLE accounts (id INTEGER PRIMARY KEY, owner TEXT NOT NULL, balance REAL);\n";
+        for (int row = 0; row < 200; row++) {
+            out << "INSERT INTO accounts VALUES (" << (i * 1000 + row) << ", 'customer-"
+                << ((row * 7919 + i) % 4099) << "', " << (row * 13 % 997) << ".25);\n";
+        }
+        backups.push_back(path.string());
+    }
+
+    fs::path dictionaryDir = testDir / "dictionaries";
+    dbbackup::DictionaryStore store(dictionaryDir.string());
+    EXPECT_EQ(store.latestId(), 0u);
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "zstd";
+    config.threads = 1;
+    config.dictionaryDir = dictionaryDir.string();
+
+    uint32_t id = store.trainFromBackups(backups, config);
+    EXPECT_GE(id, 32768u);
+    EXPECT_EQ(store.latestId(), id);
+    EXPECT_TRUE(fs::exists(store.pathFor(id)));
+
+    fs::path plainPath = testDir / "plain.zst";
+    fs::path dictPath = testDir / "dict.zst";
+    fs::path restoredPath = testDir / "restored.db";
+
+    Compressor plain(config);
+    ASSERT_TRUE(plain.compressFile(backups[0], plainPath.string()));
+
+    config.dictionary = true;
+    Compressor withDictionary(config);
+    ASSERT_TRUE(withDictionary.compressFile(backups[0], dictPath.string()));
+    EXPECT_LT(fs::file_size(dictPath), fs::file_size(plainPath));
+
+    // Restore finds the dictionary from the frame header alone
+    config.dictionary = false;
+    ASSERT_TRUE(Compressor(config).decompressFile(dictPath.string(), restoredPath.string()));
+    EXPECT_EQ(readFileContent(backups[0]), readFileContent(restoredPath.string()));
+
+    // A second training run becomes the next version
+    EXPECT_EQ(store.trainFromBackups(backups, config), id + 1);
+
+    config.dictionaryDir.clear();
+    EXPECT_THROW(Compressor(config).decompressFile(dictPath.string(), restoredPath.string()),
+                 CompressionError);
+
+    // With the SQL transform on, zstd sees the transformed stream, so that is what trains
+    config.dictionaryDir = dictionaryDir.string();
+    config.dictionary = true;
+    config.transform = "sql";
+    fs::path untrainedPath = testDir / "untrained.zst";
+    fs::path trainedPath = testDir / "trained.zst";
+    ASSERT_TRUE(Compressor(config).compressFile(backups[0], untrainedPath.string()));
+    store.trainFromBackups(backups, config);
+    ASSERT_TRUE(Compressor(config).compressFile(backups[0], trainedPath.string()));
+    EXPECT_LT(fs::file_size(trainedPath), fs::file_size(untrainedPath));
+    ASSERT_TRUE(Compressor(config).decompressFile(trainedPath.string(), restoredPath.string()));
+    EXPECT_EQ(readFileContent(backups[0]), readFileContent(restoredPath.string()));
+}
+#endif
+
+TEST_F(CompressionTest, GzipStoresHighEntropyBlocksWithoutLosingRatio) {
+    // Text dump rows interleaved with incompressible BLOB-like runs
+    fs::path textPath = testDir / "mixed_text.txt";
+    fs::path blobPath = testDir / "mixed_blob.bin";
+    fs::path inputPath = testDir / "mixed_input.bin";
+    createTestFile(textPath.string(), 3 * 1024 * 1024);
+    createRandomFile(blobPath.string(), 3 * 1024 * 1024);
+    {
+        auto text = readFileContent(textPath.string());
+        auto blob = readFileContent(blobPath.string());
+        std::ofstream out(inputPath, std::ios::binary);
+        const size_t piece = 512 * 1024;
+        for (size_t offset = 0; offset < text.size(); offset += piece) {
+            out.write(text.data() + offset, std::min(piece, text.size() - offset));
+            out.write(blob.data() + offset, std::min(piece, blob.size() - offset));
+        }
+    }
+
+    for (int threads : {1, 4}) {
+        fs::path storedPath = testDir / ("mixed_stored_" + std::to_string(threads) + ".gz");
+        fs::path deflatedPath = testDir / ("mixed_deflated_" + std::to_string(threads) + ".gz");
+        fs::path decompressedPath = testDir / ("mixed_out_" + std::to_string(threads) + ".bin");
+
+        CompressionConfig config;
+        config.enabled = true;
+        config.format = "gzip";
+        config.threads = threads;
+        ASSERT_TRUE(Compressor(config).compressFile(inputPath.string(), storedPath.string()));
+
+        config.passthrough = false;
+        ASSERT_TRUE(Compressor(config).compressFile(inputPath.string(), deflatedPath.string()));
+        EXPECT_LE(fs::file_size(storedPath), fs::file_size(deflatedPath) * 1.01);
+
+        ASSERT_TRUE(Compressor(config).decompressFile(storedPath.string(), decompressedPath.string()));
+        EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+    }
+}
+
+TEST_F(CompressionTest, SqlTransformRoundTripsDumpsAndImprovesRatio) {
+    // pg_dump COPY block, mysqldump extended INSERTs and lines that only look like them
+    fs::path inputPath = testDir / "dump.sql";
+    {
+        std::mt19937 gen(42);
+        std::ofstream out(inputPath, std::ios::binary);
+        out << "--\n-- PostgreSQL database dump\n--\n\nSET client_encoding = 'UTF8';\n\n";
+        out << "COPY public.orders (id, customer, amount, status, note) FROM stdin;\n";
+        for (int id = 1; id <= 40000; id++) {
+            out << id << '\t' << 1000 + gen() % 5000 << '\t' << gen() % 100000 << '.' << gen() % 100
+                << '\t' << (id % 3 ? "shipped" : "pending") << '\t'
+                << (id % 7 ? "\\N" : "call before\\tdelivery") << '\n';
+        }
+        out << "1\tshort row\n-0\t007\n\\.\n\n";
+        for (int batch = 0; batch < 20; batch++) {
+            out << "INSERT INTO `users` VALUES ";
+            for (int row = 0; row < 500; row++) {
+                int id = batch * 500 + row;
+                out << (row ? "," : "") << '(' << id << ",'user" << id << "@example.com','O''Brien \\'x\\'',"
+                    << (id % 5 ? "NULL" : "POINT(1,2)") << ')';
+            }
+            out << ";\n";
+        }
+        out << "INSERT INTO t VALUES (1,2),(3);\n";
+        out << "INSERT INTO t VALUES (1,'unterminated);\n";
+        out << "COPY public.empty (id) FROM stdin;\n\\.\n";
+        out << "-- no trailing newline";
+    }
+
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.threads = 1;
+    fs::path plainPath = testDir / "dump_plain.gz";
+    ASSERT_TRUE(Compressor(config).compressFile(inputPath.string(), plainPath.string()));
+
+    config.transform = "sql";
+    fs::path transformedPath = testDir / "dump_transformed.gz";
+    ASSERT_TRUE(Compressor(config).compressFile(inputPath.string(), transformedPath.string()));
+    EXPECT_LT(fs::file_size(transformedPath), fs::file_size(plainPath) * 0.9);
+
+    // The inverse is picked up from the data, not from the config
+    config.transform = "none";
+    fs::path decompressedPath = testDir / "dump_restored.sql";
+    ASSERT_TRUE(Compressor(config).decompressFile(transformedPath.string(), decompressedPath.string()));
+    EXPECT_EQ(readFileContent(inputPath.string()), readFileContent(decompressedPath.string()));
+}
+
+TEST_F(CompressionTest, SqlTransformHandlesInputThatIsNotSql) {
+    CompressionConfig config;
+    config.enabled = true;
+    config.format = "gzip";
+    config.transform = "sql";
+    Compressor compressor(config);
+
+    fs::path randomPath = testDir / "random.bin";
+    createRandomFile(randomPath.string(), 256 * 1024);
+    std::vector<std::string> inputs = {"", std::string("\0HG", 3), "COPY t (a) FROM stdin;\n1\n2"};
+    auto random = readFileContent(randomPath.string());
+    inputs.emplace_back(random.begin(), random.end());
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        fs::path compressedPath = testDir / ("odd_" + std::to_string(i) + ".gz");
+        ASSERT_TRUE(compressor.compressStream([&](const DataSink& sink) {
+            // Uneven pieces so lines and records straddle writes
+            for (size_t offset = 0; offset < inputs[i].size(); offset += 7) {
+                if (!sink(inputs[i].data() + offset, std::min<size_t>(7, inputs[i].size() - offset))) {
+                    return false;
+                }
+            }
+            return true;
+        }, compressedPath.string()));
+
+        std::string restored;
+        ASSERT_TRUE(compressor.decompressStream(compressedPath.string(), [&](const char* data, size_t size) {
+            restored.append(data, size);
+            return true;
+        }));
+        EXPECT_EQ(inputs[i], restored);
+    }
+}
+
+namespace {
+    // Toy stages for checking that the pipeline composes; real codecs live in compression.cpp
+    struct UppercaseStage {
+        void init() {}
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            std::string upper(input.data, input.size);
+            for (char& c : upper) {
+                c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            }
+            out(upper.data(), upper.size());
+        }
+
+        template <typename Out>
+        void finish(Out& out) {
+            out("!", 1);
+        }
+    };
+
+    struct ByteCountStage {
+        size_t* total;
+
+        void init() { *total = 0; }
+
+        template <typename Out>
+        void process(ByteSpan input, Out& out) {
+            *total += input.size;
+            out(input.data, input.size);
+        }
+
+        template <typename Out>
+        void finish(Out&) {}
+    };
+}
+
+TEST_F(CompressionTest, CodecStagesChainUnderOneDriver) {
+    size_t total = 0;
+    auto stages = chain(UppercaseStage{}, ByteCountStage{&total});
+
+    std::vector<char> written;
+    ASSERT_TRUE(compressToSink(stages, [](const DataSink& sink) {
+        return sink("select ", 7) && sink("1;", 2);
+    }, memorySink(written)));
+    EXPECT_EQ(std::string(written.begin(), written.end()), "SELECT 1;!");
+    EXPECT_EQ(total, 10u);
+
+    std::vector<char> restored;
+    ASSERT_TRUE(decompressFromSource(stages, memorySource(written.data(), written.size()),
+                                     memorySink(restored)));
+    EXPECT_EQ(std::string(restored.begin(), restored.end()), "SELECT 1;!!");
+}
+
+TEST_F(CompressionTest, WriterAndReaderStreamThroughAPipe) {
+    std::string input;
+    for (int i = 0; i < 20000; i++) {
+        input += "INSERT INTO t VALUES (" + std::to_string(i) + ", 'row');\n";
+    }
+
+    for (const char* format : {"gzip", "zstd", "xz", "bzip2", "lz4"}) {
+        CompressionConfig config;
+        config.format = format;
+        Compressor compressor(config);
+
+        // Compress in small pushes into memory
+        std::vector<char> compressed;
+        CompressionWriter writer(compressor, memorySink(compressed));
+        for (size_t offset = 0; offset < input.size(); offset += 1000) {
+            ASSERT_TRUE(writer.write(input.data() + offset, std::min<size_t>(1000, input.size() - offset)));
+        }
+        ASSERT_TRUE(writer.flush());
+        ASSERT_TRUE(writer.finish()) << format;
+
+        // Decompress from the read end of a pipe, detecting the codec from the stream
+        CompressionConfig autoConfig;
+        autoConfig.format = "auto";
+        Compressor detector(autoConfig);
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        std::thread feeder([&]() {
+            fdSink(fds[1])(compressed.data(), compressed.size());
+            close(fds[1]);
+        });
+        std::string restored;
+        {
+            DecompressionReader reader(detector, fdSource(fds[0]));
+            char buffer[777];
+            size_t got;
+            while ((got = reader.read(buffer, sizeof(buffer))) > 0) {
+                restored.append(buffer, got);
+            }
+        }
+        feeder.join();
+        close(fds[0]);
+        EXPECT_EQ(input, restored) << format;
+    }
+}
+
+TEST_F(CompressionTest, ReaderReportsCorruptStreams) {
+    std::vector<char> garbage(4096, 'x');
+    CompressionConfig config;
+    config.format = "auto";
+    Compressor compressor(config);
+
+    DecompressionReader reader(compressor, memorySource(garbage.data(), garbage.size()));
+    char buffer[64];
+    EXPECT_THROW(reader.read(buffer, sizeof(buffer)), CompressionError);
+}
+
+TEST_F(CompressionTest, BenchmarkMeasuresEveryCodecOnTheDecompressedBackup) {
+    std::string dump;
+    for (int i = 0; i < 5000; i++) {
+        dump += "INSERT INTO t VALUES (" + std::to_string(i) + ", 'bench');\n";
+    }
+    fs::path dumpPath = testDir / "bench.sql";
+    std::ofstream(dumpPath, std::ios::binary) << dump;
+
+    // A compressed backup is benchmarked on its contents, not its compressed bytes
+    CompressionConfig config;
+    config.format = "zstd";
+    fs::path backupPath = testDir / "bench.sql.zst";
+    ASSERT_TRUE(Compressor(config).compressFile(dumpPath.string(), backupPath.string()));
+    std::vector<char> sample = loadBenchSample(backupPath.string(), 1024 * 1024, config);
+    ASSERT_EQ(std::string(sample.begin(), sample.end()), dump);
+
+    std::vector<CodecBenchmark> results = benchmarkCodecs(sample, CompressionConfig(), {1, 2}, testDir.string());
+    ASSERT_EQ(results.size(), Compressor::availableFormats().size() * 3 * 2);
+    for (const auto& result : results) {
+        EXPECT_TRUE(result.error.empty()) << result.format << " " << result.level << ": " << result.error;
+        EXPECT_GT(result.ratio, 0.0);
+        EXPECT_LT(result.ratio, 0.5) << result.format << " " << result.level;
+        EXPECT_GT(result.compressMBps, 0.0);
+        EXPECT_GT(result.decompressMBps, 0.0);
+        EXPECT_GT(result.peakRssKB, 0u);
+    }
+}
+
+TEST_F(CompressionTest, ZstdDeltaStoresOnlyWhatChanged) {
+    // Two nights of the same table with a few rows changed
+    std::mt19937 gen(42);
+    std::string yesterday;
+    for (int i = 0; i < 20000; i++) {
+        yesterday += std::to_string(i) + "\t" + std::to_string(gen()) + "\t" + std::to_string(gen()) + "\n";
+    }
+    std::string today = yesterday;
+    for (size_t pos = 1000; pos + 8 < today.size(); pos += today.size() / 50) {
+        today.replace(pos, 8, "CHANGED!");
+    }
+
+    fs::path referencePath = testDir / "yesterday.dump";
+    std::ofstream(referencePath, std::ios::binary) << yesterday;
+
+    CompressionConfig config;
+    config.format = "zstd";
+    Compressor compressor(config);
+
+    fs::path fullPath = testDir / "today.dump.zst";
+    fs::path deltaPath = testDir / "today.delta.zst";
+    ASSERT_TRUE(compressor.compressStream(memorySource(today.data(), today.size()), fullPath.string()));
+    ASSERT_TRUE(compressor.compressDelta(memorySource(today.data(), today.size()), referencePath.string(),
+                                         deltaPath.string()));
+    EXPECT_LT(fs::file_size(deltaPath) * 10, fs::file_size(fullPath));
+
+    std::vector<char> restored;
+    ASSERT_TRUE(compressor.decompressDelta(deltaPath.string(), referencePath.string(), memorySink(restored)));
+    EXPECT_EQ(std::string(restored.begin(), restored.end()), today);
+
+    // Without its reference the delta does not decode
+    EXPECT_THROW(compressor.decompressStream(deltaPath.string(), memorySink(restored)), CompressionError);
+
+    CompressionConfig gzipConfig;
+    gzipConfig.format = "gzip";
+    EXPECT_THROW(Compressor(gzipConfig).compressDelta(memorySource(today.data(), today.size()),
+                                                      referencePath.string(), deltaPath.string()),
+                 ConfigurationError);
+}
+
+TEST_F(CompressionTest, IoEngineRoundTripsFilesOfAnySize) {
+    // Small blocks keep every queue slot busy; sizes straddle block boundaries
+    const size_t blockSize = 4096;
+    std::mt19937 gen(7);
+    for (size_t size : {size_t(0), size_t(1), blockSize, 3 * blockSize + 17, 64 * blockSize + 4095}) {
+        std::vector<char> input(size);
+        for (char& byte : input) {
+            byte = static_cast<char>(gen());
+        }
+        fs::path path = testDir / ("io_" + std::to_string(size) + ".bin");
+
+        // Writes arrive in odd pieces and start after bytes already in the file
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(::write(fd, "head", 4), 4);
+        {
+            BlockWriter writer(fd, blockSize);
+            for (size_t offset = 0; offset < size; offset += 1000) {
+                ASSERT_TRUE(writer.write(input.data() + offset, std::min<size_t>(1000, size - offset)));
+            }
+            ASSERT_TRUE(writer.flush());
+        }
+        ASSERT_EQ(::write(fd, "tail", 4), 4);
+        ::close(fd);
+
+        std::vector<char> expected(input);
+        expected.insert(expected.begin(), {'h', 'e', 'a', 'd'});
+        expected.insert(expected.end(), {'t', 'a', 'i', 'l'});
+        fd = ::open(path.c_str(), O_RDONLY);
+        ASSERT_GE(fd, 0);
+        std::vector<char> read;
+        EXPECT_TRUE(readBlocks(fd, memorySink(read), blockSize));
+        ::close(fd);
+        EXPECT_EQ(read, expected) << "size " << size << " via " << ioBackendName();
+    }
+
+    // A sink refusing data stops the read after the block it refused
+    std::vector<char> first;
+    EXPECT_FALSE(fileSource((testDir / "io_266239.bin").string(), blockSize)([&first](const char* data, size_t size) {
+        first.insert(first.end(), data, data + size);
+        return false;
+    }));
+    EXPECT_EQ(first.size(), blockSize);
+}
+
+TEST_F(CompressionTest, IoEngineCachePoliciesKeepDataIntact) {
+    std::mt19937 gen(11);
+    std::vector<char> input(20 * 1024 * 1024 + 100);  // Several drop-behind windows and an unaligned tail
+    for (char& byte : input) {
+        byte = static_cast<char>(gen());
+    }
+    fs::path path = testDir / "policy.bin";
+
+    for (CachePolicy policy : {CachePolicy::Buffered, CachePolicy::DropBehind, CachePolicy::Direct}) {
+        setCachePolicy(policy);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_GE(fd, 0);
+        {
+            BlockWriter writer(fd);
+            for (size_t offset = 0; offset < input.size(); offset += 300000) {
+                ASSERT_TRUE(writer.write(input.data() + offset, std::min<size_t>(300000, input.size() - offset)));
+            }
+            ASSERT_TRUE(writer.flush());
+        }
+
+        // The descriptor is handed back as it came, positioned after the data
+        EXPECT_EQ(fcntl(fd, F_GETFL) & O_DIRECT, 0);
+        EXPECT_EQ(lseek(fd, 0, SEEK_CUR), static_cast<off_t>(input.size()));
+        ::close(fd);
+
+        std::vector<char> read;
+        EXPECT_TRUE(fileSource(path.string())(memorySink(read)));
+        EXPECT_TRUE(read == input) << "policy " << static_cast<int>(policy);
+    }
+    setCachePolicy(CachePolicy::Buffered);
+
+    EXPECT_EQ(cachePolicyFromName("dropbehind"), CachePolicy::DropBehind);
+    EXPECT_THROW(cachePolicyFromName("nocache"), ConfigurationError);
+}
@@ -0,0 +1,352 @@
+#include <gtest/gtest.h>
+#include "../src/storage.hpp"
+#include "../src/recompress.hpp"
+#include "../src/checksum.hpp"
+#include "../src/dictionary_store.hpp"
+#include "../include/compression.hpp"
+#include "../include/config.hpp"
+#include "../include/error/DatabaseBackupError.hpp"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <openssl/sha.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace dbbackup;
+using namespace dbbackup::error;
+namespace fs = std::filesystem;
+
+class StorageTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        testDir = fs::temp_directory_path() / "storage_test";
+        fs::remove_all(testDir);
+        fs::create_directories(testDir);
+        config.localPath = testDir.string();
+    }
+
+    void TearDown() override {
+        fs::remove_all(testDir);
+    }
+
+    fs::path testDir;
+    StorageConfig config;
+};
+
+TEST_F(StorageTest, DeltaChainRestoresThroughEveryLink) {
+    CompressionConfig compression;
+    compression.format = "zstd";
+    Compressor compressor(compression);
+    LocalStorage storage(config);
+
+    // Night 1 is self-contained; each later night is a delta against the one before
+    std::vector<std::string> nights;
+    std::string dump;
+    for (int i = 0; i < 20000; i++) {
+        dump += "INSERT INTO t VALUES (" + std::to_string(i) + ", 'night 1');\n";
+    }
+    for (int night = 1; night <= 3; night++) {
+        dump.replace(night * 5000, 7, "night " + std::to_string(night));
+        nights.push_back(dump);
+
+        std::string name = "backup_" + std::to_string(night) + ".dump.zst";
+        std::string path = (testDir / name).string();
+        std::string base = storage.deltaBase(2);
+        EXPECT_EQ(base, night == 1 ? "" : "backup_" + std::to_string(night - 1) + ".dump.zst");
+
+        if (base.empty()) {
+            ASSERT_TRUE(compressor.compressStream(memorySource(dump.data(), dump.size()), path));
+        } else {
+            std::string reference = (testDir / "reference.dump").string();
+            std::vector<char> previous;
+            ASSERT_TRUE(storage.streamBackup(base, compression, memorySink(previous)));
+            std::ofstream(reference, std::ios::binary).write(previous.data(), previous.size());
+            ASSERT_TRUE(compressor.compressDelta(memorySource(dump.data(), dump.size()), reference, path));
+            fs::remove(reference);
+        }
+        storage.registerBackup(path, base);
+    }
+
+    // Two deltas in a row is the limit, so the next backup starts a new chain
+    EXPECT_EQ(storage.deltaBase(2), "");
+    ASSERT_EQ(storage.backupChain("backup_3.dump.zst").size(), 3u);
+
+    for (int night = 1; night <= 3; night++) {
+        std::vector<char> restored;
+        std::string name = "backup_" + std::to_string(night) + ".dump.zst";
+        ASSERT_TRUE(streamBackupChain((testDir / name).string(), compression, memorySink(restored)));
+        EXPECT_EQ(std::string(restored.begin(), restored.end()), nights[night - 1]);
+        EXPECT_EQ(isDeltaBackup((testDir / name).string()), night > 1);
+    }
+
+    // Jobs rebuilding the same chain at once each get their own scratch dumps
+    std::vector<std::vector<char>> concurrent(4);
+    std::vector<std::thread> jobs;
+    for (auto& restored : concurrent) {
+        jobs.emplace_back([&] {
+            EXPECT_TRUE(LocalStorage(config).streamBackup("backup_3.dump.zst", compression, memorySink(restored)));
+        });
+    }
+    for (auto& job : jobs) {
+        job.join();
+    }
+    for (const auto& restored : concurrent) {
+        EXPECT_EQ(std::string(restored.begin(), restored.end()), nights[2]);
+    }
+
+    // Nothing a kept delta needs may go, and rebuilds leave nothing behind
+    EXPECT_THROW(storage.deleteBackup("backup_1.dump.zst"), StorageError);
+    EXPECT_EQ(storage.cleanOldBackups(1), 0u);
+    EXPECT_EQ(storage.listBackups().size(), 3u);
+    size_t files = 0;
+    for (const auto& entry : fs::directory_iterator(testDir)) {
+        files += entry.is_regular_file() ? 1 : 0;
+    }
+    EXPECT_EQ(files, 3u);
+}
+
+TEST_F(StorageTest, DictionaryTrainsOnDeltaBackups) {
+    CompressionConfig compression;
+    compression.format = "zstd";
+    compression.threads = 1;
+    Compressor compressor(compression);
+    LocalStorage storage(config);
+
+    std::string dump;
+    for (int i = 0; i < 20000; i++) {
+        dump += "INSERT INTO accounts VALUES (" + std::to_string(i) + ", 'user" + std::to_string(i * 7919 % 4099) +
+                "', " + std::to_string(i * 13 % 997) + ".25);\n";
+    }
+    std::string fullPath = (testDir / "backup_1.dump.zst").string();
+    ASSERT_TRUE(compressor.compressStream(memorySource(dump.data(), dump.size()), fullPath));
+    storage.registerBackup(fullPath);
+
+    std::string reference = (testDir / "reference.dump").string();
+    std::ofstream(reference, std::ios::binary) << dump;
+    dump.replace(5000, 7, "night 2");
+    std::string deltaPath = (testDir / "backup_2.dump.zst").string();
+    ASSERT_TRUE(compressor.compressDelta(memorySource(dump.data(), dump.size()), reference, deltaPath));
+    fs::remove(reference);
+    storage.registerBackup(deltaPath, "backup_1.dump.zst");
+
+    // Newest first, so the delta is read before the backup it applies to
+    DictionaryStore store((testDir / "dictionaries").string());
+    uint32_t id = store.trainFromBackups({deltaPath, fullPath}, compression);
+    EXPECT_EQ(store.latestId(), id);
+}
+
+TEST_F(StorageTest, RecompressSwapsBackupsAndResumesAfterInterruption) {
+    CompressionConfig gzip;
+    gzip.format = "gzip";
+    LocalStorage storage(config);
+
+    std::vector<std::string> dumps;
+    for (int night = 1; night <= 3; night++) {
+        std::string dump;
+        for (int i = 0; i < 5000; i++) {
+            dump += "INSERT INTO t VALUES (" + std::to_string(i) + ", 'night " + std::to_string(night) + "');\n";
+        }
+        dumps.push_back(dump);
+        std::string path = (testDir / ("backup_" + std::to_string(night) + ".dump.gz")).string();
+        ASSERT_TRUE(Compressor(gzip).compressStream(memorySource(dump.data(), dump.size()), path));
+        storage.registerBackup(path);
+    }
+
+    // A run killed after backup_1's replacement went into place but before the catalog changed
+    CompressionConfig zstd;
+    zstd.format = "zstd";
+    ASSERT_TRUE(Compressor(zstd).compressStream(memorySource(dumps[0].data(), dumps[0].size()),
+                                                (testDir / "backup_1.dump.zst").string()));
+    fs::create_directories(testDir / "metadata");
+    std::ofstream(testDir / "metadata" / "recompress.journal") << "backup_1.dump.gz\nbackup_1.dump.zst\n";
+    std::ofstream(testDir / ".tmp_recompress_backup_2.dump.zst") << "half-written";
+
+    RecompressOptions options;
+    options.target = zstd;
+    RecompressStats stats = recompressBackups(config, gzip, options);
+    EXPECT_EQ(stats.converted, 2u);
+    EXPECT_EQ(stats.skipped, 1u);
+    EXPECT_EQ(stats.failed, 0u);
+
+    std::vector<BackupMetadata> backups = LocalStorage(config).listBackups();
+    ASSERT_EQ(backups.size(), 3u);
+    for (int night = 1; night <= 3; night++) {
+        std::string name = "backup_" + std::to_string(night) + ".dump.zst";
+        EXPECT_FALSE(fs::exists(testDir / ("backup_" + std::to_string(night) + ".dump.gz")));
+        EXPECT_EQ(Compressor::detectFormat((testDir / name).string()), "zstd");
+        EXPECT_TRUE(LocalStorage(config).verifyChecksum(backups[night - 1]));
+        EXPECT_EQ(backups[night - 1].filename, name);
+
+        std::vector<char> restored;
+        ASSERT_TRUE(Compressor(zstd).decompressStream((testDir / name).string(), memorySink(restored)));
+        EXPECT_EQ(std::string(restored.begin(), restored.end()), dumps[night - 1]);
+    }
+    EXPECT_FALSE(fs::exists(testDir / "metadata" / "recompress.journal"));
+    EXPECT_FALSE(fs::exists(testDir / ".tmp_recompress_backup_2.dump.zst"));
+
+    // Nothing left to do the second time round
+    stats = recompressBackups(config, gzip, options);
+    EXPECT_EQ(stats.converted, 0u);
+    EXPECT_EQ(stats.skipped, 3u);
+}
+
+TEST_F(StorageTest, StoredBackupChecksumCoversWholeFile) {
+    // Not a multiple of the 4 KB the checksum used to be read in
+    std::string dump;
+    for (int i = 0; i < 3000; i++) {
+        dump += "INSERT INTO t VALUES (" + std::to_string(i) + ");\n";
+    }
+    ASSERT_NE(dump.size() % 4096, 0u);
+    fs::path source = testDir / "incoming.sql";
+    std::ofstream(source, std::ios::binary) << dump;
+
+    auto sha256Of = [](const fs::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size(), hash);
+        std::ostringstream hex;
+        for (unsigned char byte : hash) {
+            hex << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte);
+        }
+        return hex.str();
+    };
+
+    CompressionConfig compression;
+    compression.format = "gzip";
+    Compressor compressor(compression);
+    LocalStorage storage(config);
+    for (const Compressor* codec : std::vector<const Compressor*>{nullptr, &compressor}) {
+        BackupMetadata stored = storage.storeBackup(source.string(), codec);
+        fs::path path = testDir / stored.filename;
+        EXPECT_EQ(stored.size, fs::file_size(path));
+        EXPECT_EQ(stored.checksum, sha256Of(path));
+        EXPECT_TRUE(storage.verifyChecksum(stored));
+    }
+}
+
+TEST_F(StorageTest, UncompressedBackupIsCopiedOrMovedIntoStorage) {
+    std::string dump(3 * 1024 * 1024 + 11, 'x');
+    for (size_t i = 0; i < dump.size(); i += 97) {
+        dump[i] = static_cast<char>('a' + i % 26);
+    }
+    fs::path kept = testDir / "kept.sql";
+    fs::path handedOver = testDir / "handed_over.sql";
+    std::ofstream(kept, std::ios::binary) << dump;
+    std::ofstream(handedOver, std::ios::binary) << dump;
+
+    LocalStorage storage(config);
+    BackupMetadata copied = storage.storeBackup(kept.string());
+    BackupMetadata moved = storage.storeBackup(handedOver.string(), nullptr, true);
+
+    // The source survives a copy, but not a move on the same filesystem
+    EXPECT_TRUE(fs::exists(kept));
+    EXPECT_FALSE(fs::exists(handedOver));
+    for (const BackupMetadata& stored : {copied, moved}) {
+        std::ifstream in(testDir / stored.filename, std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        EXPECT_TRUE(contents == dump) << stored.filename;
+        EXPECT_EQ(stored.size, dump.size());
+        EXPECT_TRUE(storage.verifyChecksum(stored));
+    }
+    EXPECT_EQ(copied.checksum, moved.checksum);
+}
+
+TEST_F(StorageTest, SpaceReservationsQueueBehindEachOther) {
+    config.spaceWaitSeconds = 0;
+    const uint64_t gigabyte = 1024ULL * 1024 * 1024;
+    uint64_t available = fs::space(testDir).available;
+    ASSERT_GT(available, 2 * gigabyte);
+
+    // With most of the disk claimed, a job that would fit an empty disk can't get in
+    // until the claim is released
+    {
+        auto held = std::make_unique<SpaceReservation>(config, (testDir / "first.dump").string(),
+                                                       available - 64 * 1024 * 1024);
+        EXPECT_THROW(SpaceReservation(config, (testDir / "second.dump").string(), gigabyte), StorageError);
+
+        // More than is free fails without waiting out other claims
+        config.spaceWaitSeconds = 3600;
+        auto start = std::chrono::steady_clock::now();
+        EXPECT_THROW(SpaceReservation(config, (testDir / "huge.dump").string(), available * 2), StorageError);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+        config.spaceWaitSeconds = 0;
+
+        held.reset();
+        EXPECT_NO_THROW(SpaceReservation(config, (testDir / "second.dump").string(), gigabyte));
+    }
+    EXPECT_THROW(SpaceReservation(config, (testDir / "huge.dump").string(), available * 2), StorageError);
+
+    // A preallocated file keeps only what was written
+    fs::path path = testDir / "preallocated.dump";
+    std::string data(100 * 1024, 'p');
+    {
+        SpaceReservation space(config, path.string(), 64 * 1024 * 1024);
+        BackupFileWriter output(path.string());
+        output.preallocate(space.size());
+        ASSERT_TRUE(output.write(data.data(), data.size()));
+        output.finish();
+    }
+    EXPECT_EQ(fs::file_size(path), data.size());
+    struct stat st;
+    ASSERT_EQ(::stat(path.c_str(), &st), 0);
+    EXPECT_LT(static_cast<uint64_t>(st.st_blocks) * 512, 1024ULL * 1024);
+}
+
+TEST_F(StorageTest, ConcurrentJobsShareCatalogCommits) {
+    LocalStorage storage(config);
+    std::vector<std::thread> jobs;
+    for (int i = 0; i < 8; i++) {
+        jobs.emplace_back([this, i] {
+            fs::path path = testDir / ("job_" + std::to_string(i) + ".dump");
+            std::string data(64 * 1024 + i, static_cast<char>('a' + i));
+            BackupFileWriter output(path.string());
+            ASSERT_TRUE(output.write(data.data(), data.size()));
+            output.finish();
+            dbbackup::Sha256 digest;
+            digest.update(data.data(), data.size());
+            LocalStorage(config).registerBackup(path.string(), "", digest.finish());
+        });
+    }
+    for (auto& job : jobs) {
+        job.join();
+    }
+
+    std::vector<BackupMetadata> catalog = storage.listBackups();
+    ASSERT_EQ(catalog.size(), 8u);
+    for (const BackupMetadata& stored : catalog) {
+        EXPECT_TRUE(storage.verifyChecksum(stored)) << stored.filename;
+    }
+    EXPECT_EQ(fs::file_size(testDir / "metadata" / "backups.pending"), 0u);
+
+    // A file only has its name once finished; one abandoned before that leaves nothing
+    {
+        BackupFileWriter abandoned((testDir / "abandoned.dump").string());
+        ASSERT_TRUE(abandoned.write("x", 1));
+    }
+
+    // A partial file of a job that died is cleaned up by the next one
+    pid_t child = fork();
+    if (child == 0) {
+        _exit(0);
+    }
+    waitpid(child, nullptr, 0);
+    fs::path orphan = testDir / (".partial_" + std::to_string(child) + "_crashed.dump");
+    std::ofstream(orphan) << "torn";
+    LocalStorage next(config);
+    EXPECT_FALSE(fs::exists(orphan));
+
+    for (const auto& entry : fs::directory_iterator(testDir)) {
+        std::string name = entry.path().filename().string();
+        EXPECT_EQ(name.find("partial"), std::string::npos) << name;
+        EXPECT_EQ(name.find("abandoned"), std::string::npos) << name;
+    }
+}